@@ -0,0 +1,486 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stb_image_write.h"
+#include "frame_ring.hpp"           // host_time_ms, the domain of write_job::capture_ms
+
+// What enqueue() does when the writer queue is full
+enum class backpressure_policy
+{
+    block,          // wait until a writer thread frees a slot
+    drop_oldest,    // discard the oldest queued frame to make room
+    drop_newest     // discard the frame being enqueued
+};
+
+inline bool parse_backpressure_policy(const std::string& name, backpressure_policy& policy)
+{
+    if (name == "block")            policy = backpressure_policy::block;
+    else if (name == "drop-oldest") policy = backpressure_policy::drop_oldest;
+    else if (name == "drop-newest") policy = backpressure_policy::drop_newest;
+    else return false;
+    return true;
+}
+
+// Error for a command-line option whose value the parse_* helpers rejected
+inline std::runtime_error invalid_value(const std::string& arg, const std::string& value)
+{
+    return std::runtime_error("Invalid value " + value + " for " + arg);
+}
+
+// Log-scale latency histogram with 8 buckets per doubling from 10 us (about 9% resolution),
+// safe to update from every writer thread
+class latency_histogram
+{
+public:
+    static const int bucket_count = 8 * 24;
+
+    void add(double ms)
+    {
+        int bucket = ms <= min_ms ? 0 : std::min(bucket_count - 1, int(std::log2(ms / min_ms) * 8.) + 1);
+        _buckets[bucket]++;
+        _count++;
+    }
+
+    void merge(const latency_histogram& other)
+    {
+        for (int i = 0; i < bucket_count; i++)
+            _buckets[i] += other._buckets[i].load();
+        _count += other._count.load();
+    }
+
+    uint64_t count() const { return _count; }
+
+    // Upper edge of the bucket holding the p-th percentile (0..100), 0 when empty
+    double percentile(double p) const
+    {
+        uint64_t total = _count, seen = 0;
+        if (!total)
+            return 0.;
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100. * total)));
+        for (int i = 0; i < bucket_count; i++)
+        {
+            seen += _buckets[i];
+            if (seen >= rank)
+                return min_ms * std::exp2(i / 8.);
+        }
+        return min_ms * std::exp2((bucket_count - 1) / 8.);
+    }
+
+private:
+    static constexpr double min_ms = 0.01;
+    std::atomic<uint64_t> _buckets[bucket_count] = {};
+    std::atomic<uint64_t> _count{ 0 };
+};
+
+// Per-device counters, updated by the producer and the writer threads without locking
+struct writer_stats
+{
+    std::atomic<uint64_t> enqueued{ 0 };
+    std::atomic<uint64_t> written{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<uint64_t> failed{ 0 };
+    std::atomic<uint64_t> bytes_written{ 0 };
+    std::atomic<int64_t>  queue_depth{ 0 };
+    std::atomic<int64_t>  max_queue_depth{ 0 };
+    latency_histogram     latency_ms;       // arrival on the host (or capture_ms) to written
+};
+
+// A single kept frame waiting to be encoded and written
+struct write_job
+{
+    std::string serial;
+    std::string filename;
+    rs2::frame frame;
+    std::shared_ptr<writer_stats> stats;
+    double capture_ms;      // host time the frame was handed over, 0 if unknown
+    rs2::frame reference;   // for temporal codecs: the stream's previous frame, none for a keyframe
+    bool derived;           // a post-processed copy: saved as its own file, not logged or appended again
+};
+
+// Bounded multi-producer / multi-consumer queue (Vyukov's sequence-numbered ring).
+// Push and pop never take a lock; a full or empty queue is reported to the caller.
+template<class T>
+class bounded_mpmc_queue
+{
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+public:
+    explicit bounded_mpmc_queue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        _mask = size - 1;
+        _cells.reset(new cell[size]);
+        for (size_t i = 0; i < size; i++)
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        _enqueue_pos.store(0, std::memory_order_relaxed);
+        _dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    bounded_mpmc_queue(const bounded_mpmc_queue&) = delete;
+    bounded_mpmc_queue& operator=(const bounded_mpmc_queue&) = delete;
+
+    bool try_push(T& value)
+    {
+        size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell& c = _cells[pos & _mask];
+            size_t seq = c.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    c.data = std::move(value);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value)
+    {
+        size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell& c = _cells[pos & _mask];
+            size_t seq = c.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(c.data);
+                    c.data = T();
+                    c.sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = _dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const { return _mask + 1; }
+
+private:
+    std::unique_ptr<cell[]> _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _enqueue_pos;
+    alignas(64) std::atomic<size_t> _dequeue_pos;
+};
+
+// Write a video frame's pixels as-is (no header), as the raw depth dumps always did
+inline size_t save_frame_raw_data(const std::string& filename, const rs2::frame& frame)
+{
+    auto image = frame.as<rs2::video_frame>();
+    if (!image)
+        return 0;
+
+    size_t size = size_t(image.get_height()) * image.get_stride_in_bytes();
+    std::ofstream outfile(filename.data(), std::ofstream::binary);
+    outfile.write(static_cast<const char*>(image.get_data()), size);
+    return outfile ? size : 0;
+}
+
+// Default sink: depth goes to a .raw dump, every other video stream to a png
+inline size_t save_frame_to_disk(const write_job& job)
+{
+    auto vf = job.frame.as<rs2::video_frame>();
+    if (!vf)
+        return 0;
+
+    if (vf.is<rs2::depth_frame>())
+        return save_frame_raw_data(job.filename, vf);
+
+    if (!stbi_write_png(job.filename.c_str(), vf.get_width(), vf.get_height(),
+        vf.get_bytes_per_pixel(), vf.get_data(), vf.get_stride_in_bytes()))
+        return 0;
+    return size_t(vf.get_height()) * vf.get_stride_in_bytes();
+}
+
+// Bounded producer/consumer stage between frame polling and the disk.
+// The capture side only hands over kept frame handles; a pool of writer
+// threads runs the sink (encode + write) for each of them.
+class async_frame_writer
+{
+public:
+    typedef std::function<size_t(const write_job&)> sink_fn; // returns bytes written, 0 on failure
+
+    async_frame_writer(sink_fn sink, size_t worker_count = 2, size_t capacity = 256,
+        backpressure_policy policy = backpressure_policy::block)
+        : _sink(sink), _queue(capacity), _policy(policy)
+    {
+        if (worker_count == 0) worker_count = 1;
+        for (size_t i = 0; i < worker_count; i++)
+            _workers.emplace_back([this]() { worker_loop(); });
+    }
+
+    ~async_frame_writer()
+    {
+        stop();
+    }
+
+    // Counters for a device; hold on to the pointer so enqueue() does not need a lookup
+    std::shared_ptr<writer_stats> stats_for(const std::string& serial)
+    {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        auto& stats = _stats[serial];
+        if (!stats)
+            stats = std::make_shared<writer_stats>();
+        return stats;
+    }
+
+    std::map<std::string, std::shared_ptr<writer_stats>> all_stats()
+    {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        return _stats;
+    }
+
+    // Returns false if this job was dropped under the drop_newest policy (or the writer is stopped)
+    bool enqueue(write_job job)
+    {
+        if (_stopping)
+            return false;
+        if (!job.stats)
+            job.stats = stats_for(job.serial);
+
+        auto stats = job.stats;
+        stats->enqueued++;
+        account_queued(*stats);
+        _pending++;
+
+        while (!_queue.try_push(job))
+        {
+            if (_policy == backpressure_policy::drop_newest || _stopping)
+            {
+                account_dropped(*stats);
+                return false;
+            }
+            if (_policy == backpressure_policy::drop_oldest)
+            {
+                write_job oldest;
+                if (_queue.try_pop(oldest))
+                {
+                    _queued--;
+                    account_dropped(*oldest.stats);
+                }
+            }
+            else if (push_blocking(job))
+            {
+                break;
+            }
+            else
+            {
+                account_dropped(*stats);
+                return false;
+            }
+        }
+
+        // The increment and the _sleepers load pair with the worker's increment of _sleepers
+        // and load of _queued: one side always sees the other, so a wakeup cannot be lost
+        _queued++;
+        if (_sleepers.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(_wake_mutex);
+            _wake.notify_one();
+        }
+        return true;
+    }
+
+    // Wait until everything enqueued so far has been written or dropped
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(_space_mutex);
+        _space_waiters++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (_pending.load() > 0)
+            _space.wait(lock);
+        _space_waiters--;
+    }
+
+    // Drain the queue and join the writer threads
+    void stop()
+    {
+        if (_workers.empty())
+            return;
+        flush();
+        _stopping = true;
+        {
+            std::lock_guard<std::mutex> lock(_wake_mutex);
+            _wake.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(_space_mutex);
+            _space.notify_all();
+        }
+        for (auto&& worker : _workers)
+            worker.join();
+        _workers.clear();
+    }
+
+    backpressure_policy policy() const { return _policy; }
+    size_t capacity() const { return _queue.capacity(); }
+
+private:
+    // End-to-end latency counts from the frame's arrival on the host, so time spent in
+    // librealsense's queues and the capture thread is included; frames without that
+    // metadata count from the hand-over
+    static double latency_start_ms(const write_job& job)
+    {
+        if (job.frame.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL))
+            return double(job.frame.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL));
+        return job.capture_ms;
+    }
+
+    void account_queued(writer_stats& stats)
+    {
+        auto depth = ++stats.queue_depth;
+        auto max = stats.max_queue_depth.load(std::memory_order_relaxed);
+        while (depth > max && !stats.max_queue_depth.compare_exchange_weak(max, depth)) {}
+    }
+
+    void account_dropped(writer_stats& stats)
+    {
+        stats.dropped++;
+        stats.queue_depth--;
+        _pending--;
+        notify_space();
+    }
+
+    // block policy: wait on _space for a writer to free a slot; false if the writer stopped first
+    bool push_blocking(write_job& job)
+    {
+        std::unique_lock<std::mutex> lock(_space_mutex);
+        _space_waiters++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pushed;
+        while (!(pushed = _queue.try_push(job)) && !_stopping)
+            _space.wait(lock);
+        _space_waiters--;
+        return pushed;
+    }
+
+    // Called after a slot is freed or a job finished. The fence pairs with the one in
+    // push_blocking()/flush(): either the waiter sees the change or we see the waiter.
+    void notify_space()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_space_waiters.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(_space_mutex);
+            _space.notify_all();
+        }
+    }
+
+    void worker_loop()
+    {
+        write_job job;
+        for (;;)
+        {
+            if (_queue.try_pop(job))
+            {
+                _queued--;
+                notify_space();
+                size_t bytes = 0;
+                try
+                {
+                    bytes = _sink(job);
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "Failed writing " << job.filename << ": " << e.what() << std::endl;
+                }
+
+                if (bytes)
+                {
+                    job.stats->written++;
+                    job.stats->bytes_written += bytes;
+                    double start_ms = latency_start_ms(job);
+                    if (start_ms > 0)
+                        job.stats->latency_ms.add(host_time_ms() - start_ms);
+                }
+                else
+                {
+                    job.stats->failed++;
+                }
+                job.stats->queue_depth--;
+                job = write_job();
+                _pending--;
+                notify_space();
+                continue;
+            }
+
+            if (_stopping)
+                return;
+
+            // Nothing to do - sleep until a producer queues a job or stop() is called
+            std::unique_lock<std::mutex> lock(_wake_mutex);
+            _sleepers++;
+            while (_queued.load() <= 0 && !_stopping)
+                _wake.wait(lock);
+            _sleepers--;
+        }
+    }
+
+    sink_fn _sink;
+    bounded_mpmc_queue<write_job> _queue;
+    backpressure_policy _policy;
+
+    std::vector<std::thread> _workers;
+    std::atomic<bool> _stopping{ false };
+    std::atomic<int64_t> _pending{ 0 };
+    std::atomic<int64_t> _queued{ 0 };      // jobs in _queue; can lag a push or pop briefly
+
+    std::mutex _wake_mutex;
+    std::condition_variable _wake;          // idle workers: a job was queued
+    std::atomic<int> _sleepers{ 0 };
+
+    std::mutex _space_mutex;
+    std::condition_variable _space;         // blocked producers and flush(): a slot was freed or a job finished
+    std::atomic<int> _space_waiters{ 0 };
+
+    std::mutex _stats_mutex;
+    std::map<std::string, std::shared_ptr<writer_stats>> _stats;
+};
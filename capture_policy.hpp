@@ -0,0 +1,311 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "frame_encoders.hpp"       // image_view
+#include "preset_config.hpp"        // preset_parser, the JSON reader
+#include "roi_manager.hpp"          // roi_fraction
+
+// Declarative save policy: which frames of which camera and stream are written, and how.
+//
+//   { "rules": [
+//       { "stream": "infrared", "save": false },
+//       { "serial": "819612070593", "stream": "depth", "every_nth": 3 },
+//       { "stream": "color", "max_fps": 5, "crop": [0.25, 0.25, 0.75, 0.75], "downscale": 2 },
+//       { "stream": "color", "index": 0, "on_change": ["actual_exposure", "gain_level"] } ] }
+//
+// The first rule whose serial ("*" or absent: any), stream type ("*" or absent: any) and
+// stream index (absent: any) match a frame decides for it; frames no rule matches are
+// all saved. A frame is saved when it passes every test its rule sets, in this order
+// (each test only sees the frames the previous ones let through):
+//
+//   save       false skips the stream entirely
+//   on_change  metadata (names as rs2_frame_metadata_to_string, any case, '_' for ' ')
+//              of which at least one must differ from the last saved frame
+//   every_nth  every Nth frame
+//   max_fps    at most this rate, by frame timestamp
+//
+// capture_filter makes the decision on the capture thread before a frame is kept or
+// queued, so a skipped frame costs neither a copy nor an encode. crop (fractions of the
+// image) and downscale (integer factor, nearest pixel so depth values stay real) are
+// applied by the writer threads just before encoding.
+
+struct policy_rule
+{
+    std::string serial = "*";
+    std::string stream = "*";   // lower-case rs2_stream_to_string: "depth", "color", "infrared", ...
+    int stream_index = -1;      // -1: any
+    bool save = true;
+    std::vector<rs2_frame_metadata_value> on_change;
+    int every_nth = 1;
+    double max_fps = 0;
+    bool crop = false;
+    roi_fraction crop_roi{ 0.f, 0.f, 1.f, 1.f };
+    int downscale = 1;
+
+    bool matches(const std::string& sn, const std::string& stream_name, int index) const
+    {
+        return (serial == "*" || serial == sn) && (stream == "*" || stream == stream_name) &&
+               (stream_index < 0 || stream_index == index);
+    }
+
+    bool transforms() const { return crop || downscale > 1; }
+};
+
+// "Actual Exposure" -> "actual_exposure"
+inline std::string policy_name(const std::string& s)
+{
+    std::string out;
+    for (char c : s)
+        out += c == ' ' ? '_' : char(tolower(static_cast<unsigned char>(c)));
+    return out;
+}
+
+class capture_policy
+{
+public:
+    // Without rules every frame is saved as it is
+    capture_policy() {}
+
+    static capture_policy load(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Failed to open capture policy " + path);
+        std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return parse(json);
+    }
+
+    static capture_policy parse(const std::string& json)
+    {
+        capture_policy policy;
+        std::map<int, policy_rule> rules;
+        for (auto&& kv : preset_parser(json).parse())
+        {
+            // rules.<n>.<field>[.<m>]
+            int rule = -1, item = -1;
+            char field[64] = {};
+            if (sscanf(kv.first.c_str(), "rules.%d.%63[^.].%d", &rule, field, &item) < 2 || rule < 0)
+                throw std::runtime_error("capture policy: unexpected key " + kv.first);
+            set_field(rules[rule], field, item, kv.second);
+        }
+        for (auto&& r : rules)
+            policy._rules.push_back(r.second);
+        return policy;
+    }
+
+    bool empty() const { return _rules.empty(); }
+    size_t size() const { return _rules.size(); }
+
+    // The rule for a stream; a save-everything rule when none matches
+    const policy_rule& rule_for(const std::string& serial, rs2_stream stream, int index) const
+    {
+        std::string name = policy_name(rs2_stream_to_string(stream));
+        for (auto&& r : _rules)
+        {
+            if (r.matches(serial, name, index))
+                return r;
+        }
+        return _save_all;
+    }
+
+private:
+    static void set_field(policy_rule& r, const std::string& field, int item, const std::string& value)
+    {
+        auto number = [&]()
+        {
+            char* end = nullptr;
+            double v = strtod(value.c_str(), &end);
+            if (value.empty() || *end)
+                throw std::runtime_error("capture policy: " + field + " must be a number");
+            return v;
+        };
+
+        if (field == "serial") r.serial = value;
+        else if (field == "stream") r.stream = policy_name(value);
+        else if (field == "index") r.stream_index = int(number());
+        else if (field == "save") r.save = value == "true";
+        else if (field == "every_nth") r.every_nth = std::max(1, int(number()));
+        else if (field == "max_fps") r.max_fps = number();
+        else if (field == "downscale") r.downscale = std::max(1, int(number()));
+        else if (field == "crop" && item >= 0 && item < 4)
+        {
+            float* bounds[] = { &r.crop_roi.min_x, &r.crop_roi.min_y, &r.crop_roi.max_x, &r.crop_roi.max_y };
+            *bounds[item] = float(number());
+            r.crop = true;
+        }
+        else if (field == "on_change")
+        {
+            // a single name or an array of names
+            for (int i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
+            {
+                auto key = rs2_frame_metadata_value(i);
+                if (policy_name(rs2_frame_metadata_to_string(key)) == policy_name(value))
+                {
+                    r.on_change.push_back(key);
+                    return;
+                }
+            }
+            throw std::runtime_error("capture policy: unknown metadata " + value);
+        }
+        else throw std::runtime_error("capture policy: unknown field " + field);
+    }
+
+    std::vector<policy_rule> _rules;
+    policy_rule _save_all;
+};
+
+// Applies a policy to the frames of every device. Each stream's decimation state belongs
+// to the thread that admits its frames, so admit() shares nothing but the counters.
+class capture_filter
+{
+    struct stream_state;
+
+public:
+    typedef std::map<int, stream_state> stream_states; // stream unique id -> state
+
+    explicit capture_filter(const capture_policy& policy) : _policy(policy) {}
+
+    const capture_policy& policy() const { return _policy; }
+
+    // Decides whether to save this frame of device `serial` and advances its stream's
+    // state in `states`, which the caller keeps for that device and never shares
+    bool admit(stream_states& states, const std::string& serial, const rs2::frame& f)
+    {
+        if (_policy.empty())
+            return true;
+
+        auto profile = f.get_profile();
+        auto& state = states[profile.unique_id()];
+        if (!state.rule)
+            state.rule = &_policy.rule_for(serial, profile.stream_type(), profile.stream_index());
+        bool saved = state.admit(f);
+        (saved ? _saved : _skipped)++;
+        return saved;
+    }
+
+    void print_report() const
+    {
+        printf("policy: %zu rules, saved=%llu skipped=%llu\n", _policy.size(),
+            (unsigned long long)_saved.load(), (unsigned long long)_skipped.load());
+    }
+
+private:
+    struct stream_state
+    {
+        const policy_rule* rule = nullptr;
+        uint64_t seen = 0;
+        double last_ms = 0;
+        double next_due_ms = 0;
+        bool has_last_saved = false;
+        std::vector<rs2_metadata_type> last_saved;
+
+        bool admit(const rs2::frame& f)
+        {
+            auto& r = *rule;
+            if (!r.save)
+                return false;
+
+            std::vector<rs2_metadata_type> values;
+            if (!r.on_change.empty())
+            {
+                for (auto key : r.on_change)
+                    values.push_back(f.supports_frame_metadata(key) ? f.get_frame_metadata(key) : 0);
+                if (has_last_saved && values == last_saved)
+                    return false;
+            }
+
+            if (r.every_nth > 1 && seen++ % uint64_t(r.every_nth) != 0)
+                return false;
+
+            if (r.max_fps > 0)
+            {
+                double t = f.get_timestamp();
+                double period = 1000. / r.max_fps;
+                // Half a source frame of slack, so jitter does not push us a whole frame late
+                double slack = last_ms > 0 && t > last_ms ? (t - last_ms) / 2 : 0;
+                last_ms = t;
+                if (next_due_ms > 0 && t + slack < next_due_ms)
+                    return false;
+                // Keep the cadence; restart it after a gap (or a clock reset)
+                next_due_ms = (next_due_ms > 0 && std::abs(t - next_due_ms) < period) ? next_due_ms + period : t + period;
+            }
+
+            if (!r.on_change.empty())
+            {
+                last_saved = values;
+                has_last_saved = true;
+            }
+            return true;
+        }
+    };
+
+    const capture_policy _policy;
+    std::atomic<uint64_t> _saved{ 0 };
+    std::atomic<uint64_t> _skipped{ 0 };
+};
+
+// Crops and downscales per the rule into `scratch`, rows packed; the image itself when
+// the rule changes nothing
+inline image_view transform_for_save(const policy_rule& rule, const image_view& in, std::vector<uint8_t>& scratch)
+{
+    if (!rule.transforms())
+        return in;
+
+    int x0 = 0, y0 = 0, x1 = in.width, y1 = in.height; // x1, y1 exclusive
+    if (rule.crop)
+    {
+        // Fractions are pixel edges: [0.25, 0.75] of 640 columns keeps 320 of them, at least one
+        auto edge = [](float v, int size) { return std::min(size, std::max(0, int(v * size))); };
+        x0 = std::min(edge(rule.crop_roi.min_x, in.width), in.width - 1);
+        y0 = std::min(edge(rule.crop_roi.min_y, in.height), in.height - 1);
+        x1 = std::max(x0 + 1, edge(rule.crop_roi.max_x, in.width));
+        y1 = std::max(y0 + 1, edge(rule.crop_roi.max_y, in.height));
+    }
+    int k = std::max(1, rule.downscale);
+    int bpp = in.bytes_per_pixel;
+    int w = std::max(1, (x1 - x0) / k);
+    int h = std::max(1, (y1 - y0) / k);
+    scratch.resize(size_t(w) * h * bpp);
+
+    for (int y = 0; y < h; y++)
+    {
+        const uint8_t* src = in.data + size_t(y0 + y * k) * in.stride + size_t(x0) * bpp;
+        uint8_t* dst = scratch.data() + size_t(y) * w * bpp;
+        if (k == 1)
+        {
+            memcpy(dst, src, size_t(w) * bpp);
+        }
+        else if (bpp == 2)
+        {
+            auto s = reinterpret_cast<const uint16_t*>(src);
+            auto d = reinterpret_cast<uint16_t*>(dst);
+            for (int x = 0; x < w; x++)
+                d[x] = s[x * k];
+        }
+        else
+        {
+            for (int x = 0; x < w; x++)
+                memcpy(dst + size_t(x) * bpp, src + size_t(x) * k * bpp, bpp);
+        }
+    }
+    return image_view{ scratch.data(), w, h, bpp, w * bpp };
+}
@@ -0,0 +1,240 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DEPTH_KERNELS_AVX2
+#endif
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define DEPTH_KERNELS_SSE41
+#endif
+
+// Depth preview and statistics kernels over raw Z16 buffers.
+//
+//   depth_colormap   - depth -> RGB8 through a 64K-entry lookup table built once for a
+//                      fixed near/far range (jet, holes black). AVX2 gathers 8 pixels at
+//                      a time, SSE4.1 packs 4; both fall back to scalar at row ends.
+//   depth_statistics - one pass over the ROI: min/max/mean of valid (non-zero) pixels,
+//                      valid ratio and a histogram, the vector part in SSE4.1/AVX2.
+//
+// Both take a row stride, so they work on rs2::depth_frame data directly.
+
+// Inclusive pixel bounds, the same convention as rs2::region_of_interest
+struct depth_roi
+{
+    int min_x, min_y, max_x, max_y;
+};
+
+class depth_colormap
+{
+public:
+    // near/far in depth units (millimeters at the default depth scale)
+    depth_colormap(uint16_t near_units = 300, uint16_t far_units = 4000)
+        : _lut(65536)
+    {
+        set_range(near_units, far_units);
+    }
+
+    void set_range(uint16_t near_units, uint16_t far_units)
+    {
+        _near = near_units;
+        _far = std::max<uint16_t>(uint16_t(near_units + 1), far_units);
+        _lut[0] = 0; // no data
+        for (uint32_t d = 1; d < 65536; d++)
+        {
+            float t = (float(std::min<uint32_t>(std::max<uint32_t>(d, _near), _far)) - _near) / float(_far - _near);
+            _lut[d] = jet(t);
+        }
+    }
+
+    uint16_t near_units() const { return _near; }
+    uint16_t far_units() const { return _far; }
+
+    // rgb: 3 bytes per pixel, rgb_stride bytes per row
+    void colorize(const uint16_t* depth, int width, int height, int depth_stride, uint8_t* rgb, int rgb_stride) const
+    {
+        for (int y = 0; y < height; y++)
+        {
+            auto src = reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) + size_t(y) * depth_stride);
+            colorize_row(src, width, rgb + size_t(y) * rgb_stride);
+        }
+    }
+
+private:
+    // Packed 0x00BBGGRR, so the low three bytes are the RGB8 output in memory order
+    static uint32_t jet(float t)
+    {
+        float r = std::min(1.f, std::max(0.f, 1.5f - std::fabs(4.f * t - 3.f)));
+        float g = std::min(1.f, std::max(0.f, 1.5f - std::fabs(4.f * t - 2.f)));
+        float b = std::min(1.f, std::max(0.f, 1.5f - std::fabs(4.f * t - 1.f)));
+        return uint32_t(r * 255.f + .5f) | (uint32_t(g * 255.f + .5f) << 8) | (uint32_t(b * 255.f + .5f) << 16);
+    }
+
+    void colorize_row(const uint16_t* src, int width, uint8_t* dst) const
+    {
+        const uint32_t* lut = _lut.data();
+        int x = 0;
+        // The vector stores write 4 bytes past their 12 (SSE) or 24 (AVX2) bytes of pixels,
+        // so they stop while at least 2 more pixels remain to be written over it
+#ifdef DEPTH_KERNELS_AVX2
+        const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                              0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for (; x + 10 <= width; x += 8)
+        {
+            __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x)));
+            __m256i px = _mm256_shuffle_epi8(_mm256_i32gather_epi32(reinterpret_cast<const int*>(lut), idx, 4), pack);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3), _mm256_castsi256_si128(px));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3 + 12), _mm256_extracti128_si256(px, 1));
+        }
+#elif defined(DEPTH_KERNELS_SSE41)
+        const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        for (; x + 6 <= width; x += 4)
+        {
+            __m128i px = _mm_setr_epi32(int(lut[src[x]]), int(lut[src[x + 1]]), int(lut[src[x + 2]]), int(lut[src[x + 3]]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3), _mm_shuffle_epi8(px, pack));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            uint32_t c = lut[src[x]];
+            dst[x * 3 + 0] = uint8_t(c);
+            dst[x * 3 + 1] = uint8_t(c >> 8);
+            dst[x * 3 + 2] = uint8_t(c >> 16);
+        }
+    }
+
+    uint16_t _near = 0, _far = 0;
+    std::vector<uint32_t> _lut;
+};
+
+struct depth_stats
+{
+    uint16_t min = 0, max = 0;      // over valid pixels, depth units
+    double mean = 0;
+    uint64_t valid = 0, total = 0;
+    double valid_ratio = 0;
+    int histogram_shift = 8;        // bin i counts valid depths in [i << shift, (i + 1) << shift)
+    std::vector<uint32_t> histogram;
+};
+
+// Fused statistics over the ROI (the whole frame when roi is null). Each row is reduced
+// with SIMD min/max/sum/zero-count and binned while it is still in L1.
+inline void depth_statistics(const uint16_t* depth, int width, int height, int depth_stride,
+    const depth_roi* roi, depth_stats& out, int histogram_shift = 8)
+{
+    int x0 = 0, y0 = 0, x1 = width - 1, y1 = height - 1;
+    if (roi)
+    {
+        x0 = std::max(0, roi->min_x); y0 = std::max(0, roi->min_y);
+        x1 = std::min(width - 1, roi->max_x); y1 = std::min(height - 1, roi->max_y);
+    }
+    out.histogram_shift = histogram_shift;
+    out.histogram.assign(size_t(65536) >> histogram_shift, 0);
+    out.valid = out.total = 0;
+    out.min = out.max = 0;
+    out.mean = out.valid_ratio = 0;
+    if (x1 < x0 || y1 < y0)
+        return;
+
+    uint32_t* hist = out.histogram.data();
+    std::vector<uint32_t> second(out.histogram.size(), 0);
+    uint32_t* hist2 = second.data();
+    uint16_t lo = std::numeric_limits<uint16_t>::max(), hi = 0;
+    uint64_t sum = 0, zeros = 0;
+    const int n = x1 - x0 + 1;
+
+    for (int y = y0; y <= y1; y++)
+    {
+        auto row = reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) + size_t(y) * depth_stride) + x0;
+        int x = 0;
+#ifdef DEPTH_KERNELS_AVX2
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            __m256i vmin = _mm256_set1_epi16(-1), vmax = zero, vzeros = zero, vsum = zero;
+            for (; x + 16 <= n; x += 16)
+            {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+                __m256i hole = _mm256_cmpeq_epi16(v, zero);
+                vmin = _mm256_min_epu16(vmin, _mm256_or_si256(v, hole));   // holes become 0xFFFF
+                vmax = _mm256_max_epu16(vmax, v);
+                vzeros = _mm256_sub_epi16(vzeros, hole);                   // -(-1) per hole
+                vsum = _mm256_add_epi32(vsum, _mm256_unpacklo_epi16(v, zero));
+                vsum = _mm256_add_epi32(vsum, _mm256_unpackhi_epi16(v, zero));
+            }
+            alignas(32) uint16_t mins[16], maxs[16], zs[16];
+            alignas(32) uint32_t sums[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(mins), vmin);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(zs), vzeros);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(sums), vsum);
+            for (int i = 0; i < 16; i++) { lo = std::min(lo, mins[i]); hi = std::max(hi, maxs[i]); zeros += zs[i]; }
+            for (int i = 0; i < 8; i++) sum += sums[i];
+        }
+#elif defined(DEPTH_KERNELS_SSE41)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i vmin = _mm_set1_epi16(-1), vmax = zero, vzeros = zero, vsum = zero;
+            for (; x + 8 <= n; x += 8)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+                __m128i hole = _mm_cmpeq_epi16(v, zero);
+                vmin = _mm_min_epu16(vmin, _mm_or_si128(v, hole));         // holes become 0xFFFF
+                vmax = _mm_max_epu16(vmax, v);
+                vzeros = _mm_sub_epi16(vzeros, hole);                      // -(-1) per hole
+                vsum = _mm_add_epi32(vsum, _mm_unpacklo_epi16(v, zero));
+                vsum = _mm_add_epi32(vsum, _mm_unpackhi_epi16(v, zero));
+            }
+            alignas(16) uint16_t mins[8], maxs[8], zs[8];
+            alignas(16) uint32_t sums[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(mins), vmin);
+            _mm_store_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+            _mm_store_si128(reinterpret_cast<__m128i*>(zs), vzeros);
+            _mm_store_si128(reinterpret_cast<__m128i*>(sums), vsum);
+            for (int i = 0; i < 8; i++) { lo = std::min(lo, mins[i]); hi = std::max(hi, maxs[i]); zeros += zs[i]; }
+            for (int i = 0; i < 4; i++) sum += sums[i];
+        }
+#endif
+        for (; x < n; x++)
+        {
+            uint16_t d = row[x];
+            if (d) lo = std::min(lo, d);
+            else zeros++;
+            hi = std::max(hi, d);
+            sum += d;
+        }
+
+        // Holes land in bin 0 and are taken out once at the end, keeping this loop branch-free.
+        // Neighbouring pixels usually share a bin, so alternate between two copies of the
+        // histogram to avoid stalling on the same counter.
+        for (x = 0; x + 2 <= n; x += 2)
+        {
+            hist[row[x] >> histogram_shift]++;
+            hist2[row[x + 1] >> histogram_shift]++;
+        }
+        if (x < n)
+            hist[row[x] >> histogram_shift]++;
+    }
+    for (size_t i = 0; i < out.histogram.size(); i++)
+        hist[i] += hist2[i];
+
+    out.total = uint64_t(n) * (y1 - y0 + 1);
+    out.valid = out.total - zeros;
+    hist[0] -= uint32_t(zeros);
+    out.valid_ratio = double(out.valid) / double(out.total);
+    if (out.valid)
+    {
+        out.min = lo;
+        out.max = hi;
+        out.mean = double(sum) / double(out.valid);
+    }
+}
@@ -0,0 +1,82 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+#include "example.hpp"              // OpenGL, rect, draw_text
+
+#include <cstdio>
+#include <vector>
+
+#include "depth_kernels.hpp"
+
+// Depth view for the examples, in place of rs2::colorizer + texture: colorizes with
+// depth_colormap into a reusable buffer, computes depth_stats over an optional ROI in
+// the same update, and draws the result as an OpenGL texture.
+class depth_preview
+{
+public:
+    explicit depth_preview(uint16_t near_units = 300, uint16_t far_units = 4000)
+        : _colormap(near_units, far_units)
+    {
+    }
+
+    void update(const rs2::depth_frame& depth, const depth_roi* roi = nullptr)
+    {
+        if (!depth)
+            return;
+        _width = depth.get_width();
+        _height = depth.get_height();
+        int stride = (_width * 3 + 3) & ~3; // GL's default unpack alignment is 4
+        _rgb.resize(size_t(stride) * _height);
+
+        auto data = static_cast<const uint16_t*>(depth.get_data());
+        _colormap.colorize(data, _width, _height, depth.get_stride_in_bytes(), _rgb.data(), stride);
+        depth_statistics(data, _width, _height, depth.get_stride_in_bytes(), roi, _stats);
+
+        if (!_gl_handle)
+            glGenTextures(1, &_gl_handle);
+        glBindTexture(GL_TEXTURE_2D, _gl_handle);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _width, _height, 0, GL_RGB, GL_UNSIGNED_BYTE, _rgb.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void show(const rect& r) const
+    {
+        if (!_gl_handle)
+            return;
+        glBindTexture(GL_TEXTURE_2D, _gl_handle);
+        glEnable(GL_TEXTURE_2D);
+        glBegin(GL_QUAD_STRIP);
+        glTexCoord2f(0.f, 1.f); glVertex2f(r.x, r.y + r.h);
+        glTexCoord2f(0.f, 0.f); glVertex2f(r.x, r.y);
+        glTexCoord2f(1.f, 1.f); glVertex2f(r.x + r.w, r.y + r.h);
+        glTexCoord2f(1.f, 0.f); glVertex2f(r.x + r.w, r.y);
+        glEnd();
+        glDisable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // One line of statistics under the top-left corner of the view
+    void show_stats(const rect& r) const
+    {
+        if (!_stats.total)
+            return;
+        char text[128];
+        snprintf(text, sizeof(text), "depth min %u max %u mean %.0f valid %.1f%%",
+            _stats.min, _stats.max, _stats.mean, 100. * _stats.valid_ratio);
+        draw_text(int(r.x) + 10, int(r.y) + 20, text);
+    }
+
+    const depth_stats& stats() const { return _stats; }
+
+private:
+    depth_colormap _colormap;
+    depth_stats _stats;
+    std::vector<uint8_t> _rgb;
+    int _width = 0, _height = 0;
+    GLuint _gl_handle = 0;
+};
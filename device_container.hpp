@@ -0,0 +1,950 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2015-2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+#include "example.hpp"              // Include short list of convenience functions for rendering
+
+#include <thread>
+#include <string>
+#include <map>
+#include <set>
+#include <tuple>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <mutex>                    // std::mutex, std::lock_guard
+#include <fstream>              // File IO
+#include <iostream>             // Terminal IO
+#include <sstream>              // Stringstreams
+
+#include "async_frame_writer.hpp"   // Bounded writer stage between polling and the disk
+#include "io_backend.hpp"           // Buffered / mmap / direct output files
+#include "raw_container.hpp"        // Segmented append-only raw dumps
+#include "frame_ring.hpp"           // Memory-bounded ring of kept frames
+#include "frame_encoders.hpp"       // raw / png / qoi / rice still-image encoders
+#include "metadata_log.hpp"         // Per-stream binary metadata log
+#include "frame_sync.hpp"           // Cross-device hardware timestamp synchronizer
+#include "depth_preview.hpp"        // LUT depth colorizer and statistics
+#include "event_recorder.hpp"       // Pre/post-event recording from the frame rings
+#include "stage_profiler.hpp"       // Per-stage timing and frame age
+#include "capture_policy.hpp"       // Which frames are saved, and cropped / downscaled how
+#include "pointcloud_export.hpp"    // Depth -> PLY / XYZ point clouds
+#include "device_lifecycle.hpp"     // Background device bring-up and teardown
+#include "shm_ring.hpp"             // Shared-memory frame ring for local consumer processes
+#include "health_monitor.hpp"       // Counter gaps, fps, jitter and backlog per stream
+#include "post_processing.hpp"      // Depth filter chains on a worker pool
+
+// One capture pipeline per camera, each on its own thread, feeding the writer pool.
+// Shared by the multicam example and the save-path benchmark; the including
+// translation unit provides STB_IMAGE_WRITE_IMPLEMENTATION.
+
+const std::string platform_camera_name = "Platform Camera";
+
+class device_container
+{
+    typedef std::map<int, rs2::frame> stream_frames;
+
+    // Helper struct per pipeline. Each one owns a capture thread; the latest frames are
+    // published as an immutable snapshot so readers never wait for capture (or vice versa).
+    // Frames are published as captured; the renderer colorizes only those it draws.
+    struct depth_view
+    {
+        unsigned long long frame_number = ~0ULL; // last frame colorized into the preview
+        depth_preview preview;
+    };
+
+    struct view_port
+    {
+		std::string dev;
+        std::shared_ptr<const stream_frames> frames_per_stream; // read/written with std::atomic_load/store
+        std::map<int, depth_view> depth_views;                   // render thread only
+        std::unique_ptr<depth_threshold_trigger> trigger;        // capture thread only
+        std::map<int, int> channels;                             // stream id -> profiler channel, capture thread only
+        std::map<int, stream_health*> health;                    // stream id -> its health record, capture thread only
+        capture_filter::stream_states admit_states;              // capture policy state, capture thread only
+        int poll_channel = -1;
+        texture tex;
+        rs2::pipeline pipe;
+        rs2::pipeline_profile profile;
+        std::shared_ptr<writer_stats> write_stats;
+        bool first_frame_seen = false;                           // capture thread only
+        std::atomic<bool> running{ true };
+        std::thread worker;
+    };
+
+    typedef std::map<std::string, std::shared_ptr<view_port>> device_map;
+
+public:
+    device_container(size_t writer_threads = 2, size_t queue_capacity = 256,
+        backpressure_policy policy = backpressure_policy::block, size_t retain_bytes_per_stream = 256 << 20)
+        : _devices(std::make_shared<device_map>()), _retention(retain_bytes_per_stream),
+          _writer([this](const write_job& job) { return save_job(job); }, writer_threads, queue_capacity, policy)
+    {
+    }
+
+    ~device_container()
+    {
+        // No bring-up or teardown may run past this point
+        _lifecycle.shutdown();
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto&& view : *devices())
+            stop_capture(*view.second);
+    }
+
+    // Returns at once: opening and starting the device happen on the lifecycle manager's
+    // thread for it, so a hot-plug callback never waits and live devices keep streaming.
+    // `configure` (e.g. loading a preset) runs there too, before the pipeline starts.
+    void enable_device(rs2::device dev, std::function<void(rs2::device)> configure = nullptr)
+    {
+        std::string serial_number(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER));
+
+        // Ignoring platform cameras (webcams, etc..)
+        if (platform_camera_name == dev.get_info(RS2_CAMERA_INFO_NAME))
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_plugged.emplace(serial_number, dev).second)
+            {
+                return; //already in, or on its way
+            }
+        }
+
+        _lifecycle.bring_up(serial_number, [this, serial_number, dev, configure]()
+        {
+            if (configure)
+                configure(dev);
+            // Create a pipeline from the given device
+            rs2::pipeline p(_ctx);
+            rs2::config c;
+            c.enable_device(serial_number);
+            start_view(serial_number, p, c);
+        });
+    }
+
+    // Plays a recorded .bag file through the same capture and save path as a camera
+    void enable_playback(const std::string& file, bool repeat = false)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_playback.insert(file).second)
+                return;
+        }
+        _lifecycle.bring_up(file, [this, file, repeat]()
+        {
+            rs2::pipeline p(_ctx);
+            rs2::config c;
+            c.enable_device_from_file(file, repeat);
+            start_view(file, p, c, true);
+        });
+    }
+
+    // Blocks until every queued bring-up and teardown has finished; false on timeout
+    bool wait_for_devices(std::chrono::milliseconds timeout = std::chrono::milliseconds(10000))
+    {
+        return _lifecycle.wait_idle(timeout);
+    }
+
+    // State, startup and reconnect latency of every device seen so far
+    std::vector<device_lifecycle_record> device_lifecycles() const
+    {
+        return _lifecycle.records();
+    }
+
+    // Context that pipelines are created in, e.g. one holding software devices.
+    // Call before any device is enabled.
+    void use_context(rs2::context ctx) { _ctx = ctx; }
+
+    // Where frames are written (default ".\\images\\"), and whether every frame's
+    // timestamps are printed. Call before any device is enabled.
+    void set_output(const std::string& prefix, bool verbose)
+    {
+        _output_prefix = prefix;
+        _verbose = verbose;
+    }
+
+    // Blocks until every queued frame is written
+    void flush()
+    {
+        _post.flush();
+        _writer.flush();
+    }
+
+    std::map<std::string, std::shared_ptr<writer_stats>> writer_statistics()
+    {
+        return _writer.all_stats();
+    }
+
+    uint64_t frames_captured() const { return _frames_captured; }
+
+    // The streams each started device (or recording) delivers, by serial
+    std::map<std::string, std::vector<rs2::stream_profile>> active_streams() const
+    {
+        std::map<std::string, std::vector<rs2::stream_profile>> streams;
+        for (auto&& view : *devices())
+            streams[view.first] = view.second->profile.get_streams();
+        return streams;
+    }
+
+    // Stage timings of capture, save and render, per device and stream
+    stage_profiler& profiler() { return _profiler; }
+
+    // Per-stream health: counter gaps, fps, jitter, metadata anomalies
+    const health_monitor& health() const { return _health; }
+
+    // print_writer_stats() also rewrites this Prometheus text file of the health and
+    // writer metrics, for a scraper to pull
+    void enable_health_report(const std::string& path)
+    {
+        _health_path = path;
+    }
+
+    // print_writer_stats() also rewrites this JSON stage report
+    void enable_profile_report(const std::string& path)
+    {
+        _profile_path = path;
+    }
+
+    // Keep the last `events_per_thread` stage spans of every thread for write_trace().
+    // Call before any device is enabled.
+    void enable_trace(size_t events_per_thread)
+    {
+        _profiler.enable_trace(events_per_thread);
+    }
+
+    bool write_trace(const std::string& path) const
+    {
+        return _profiler.write_chrome_trace(path);
+    }
+
+private:
+    // Runs on the lifecycle thread of the device; only publishing takes _mutex
+    void start_view(std::string serial_number, rs2::pipeline& p, rs2::config& c, bool playback = false)
+    {
+        // Start the pipeline with the configuration
+        rs2::pipeline_profile profile = p.start(c);
+        if (playback)
+            serial_number = playback_name(profile.get_device(), serial_number);
+        // Hold it internally
+        auto view = std::make_shared<view_port>();
+        view->dev = serial_number;
+        view->frames_per_stream = std::make_shared<stream_frames>();
+        view->pipe = p;
+        view->profile = profile;
+        view->write_stats = _writer.stats_for(serial_number);
+        view->poll_channel = _profiler.channel(serial_number, "frameset");
+        if (_events && _trigger_near_units)
+            view->trigger.reset(new depth_threshold_trigger(_trigger_near_units, _trigger_fraction));
+        view->worker = std::thread([this, view]() { capture_loop(*view); });
+
+        // Publish a new device list; readers holding the old one are unaffected
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto updated = std::make_shared<device_map>(*devices());
+        (*updated)[serial_number] = view;
+        std::atomic_store(&_devices, std::shared_ptr<const device_map>(updated));
+    }
+
+    // A recording is saved under the serial of the camera it was recorded from; without
+    // one, or when that camera is already streaming, under the .bag file's name. Either
+    // way the name goes into file names, so it must not contain path separators or '_'.
+    std::string playback_name(const rs2::device& dev, const std::string& file)
+    {
+        std::string name;
+        if (dev.supports(RS2_CAMERA_INFO_SERIAL_NUMBER))
+            name = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+        if (name.empty() || devices()->count(name))
+        {
+            name = file.substr(file.find_last_of("/\\") + 1);
+            name = name.substr(0, name.rfind('.'));
+        }
+        for (auto& ch : name)
+        {
+            if (ch == '/' || ch == '\\' || ch == '_' || ch == ' ' || ch == ':')
+                ch = '-';
+        }
+        return name;
+    }
+
+    // Runs on the lifecycle thread of the device
+    void stop_view(const std::string& serial_number)
+    {
+        std::shared_ptr<view_port> view;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto current = devices();
+            auto it = current->find(serial_number);
+            if (it == current->end())
+                return; // its bring-up failed
+            view = it->second;
+            auto updated = std::make_shared<device_map>(*current);
+            updated->erase(serial_number);
+            std::atomic_store(&_devices, std::shared_ptr<const device_map>(updated));
+        }
+        // Renderers may still hold the old list (and so the view_port), but capture stops now
+        stop_capture(*view);
+        if (_sync)
+            _sync->remove_device(serial_number);
+
+        // A reconnected device starts its temporal chains with a keyframe
+        std::lock_guard<std::mutex> lock(_chains_mutex);
+        for (auto it = _chains.begin(); it != _chains.end();)
+            it = std::get<0>(it->first) == serial_number ? _chains.erase(it) : std::next(it);
+    }
+
+public:
+
+    // Returns at once; each removed device is stopped on its lifecycle thread, after
+    // its bring-up if that is still in progress
+    void remove_devices(const rs2::event_information& info)
+    {
+        std::vector<std::string> removed;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            // Go over the list of devices and check if it was disconnected
+            auto itr = _plugged.begin();
+            while (itr != _plugged.end())
+            {
+                if (info.was_removed(itr->second))
+                {
+                    removed.push_back(itr->first);
+                    itr = _plugged.erase(itr);
+                }
+                else
+                {
+                    ++itr;
+                }
+            }
+        }
+        for (auto&& serial_number : removed)
+            _lifecycle.tear_down(serial_number, [this, serial_number]() { stop_view(serial_number); });
+    }
+
+    size_t device_count()
+    {
+        return devices()->size();
+    }
+
+    int stream_count()
+    {
+        int count = 0;
+        for (auto&& sn_to_dev : *devices())
+        {
+            for (auto&& stream : *std::atomic_load(&sn_to_dev.second->frames_per_stream))
+            {
+                if (stream.second)
+                {
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
+
+    // Append depth frames to segment files instead of writing one .raw file per frame.
+    // Call before any device is enabled.
+    void enable_raw_container(const std::string& prefix, uint64_t segment_bytes, std::chrono::seconds segment_duration)
+    {
+        _container.reset(new raw_container_writer(prefix, segment_bytes, segment_duration, _io));
+    }
+
+    // Which frames are saved continuously (event recordings keep their whole window)
+    // and how they are cropped or downscaled. Call before any device is enabled.
+    void set_capture_policy(const capture_policy& policy)
+    {
+        _filter.reset(new capture_filter(policy));
+    }
+
+    // How frame files and container segments are written (buffered stdio by default).
+    // Call before enable_raw_container() and before any device is enabled.
+    void set_io(const io_options& options)
+    {
+        _io = std::make_shared<frame_io>(options);
+    }
+
+    // Also write every saved depth frame as a point cloud (the whole frame, whatever the
+    // capture policy crops). voxel_m = 0: no downsampling; max_m = 0: no range limit.
+    // Call after set_io() and before any device is enabled.
+    void enable_pointcloud(point_format format, float voxel_m = 0, float max_m = 0)
+    {
+        _pointcloud.reset(new pointcloud_exporter(format, voxel_m, max_m, _io));
+    }
+
+    // Also copy every captured video frame into the shared-memory ring `name`, which
+    // local processes read with shm_frame_subscriber. Frames larger than `slot_bytes`
+    // are not published. Call before any device is enabled.
+    void enable_shm_publisher(const std::string& name, uint32_t slots = 8, size_t slot_bytes = 4 << 20)
+    {
+        _shm.reset(new shm_frame_publisher(name, slots, slot_bytes));
+    }
+
+    // Run depth frames through a filter chain ("decimation:2,spatial,temporal", see
+    // post_processing.hpp) on a pool of `threads`, off the capture threads. Frames are
+    // filtered where they are handed to the writers - every frame when saving
+    // continuously, the event windows in event mode, in group order with sync on - and a
+    // filtered frame is saved only if its source frame was (capture policy), with the
+    // source's prefix followed by "filtered_". Raw and filtered depth are saved
+    // independently. Call before any device is enabled.
+    void enable_filters(const std::string& chain, size_t threads, bool save_raw = true, bool save_filtered = true)
+    {
+        _save_raw_depth = save_raw;
+        _save_filtered_depth = save_filtered;
+        _post.start(parse_filter_chain(chain), threads, 16,
+            [this](const std::string& serial, rs2::frame filtered, const post_processor::frame_tag& tag)
+        {
+            if (_save_filtered_depth && tag.saved)
+                enqueue_frame(serial, filtered, nullptr, tag.prefix + "filtered_", host_time_ms(), true);
+        });
+    }
+
+    // Frames filtered and dropped per stream, and what each filter costs
+    std::string filter_report() const
+    {
+        return _post.report_text();
+    }
+
+    // Encoders used by the writer threads for depth and for every other video stream
+    // (streams the color encoder cannot handle fall back to png). A temporal depth codec
+    // (tdc) codes each frame against the stream's previous one and writes a keyframe
+    // every `keyframe_interval` frames. Call before any device is enabled.
+    void set_encoders(const std::string& depth_codec, const std::string& color_codec, int keyframe_interval = 30)
+    {
+        _depth_encoder = make_frame_encoder(depth_codec);
+        _color_encoder = make_frame_encoder(color_codec);
+        _keyframe_interval = std::max(1, keyframe_interval);
+    }
+
+    // Group framesets from all cameras by hardware timestamp and hand each group to the
+    // writers as one unit (files are prefixed with the group id). Framesets no other camera
+    // matched are saved unprefixed. Call before any device is enabled.
+    void enable_sync(double tolerance_ms, double max_wait_ms = 100.)
+    {
+        typedef cross_device_synchronizer<rs2::frameset> synchronizer;
+        _sync.reset(new synchronizer(tolerance_ms, max_wait_ms,
+            [this](uint64_t group_id, const std::vector<synchronizer::entry>& group)
+        {
+            std::string prefix = "g" + std::to_string(group_id) + "_";
+            for (auto&& e : group)
+                enqueue_frames(e.serial, e.payload, _writer.stats_for(e.serial), _sync_admit_states[e.serial], prefix);
+        },
+            [this](const synchronizer::entry& e)
+        {
+            enqueue_frames(e.serial, e.payload, _writer.stats_for(e.serial), _sync_admit_states[e.serial], "");
+        }));
+    }
+
+    // Event mode: nothing is saved continuously; trigger_event(), SIGUSR1 (where available)
+    // or the depth trigger save `pre_seconds` before and `post_seconds` after each event,
+    // with files prefixed by the event id. near_units = 0 disables the depth trigger.
+    // Call before any device is enabled.
+    void enable_events(double pre_seconds, double post_seconds, uint16_t near_units = 0, double near_fraction = 0.2)
+    {
+        _trigger_near_units = near_units;
+        _trigger_fraction = near_fraction;
+        _events.reset(new event_recorder(_retention,
+            [this](uint64_t event_id, const frame_retention::retained_frame& f)
+        {
+            std::string prefix = "ev" + std::to_string(event_id) + "_";
+            filter_depth(f.serial, f.frame, prefix, true);
+            enqueue_frame(f.serial, f.frame, _writer.stats_for(f.serial), prefix, f.host_ms);
+        }, pre_seconds, post_seconds));
+#ifdef SIGUSR1
+        _events->install_signal_trigger(SIGUSR1);
+#endif
+    }
+
+    void trigger_event(const std::string& reason)
+    {
+        if (_events)
+            _events->trigger(reason);
+    }
+
+    // The last `seconds` of retained depth frames across all devices, for later dumping
+    std::vector<frame_retention::retained_frame> retained_frames(double seconds)
+    {
+        return _retention.snapshot_last(seconds);
+    }
+
+    void print_writer_stats()
+    {
+        _lifecycle.print_report();
+        _health.print_report(host_time_ms());
+        if (!_health_path.empty() && !_health.write_prometheus(_health_path, _writer.all_stats(), host_time_ms()))
+            std::cerr << "Failed to write " << _health_path << std::endl;
+        _retention.print_report();
+        if (_sync)
+            _sync->print_report();
+        if (_events)
+            _events->print_report();
+        if (_filter)
+            _filter->print_report();
+        if (_shm)
+            _shm->print_report();
+        _post.print_report();
+        printf("%s", _profiler.report_text().c_str());
+        if (!_profile_path.empty() && !_profiler.write_report(_profile_path))
+            std::cerr << "Failed to write " << _profile_path << std::endl;
+        for (auto&& sn_to_stats : _writer.all_stats())
+        {
+            auto& stats = *sn_to_stats.second;
+            printf("writer sn: %s queued=%lld max=%lld written=%llu dropped=%llu failed=%llu bytes=%llu latency p50=%.1fms p99=%.1fms\n",
+                sn_to_stats.first.c_str(), (long long)stats.queue_depth, (long long)stats.max_queue_depth,
+                (unsigned long long)stats.written, (unsigned long long)stats.dropped,
+                (unsigned long long)stats.failed, (unsigned long long)stats.bytes_written,
+                stats.latency_ms.percentile(50), stats.latency_ms.percentile(99));
+        }
+    }
+
+
+    void render_textures(int cols, int rows, float view_width, float view_height)
+    {
+        _profiler.name_thread("render");
+        int stream_no = 0;
+        for (auto&& view : *devices())
+        {
+            // For each device get its latest published frames
+            auto frames_per_stream = std::atomic_load(&view.second->frames_per_stream);
+            for (auto&& id_to_frame : *frames_per_stream)
+            {
+                rect frame_location{ view_width * (stream_no % cols), view_height * (stream_no / cols), view_width, view_height };
+                if (rs2::depth_frame depth = id_to_frame.second.as<rs2::depth_frame>())
+                {
+                    // Colorize a frame once, when it is first shown, no matter how often we redraw
+                    auto& shown = view.second->depth_views[id_to_frame.first];
+                    int channel = _profiler.channel(view.second->dev, depth.get_profile().stream_name());
+                    double arrival_ms = frame_arrival_ms(depth);
+                    if (shown.frame_number != depth.get_frame_number())
+                    {
+                        stage_timer timer(_profiler, channel, pipeline_stage::colorize, arrival_ms);
+                        shown.preview.update(depth);
+                        shown.frame_number = depth.get_frame_number();
+                    }
+                    stage_timer timer(_profiler, channel, pipeline_stage::render, arrival_ms);
+                    shown.preview.show(frame_location);
+                    shown.preview.show_stats(frame_location);
+                    show_health(view.second->dev, depth, frame_location, 40);
+                    stream_no++;
+                }
+                else if (rs2::video_frame vid_frame = id_to_frame.second.as<rs2::video_frame>())
+                {
+                    stage_timer timer(_profiler, _profiler.channel(view.second->dev, vid_frame.get_profile().stream_name()),
+                        pipeline_stage::render, frame_arrival_ms(vid_frame));
+                    view.second->tex.render(vid_frame, frame_location);
+                    show_health(view.second->dev, vid_frame, frame_location, 20);
+                    stream_no++;
+                }
+            }
+        }
+    }
+
+private:
+    void show_health(const std::string& serial, const rs2::frame& f, const rect& r, int line_y)
+    {
+        auto record = _health.stream(serial, f.get_profile().stream_name());
+        draw_text(int(r.x) + 10, int(r.y) + line_y, health_monitor::summary(*record, host_time_ms()).c_str());
+    }
+
+    std::shared_ptr<const device_map> devices() const
+    {
+        return std::atomic_load(&_devices);
+    }
+
+    void stop_capture(view_port& view)
+    {
+        view.running = false;
+        if (view.worker.joinable())
+            view.worker.join();
+    }
+
+    // Runs on the device's own capture thread
+    void capture_loop(view_port& view)
+    {
+        _profiler.name_thread("capture " + view.dev);
+        while (view.running)
+        {
+            rs2::frameset frameset;
+            try
+            {
+                auto poll_start = stage_ticks();
+                if (view.pipe.try_wait_for_frames(&frameset, 100))
+                {
+                    _profiler.record(view.poll_channel, pipeline_stage::poll, poll_start, stage_ticks(), frame_arrival_ms(frameset));
+                    if (!view.first_frame_seen)
+                    {
+                        view.first_frame_seen = true;
+                        _lifecycle.first_frame(view.dev);
+                    }
+                    capture_frames(view, frameset);
+                }
+            }
+            catch (const rs2::error& e)
+            {
+                // The device is being unplugged; remove_devices will stop this thread
+                std::cerr << "sn: " << view.dev << " capture error: " << e.what() << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+        view.pipe.stop();
+    }
+
+    void capture_frames(view_port& view, rs2::frameset& frameset)
+    {
+		if (_verbose)
+			printf("sn: %s\n", view.dev.c_str());
+		_frames_captured += frameset.size();
+		double capture_ms = host_time_ms();
+        auto frames_per_stream = std::make_shared<stream_frames>(*std::atomic_load(&view.frames_per_stream));
+		//keep frame, the ring releases the oldest ones once its budget is used up.
+		//In event mode every stream is kept, to have the whole pre-event window.
+		//A frameset without depth (color-only device or recording) keeps nothing.
+		if (_events)
+		{
+			for (size_t i = 0; i < frameset.size(); i++)
+				_retention.push(view.dev, frameset[i]);
+		}
+		else
+		{
+			_retention.push(view.dev, frameset.get_depth_frame());
+		}
+
+		//printf("%s, ae=%lld\n", rs2_stream_to_string(frame.get_profile().stream_type()), exp);
+
+        for (int i = 0; i < frameset.size(); i++)
+        {
+            rs2::frame frame = frameset[i];
+            int stream_id = frame.get_profile().unique_id();
+            auto channel = view.channels.find(stream_id);
+            if (channel == view.channels.end())
+                channel = view.channels.emplace(stream_id, _profiler.channel(view.dev, frame.get_profile().stream_name())).first;
+            stage_timer timer(_profiler, channel->second, pipeline_stage::metadata, frame_arrival_ms(frame));
+
+			// Counter gaps, rate and jitter; registering a stream is the only lock, once
+			auto health = view.health.find(stream_id);
+			if (health == view.health.end())
+			{
+				auto record = _health.stream(view.dev, frame.get_profile().stream_name());
+				record->begin(frame.get_profile().fps());
+				health = view.health.emplace(stream_id, record).first;
+			}
+			health->second->on_frame(frame, capture_ms);
+
+
+			//--------------------get timestamp and frame count start-------------------
+
+
+			//auto exp = frame.get_frame_metadata(RS2_FRAME_METADATA_ACTUAL_EXPOSURE);
+			if (_verbose)
+			{
+				auto ts_bkend = metadata_or(frame, RS2_FRAME_METADATA_BACKEND_TIMESTAMP, 0);
+				auto ts_toa = metadata_or(frame, RS2_FRAME_METADATA_TIME_OF_ARRIVAL, 0);
+				auto ts_frame = metadata_or(frame, RS2_FRAME_METADATA_FRAME_TIMESTAMP, 0);
+				auto ts_sensor = metadata_or(frame, RS2_FRAME_METADATA_SENSOR_TIMESTAMP, 0);
+				auto frm_id = frame.get_frame_number();
+				auto frm_cnt = metadata_or(frame, RS2_FRAME_METADATA_FRAME_COUNTER, 0);
+				auto frm_tp = rs2_stream_to_string(frame.get_profile().stream_type());
+				printf("                %s id=%lld cnt=%lld tsbk=%lld %lld %lld %lld\n", frm_tp, (long long)frm_id, (long long)frm_cnt,
+					(long long)ts_bkend, (long long)ts_toa, (long long)ts_frame, (long long)ts_sensor);
+			}
+
+            (*frames_per_stream)[stream_id] = frame; //update view port with the new stream
+        
+			//--------------------get timestamp and frame count end-------------------
+        }
+
+		// Local subscribers get every frame, whatever is saved
+		if (_shm)
+		{
+			for (size_t i = 0; i < frameset.size(); i++)
+			{
+				rs2::frame frame = frameset[i];
+				stage_timer timer(_profiler, view.channels[frame.get_profile().unique_id()], pipeline_stage::publish, frame_arrival_ms(frame));
+				publish_frame(view.dev, frame, capture_ms);
+			}
+		}
+
+		// In event mode frames reach the writers only around events, from the rings
+		if (_events)
+		{
+			if (view.trigger)
+				view.trigger->check(frameset.get_depth_frame(), *_events, view.dev);
+		}
+		// With sync on, frames reach the writers as part of a cross-device group
+		else if (_sync)
+		{
+			auto depth = frameset.get_depth_frame();
+			rs2::frame reference = depth ? rs2::frame(depth) : frameset[0];
+			if (reference.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_TIMESTAMP) &&
+				reference.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL))
+			{
+				// FRAME_TIMESTAMP is the device clock in microseconds, TIME_OF_ARRIVAL host ms
+				frameset.keep();
+				_sync->add(view.dev, reference.get_frame_metadata(RS2_FRAME_METADATA_FRAME_TIMESTAMP) / 1000.,
+					double(reference.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL)), frameset);
+			}
+			else
+			{
+				// No hardware timestamps (e.g. metadata not enabled in the kernel): save unsynced
+				enqueue_frames(view.dev, frameset, view.write_stats, view.admit_states, "");
+			}
+		}
+		else
+		{
+			enqueue_frames(view.dev, frameset, view.write_stats, view.admit_states, "");
+		}
+
+        // Publish the new latest frames for the renderer and the stream counter
+        std::atomic_store(&view.frames_per_stream, std::shared_ptr<const stream_frames>(frames_per_stream));
+    }
+
+	void publish_frame(const std::string& serial, const rs2::frame& frame, double capture_ms)
+	{
+		auto vf = frame.as<rs2::video_frame>();
+		if (!vf)
+			return;
+		auto profile = vf.get_profile();
+		shm_frame_header h{};
+		strncpy(h.serial, serial.c_str(), sizeof(h.serial) - 1);
+		h.stream = profile.stream_type();
+		h.stream_index = profile.stream_index();
+		h.format = profile.format();
+		h.width = vf.get_width();
+		h.height = vf.get_height();
+		h.bytes_per_pixel = vf.get_bytes_per_pixel();
+		h.stride = vf.get_stride_in_bytes();
+		h.timestamp_domain = vf.get_frame_timestamp_domain();
+		h.frame_number = vf.get_frame_number();
+		h.frame_counter = metadata_or(vf, RS2_FRAME_METADATA_FRAME_COUNTER, rs2_metadata_type(vf.get_frame_number()));
+		h.backend_timestamp = metadata_or(vf, RS2_FRAME_METADATA_BACKEND_TIMESTAMP, 0);
+		h.timestamp = vf.get_timestamp();
+		h.capture_ms = capture_ms;
+		_shm->publish(h, vf.get_data(), size_t(h.height) * h.stride);
+	}
+
+	static rs2_metadata_type metadata_or(const rs2::frame& f, rs2_frame_metadata_value key, rs2_metadata_type fallback)
+	{
+		return f.supports_frame_metadata(key) ? f.get_frame_metadata(key) : fallback;
+	}
+
+	// Continuous saving: frames the capture policy skips are dropped here, before any copy.
+	// Skipped depth frames are still filtered, so the temporal filter sees every frame.
+	void enqueue_frames(const std::string& serial, const rs2::frameset& frameset, const std::shared_ptr<writer_stats>& stats,
+		capture_filter::stream_states& admit_states, const std::string& prefix)
+	{
+		for (size_t i = 0; i < frameset.size(); i++)
+		{
+			bool saved = !_filter || _filter->admit(admit_states, serial, frameset[i]);
+			filter_depth(serial, frameset[i], prefix, saved);
+			if (saved)
+				enqueue_frame(serial, frameset[i], stats, prefix, host_time_ms());
+		}
+	}
+
+	// Depth filtering happens on the post-processing pool, in order per stream; the
+	// filtered frame comes back to the writers through enable_filters' output
+	void filter_depth(const std::string& serial, const rs2::frame& frame, const std::string& prefix, bool saved)
+	{
+		if (!_post.running() || !frame.is<rs2::depth_frame>())
+			return;
+		post_processor::frame_tag tag;
+		tag.prefix = prefix;
+		tag.saved = saved;
+		_post.submit(_post.chain_for(serial, frame.get_profile().stream_name()), frame, tag);
+	}
+
+	void enqueue_frame(const std::string& serial, rs2::frame frame,
+		const std::shared_ptr<writer_stats>& stats, const std::string& prefix, double capture_ms, bool derived = false)
+	{
+		//--------------------------save raw start-------------------------
+
+		//save image to disk 
+		// We can only save video frames, so we skip the rest. Encoding and writing happen
+		// on the writer threads; here we only name the file and hand over a kept frame.
+		if (auto vf = frame.as<rs2::video_frame>())
+		{
+			if (_post.running() && !_save_raw_depth && !derived && vf.is<rs2::depth_frame>())
+				return; // only the filtered depth is wanted
+
+			// Recordings and software devices may lack metadata; fall back to what every frame has
+			auto ts_bkend = metadata_or(frame, RS2_FRAME_METADATA_BACKEND_TIMESTAMP, rs2_metadata_type(frame.get_timestamp()));
+			auto frm_cnt = metadata_or(frame, RS2_FRAME_METADATA_FRAME_COUNTER, rs2_metadata_type(frame.get_frame_number()));
+			std::stringstream file;
+			std::string filename;
+			file << prefix << "fc" << frm_cnt << "_ts" << ts_bkend << "_sn" << serial << "_" << vf.get_profile().stream_name();
+			file >> filename; // the writer adds the extension of the encoder it uses
+
+			frame.keep();
+			write_job job{ serial, _output_prefix + filename, frame, stats, capture_ms };
+			job.derived = derived;
+			if (vf.is<rs2::depth_frame>() && _depth_encoder->temporal())
+				job.reference = next_reference(serial, frame, prefix, derived);
+			_writer.enqueue(std::move(job));
+			//-------------------------save raw end--------------------------
+		}
+	}
+
+	// The frame a temporal codec codes this one against (none: keyframe). Jobs are
+	// independent of each other, so writer threads may encode a chain in any order; a
+	// job the writer drops leaves the frames up to the next keyframe undecodable.
+	// A chain is one run of files with the same tag (see chain_tag), so each event
+	// recording starts with a keyframe of its own.
+	rs2::frame next_reference(const std::string& serial, const rs2::frame& frame, const std::string& prefix, bool derived)
+	{
+		std::string tag = chain_tag(prefix);
+		std::lock_guard<std::mutex> lock(_chains_mutex);
+		auto& chain = _chains[std::make_tuple(serial, derived, frame.get_profile().unique_id())];
+		rs2::frame reference;
+		if (chain.last && chain.tag == tag && ++chain.since_keyframe < _keyframe_interval)
+			reference = chain.last;
+		else
+			chain.since_keyframe = 0;
+		chain.last = frame;
+		chain.tag = tag;
+		return reference;
+	}
+
+	// A file prefix without its sync group ("g<id>_"), which changes from frame to frame
+	// within a chain; what is left ("", "filtered_", "ev<id>_", ...) is the same for every
+	// file of a chain. rs-tdc--decode-- groups files the same way.
+	static std::string chain_tag(const std::string& prefix)
+	{
+		if (prefix.size() > 1 && prefix[0] == 'g' && isdigit((unsigned char)prefix[1]))
+		{
+			auto end = prefix.find('_');
+			if (end != std::string::npos)
+				return prefix.substr(end + 1);
+		}
+		return prefix;
+	}
+
+	// Runs on the writer threads
+	size_t save_job(const write_job& job)
+	{
+		auto vf = job.frame.as<rs2::video_frame>();
+		if (!vf)
+			return 0;
+
+		_profiler.name_thread("writer");
+		int channel = _profiler.channel(job.serial, vf.get_profile().stream_name());
+		double arrival_ms = frame_arrival_ms(vf);
+
+		bool is_depth = vf.is<rs2::depth_frame>();
+		auto& encoder = is_depth ? _depth_encoder : _color_encoder;
+		size_t bytes = 0;
+
+		// Crop / downscale per the capture policy, into this thread's reusable buffer
+		static thread_local std::vector<uint8_t> transformed;
+		image_view image{ static_cast<const uint8_t*>(vf.get_data()), vf.get_width(), vf.get_height(),
+			vf.get_bytes_per_pixel(), vf.get_stride_in_bytes() };
+		if (_filter)
+		{
+			auto profile = vf.get_profile();
+			image = transform_for_save(_filter->policy().rule_for(job.serial, profile.stream_type(), profile.stream_index()),
+				image, transformed);
+		}
+
+		if (encoder->name() == std::string("raw"))
+		{
+			// Raw needs no encoding: write the frame buffer straight out
+			stage_timer timer(_profiler, channel, pipeline_stage::write, arrival_ms);
+			bytes = (_container && is_depth && !job.derived) ? _container->append(job.serial, job.frame, image.data, image.width, image.height, image.stride)
+			                                 : _io->write_file(job.filename + ".raw", image.data, size_t(image.height) * image.stride);
+		}
+		else
+		{
+			// Each writer thread encodes into its own reusable buffer
+			static thread_local std::vector<uint8_t> encoded;
+			auto& used = encoder->supports(image.bytes_per_pixel) ? encoder : _fallback_encoder;
+			{
+				stage_timer timer(_profiler, channel, pipeline_stage::encode, arrival_ms);
+				bool ok;
+				if (auto ref = job.reference.as<rs2::video_frame>())
+				{
+					// The reference goes through the same crop / downscale as the frame
+					static thread_local std::vector<uint8_t> transformed_reference;
+					image_view reference{ static_cast<const uint8_t*>(ref.get_data()), ref.get_width(), ref.get_height(),
+						ref.get_bytes_per_pixel(), ref.get_stride_in_bytes() };
+					if (_filter)
+					{
+						auto profile = ref.get_profile();
+						reference = transform_for_save(_filter->policy().rule_for(job.serial, profile.stream_type(), profile.stream_index()),
+							reference, transformed_reference);
+					}
+					ok = used->encode_temporal(image, vf.get_frame_number(), &reference, ref.get_frame_number(), encoded);
+				}
+				else
+				{
+					ok = used->encode_temporal(image, vf.get_frame_number(), nullptr, 0, encoded);
+				}
+				if (!ok)
+					return 0;
+			}
+
+			stage_timer timer(_profiler, channel, pipeline_stage::write, arrival_ms);
+			bytes = _io->write_file(job.filename + used->extension(), encoded.data(), encoded.size());
+		}
+
+		if (_pointcloud && is_depth)
+		{
+			std::shared_ptr<point_cloud> cloud;
+			{
+				stage_timer timer(_profiler, channel, pipeline_stage::pointcloud, arrival_ms);
+				cloud = _pointcloud->deproject(vf.as<rs2::depth_frame>());
+			}
+			stage_timer timer(_profiler, channel, pipeline_stage::write, arrival_ms);
+			bytes += _pointcloud->write(*cloud, job.filename);
+		}
+
+		// Log this frame's metadata even if writing it failed
+		if (job.derived)
+			return bytes;
+		stage_timer timer(_profiler, channel, pipeline_stage::metadata, arrival_ms);
+		_metadata.append(job.serial, job.frame, job.capture_ms);
+		return bytes;
+	}
+
+    stage_profiler _profiler; // first: every other member may record into it until destroyed
+    std::string _profile_path;
+    health_monitor _health;
+    std::string _health_path;
+    std::mutex _mutex; // guards _plugged, _playback and publishing _devices; capture and rendering never take it
+    rs2::context _ctx;
+    std::string _output_prefix = ".\\images\\";
+    bool _verbose = true;
+    std::atomic<uint64_t> _frames_captured{ 0 };
+    std::shared_ptr<const device_map> _devices;
+    std::map<std::string, rs2::device> _plugged;   // enabled cameras, streaming or on their way
+    std::set<std::string> _playback;
+    metadata_logger _metadata;
+    std::shared_ptr<const frame_io> _io = std::make_shared<frame_io>();
+    std::unique_ptr<raw_container_writer> _container;
+    std::shared_ptr<frame_encoder> _depth_encoder = std::make_shared<raw_encoder>();
+    std::shared_ptr<frame_encoder> _color_encoder = std::make_shared<png_encoder>();
+    std::shared_ptr<frame_encoder> _fallback_encoder = std::make_shared<png_encoder>();
+    frame_retention _retention;
+    std::map<std::string, capture_filter::stream_states> _sync_admit_states; // sync delivery only, which the synchronizer serializes
+    std::unique_ptr<cross_device_synchronizer<rs2::frameset>> _sync;
+    std::unique_ptr<pointcloud_exporter> _pointcloud;
+    std::unique_ptr<shm_frame_publisher> _shm;
+    int _keyframe_interval = 30;
+    struct temporal_chain
+    {
+        rs2::frame last;
+        std::string tag;
+        int since_keyframe = 0;
+    };
+    std::mutex _chains_mutex;
+    std::map<std::tuple<std::string, bool, int>, temporal_chain> _chains; // per serial, raw / filtered and stream profile
+    std::unique_ptr<capture_filter> _filter; // before _writer: its threads read the policy until they stop
+    async_frame_writer _writer; // drains before the devices go away
+    bool _save_raw_depth = true, _save_filtered_depth = true;
+    post_processor _post{ _profiler }; // after _writer: its threads hand filtered frames to the writers
+    uint16_t _trigger_near_units = 0;
+    double _trigger_fraction = 0;
+    std::unique_ptr<event_recorder> _events; // after _writer: stops handing it frames before it drains
+    device_lifecycle _lifecycle; // last: its threads use everything above; shut down first in the destructor
+};
+
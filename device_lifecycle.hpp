@@ -0,0 +1,292 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Background bring-up and teardown of hot-plugged devices.
+//
+// A device-change callback only queues work here and returns. Each device's steps run
+// in order on a thread of its own (spawned while it has work, gone when it has none),
+// so a camera that takes seconds to enumerate and start delays neither the callback,
+// nor other devices' bring-up, nor anything already streaming.
+//
+//   discovered -> configuring -> streaming -> removing -> removed
+//                      |
+//                      +-> failed (after the retries; a later plug starts over)
+//
+// A bring-up that throws is retried with backoff, unless a teardown for the device was
+// queued meanwhile. Per device it records how long bring-up took (discovered to first
+// frame), how long a reconnect left it without data (removed to first frame again) and
+// how long teardown took.
+
+enum class device_state { discovered, configuring, streaming, removing, removed, failed };
+
+inline const char* device_state_name(device_state state)
+{
+    static const char* names[] = { "discovered", "configuring", "streaming", "removing", "removed", "failed" };
+    return names[int(state)];
+}
+
+struct device_lifecycle_record
+{
+    std::string id;
+    device_state state = device_state::discovered;
+    std::string error;          // why the last bring-up attempt failed
+    unsigned connects = 0;      // bring-ups that delivered a first frame
+    unsigned failures = 0;      // bring-up attempts that threw
+    double startup_ms = 0;      // discovered -> first frame, last bring-up
+    double max_startup_ms = 0;
+    double reconnect_ms = 0;    // removed -> first frame again, last reconnect
+    double max_reconnect_ms = 0;
+    double teardown_ms = 0;     // last teardown step
+};
+
+class device_lifecycle
+{
+public:
+    typedef std::function<void()> step;
+
+    explicit device_lifecycle(int attempts = 3, std::chrono::milliseconds backoff = std::chrono::milliseconds(250))
+        : _attempts(std::max(1, attempts)), _backoff(backoff)
+    {
+    }
+
+    ~device_lifecycle()
+    {
+        shutdown();
+    }
+
+    device_lifecycle(const device_lifecycle&) = delete;
+    device_lifecycle& operator=(const device_lifecycle&) = delete;
+
+    // Queue a bring-up (open, configure, start); returns at once
+    void bring_up(const std::string& id, step start)
+    {
+        post(id, operation{ true, start });
+    }
+
+    // Queue a teardown; runs after anything already queued for the device
+    void tear_down(const std::string& id, step stop)
+    {
+        post(id, operation{ false, stop });
+    }
+
+    // Called by the capture thread when a brought-up device delivers its first frame
+    void first_frame(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _devices.find(id);
+        if (it == _devices.end() || !it->second.awaiting_first_frame)
+            return;
+        auto& d = it->second;
+        auto now = clock::now();
+        d.awaiting_first_frame = false;
+        d.record.connects++;
+        d.record.startup_ms = ms_between(d.discovered_at, now);
+        d.record.max_startup_ms = std::max(d.record.max_startup_ms, d.record.startup_ms);
+        if (d.was_removed)
+        {
+            d.record.reconnect_ms = ms_between(d.removed_at, now);
+            d.record.max_reconnect_ms = std::max(d.record.max_reconnect_ms, d.record.reconnect_ms);
+            d.was_removed = false;
+        }
+    }
+
+    // Waits until no device has work queued or running; false on timeout
+    bool wait_idle(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _changed.wait_for(lock, timeout, [this]()
+        {
+            for (auto&& d : _devices)
+            {
+                if (d.second.busy)
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    std::vector<device_lifecycle_record> records() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<device_lifecycle_record> out;
+        for (auto&& d : _devices)
+            out.push_back(d.second.record);
+        return out;
+    }
+
+    void print_report() const
+    {
+        for (auto&& r : records())
+        {
+            printf("device %s: %s connects=%u failures=%u startup=%.0fms (max %.0f) reconnect=%.0fms (max %.0f) teardown=%.0fms%s%s\n",
+                r.id.c_str(), device_state_name(r.state), r.connects, r.failures, r.startup_ms, r.max_startup_ms,
+                r.reconnect_ms, r.max_reconnect_ms, r.teardown_ms, r.error.empty() ? "" : " error: ", r.error.c_str());
+        }
+    }
+
+    // Drops queued steps and waits for the running ones; nothing runs afterwards
+    void shutdown()
+    {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+            for (auto&& d : _devices)
+            {
+                d.second.pending.clear();
+                if (d.second.thread.joinable())
+                    threads.push_back(std::move(d.second.thread));
+            }
+        }
+        _changed.notify_all();
+        for (auto&& t : threads)
+            t.join();
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct operation
+    {
+        bool up;
+        step run;
+    };
+
+    struct device
+    {
+        device_lifecycle_record record;
+        std::deque<operation> pending;
+        bool busy = false;
+        std::thread thread;
+        clock::time_point discovered_at, removed_at;
+        bool was_removed = false;
+        bool awaiting_first_frame = false;
+    };
+
+    static double ms_between(clock::time_point from, clock::time_point to)
+    {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    void post(const std::string& id, operation op)
+    {
+        std::thread finished;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stopping)
+                return;
+            auto& d = _devices[id];
+            d.record.id = id;
+            if (op.up)
+            {
+                d.discovered_at = clock::now();
+                if (!d.busy)
+                    d.record.state = device_state::discovered;
+            }
+            d.pending.push_back(op);
+            if (!d.busy)
+            {
+                // The previous thread of this device has finished its last step; reap it
+                d.busy = true;
+                finished = std::move(d.thread);
+                d.thread = std::thread([this, id]() { run(id); });
+            }
+        }
+        _changed.notify_all();
+        if (finished.joinable())
+            finished.join();
+    }
+
+    // A device's own thread: runs its queued steps in order, then exits
+    void run(const std::string& id)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto& d = _devices[id]; // std::map nodes stay put
+        for (;;)
+        {
+            if (_stopping || d.pending.empty())
+            {
+                d.busy = false;
+                _changed.notify_all();
+                return;
+            }
+            auto op = d.pending.front();
+            d.pending.pop_front();
+
+            if (!op.up)
+            {
+                d.record.state = device_state::removing;
+                d.awaiting_first_frame = false;
+                auto start = clock::now();
+                lock.unlock();
+                try
+                {
+                    op.run();
+                }
+                catch (const std::exception& e)
+                {
+                    fprintf(stderr, "device %s: teardown failed: %s\n", id.c_str(), e.what());
+                }
+                lock.lock();
+                d.record.state = device_state::removed;
+                d.record.teardown_ms = ms_between(start, clock::now());
+                d.removed_at = clock::now();
+                d.was_removed = true;
+                continue;
+            }
+
+            for (int attempt = 0; attempt < _attempts; attempt++)
+            {
+                d.record.state = device_state::configuring;
+                lock.unlock();
+                std::string error;
+                try
+                {
+                    op.run();
+                }
+                catch (const std::exception& e)
+                {
+                    error = e.what();
+                }
+                lock.lock();
+                if (error.empty())
+                {
+                    d.record.state = device_state::streaming;
+                    d.record.error.clear();
+                    d.awaiting_first_frame = true;
+                    break;
+                }
+
+                d.record.state = device_state::failed;
+                d.record.error = error;
+                d.record.failures++;
+                // Back off before retrying; a queued teardown or shutdown ends the retries
+                auto backoff = _backoff * (1 << attempt);
+                if (attempt + 1 == _attempts ||
+                    _changed.wait_for(lock, backoff, [&]() { return _stopping || !d.pending.empty(); }))
+                    break;
+            }
+        }
+    }
+
+    const int _attempts;
+    const std::chrono::milliseconds _backoff;
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;
+    std::map<std::string, device> _devices;
+    bool _stopping = false;
+};
@@ -0,0 +1,223 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_ring.hpp"
+#include "depth_kernels.hpp"
+
+// Event-triggered recording on top of frame_retention.
+//
+// Capture keeps pushing every frame into the memory-bounded rings as before and does
+// nothing else. When a trigger fires, the recorder's own thread hands the frames of
+// [event - pre, event + post] to the sink: the pre-event part at once, the post-event
+// part in small steps as it arrives, so the rings never have to hold more than the
+// pre-event window. Overlapping events are merged; no frame is written twice.
+//
+// Triggers: trigger() from any thread, a POSIX signal (install_signal_trigger), or
+// depth_threshold_trigger run on depth frames.
+class event_recorder
+{
+public:
+    // Called on the recorder thread for every frame to save; event_id counts from 0
+    typedef std::function<void(uint64_t event_id, const frame_retention::retained_frame&)> frame_sink;
+
+    event_recorder(frame_retention& rings, frame_sink sink, double pre_seconds, double post_seconds)
+        : _rings(rings), _sink(sink), _pre_ms(pre_seconds * 1000.), _post_ms(post_seconds * 1000.),
+          _thread([this]() { run(); })
+    {
+    }
+
+    ~event_recorder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    // Never blocks on disk; safe to call from capture threads
+    void trigger(const std::string& reason, double event_ms = host_time_ms())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _triggers.push_back(std::make_pair(event_ms, reason));
+        }
+        _cv.notify_one();
+    }
+
+    // The next `sig` (e.g. SIGUSR1) triggers an event; one recorder per process
+    void install_signal_trigger(int sig)
+    {
+        _signal = sig;
+        signal_pending() = false;
+        std::signal(sig, on_signal);
+    }
+
+    uint64_t events() const { return _events; }
+    uint64_t frames_saved() const { return _frames_saved; }
+    bool recording() const { return _recording; }
+
+    void print_report() const
+    {
+        printf("events: triggered=%llu frames saved=%llu %s\n", (unsigned long long)_events.load(),
+            (unsigned long long)_frames_saved.load(), _recording ? "recording" : "idle");
+    }
+
+private:
+    static std::atomic<bool>& signal_pending()
+    {
+        static std::atomic<bool> pending{ false };
+        return pending;
+    }
+
+    static void on_signal(int sig)
+    {
+        signal_pending() = true;
+        std::signal(sig, on_signal); // re-arm on platforms that reset the handler
+    }
+
+    void run()
+    {
+        // Frames younger than this may still be on their way into the rings
+        const double settle_ms = 50.;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stop)
+        {
+            _cv.wait_for(lock, std::chrono::milliseconds(20));
+            if (signal_pending().exchange(false))
+                _triggers.push_back(std::make_pair(host_time_ms(), std::string("signal ") + std::to_string(_signal)));
+
+            while (!_triggers.empty())
+            {
+                auto t = _triggers.front();
+                _triggers.pop_front();
+                printf("event %llu: %s\n", (unsigned long long)_events.load(), t.second.c_str());
+                if (_recording && t.first - _pre_ms <= _window_end)
+                {
+                    _window_end = std::max(_window_end, t.first + _post_ms); // merged into the open event
+                }
+                else
+                {
+                    _event_id = _events;
+                    _flushed_until = std::max(_flushed_until, t.first - _pre_ms);
+                    _window_end = t.first + _post_ms;
+                    _recording = true;
+                }
+                _events++;
+            }
+            if (!_recording)
+                continue;
+
+            double to = std::min(_window_end, host_time_ms() - settle_ms);
+            if (to <= _flushed_until)
+                continue;
+            double from = _flushed_until;
+            uint64_t id = _event_id;
+            _flushed_until = to;
+            if (to >= _window_end)
+                _recording = false;
+
+            lock.unlock();
+            for (auto&& f : _rings.snapshot(from, to))
+            {
+                if (f.host_ms <= from) // snapshot bounds are inclusive; the previous step took it
+                    continue;
+                _sink(id, f);
+                _frames_saved++;
+            }
+            lock.lock();
+        }
+    }
+
+    frame_retention& _rings;
+    frame_sink _sink;
+    double _pre_ms, _post_ms;
+    int _signal = 0;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::pair<double, std::string>> _triggers;
+    bool _stop = false;
+    std::atomic<bool> _recording{ false };
+    double _flushed_until = 0;      // frames up to here were handed to the sink (or skipped)
+    double _window_end = 0;
+    uint64_t _event_id = 0;
+    std::atomic<uint64_t> _events{ 0 };
+    std::atomic<uint64_t> _frames_saved{ 0 };
+    std::thread _thread; // last, so everything it uses exists before it starts
+};
+
+// Fires when at least `min_fraction` of the valid depth pixels (in the ROI, if given) are
+// nearer than `near_units`, i.e. something came close. Re-arms after `cooldown_ms`.
+class depth_threshold_trigger
+{
+public:
+    depth_threshold_trigger(uint16_t near_units, double min_fraction, double cooldown_ms = 5000.)
+        : _near(near_units), _min_fraction(min_fraction), _cooldown_ms(cooldown_ms)
+    {
+    }
+
+    void set_roi(const depth_roi& roi) { _roi = roi; _has_roi = true; }
+
+    // Returns true (and fires the recorder) on a new event
+    bool check(const rs2::depth_frame& depth, event_recorder& recorder, const std::string& serial)
+    {
+        if (!depth)
+            return false;
+        double now = host_time_ms();
+        if (now - _last_fired < _cooldown_ms)
+            return false;
+
+        depth_statistics(static_cast<const uint16_t*>(depth.get_data()), depth.get_width(), depth.get_height(),
+            depth.get_stride_in_bytes(), _has_roi ? &_roi : nullptr, _stats, _shift);
+        if (!_stats.valid)
+            return false;
+
+        // Whole bins below the threshold; the bin holding it is counted pro rata
+        uint64_t near = 0;
+        size_t last_bin = _near >> _shift;
+        for (size_t i = 0; i < last_bin && i < _stats.histogram.size(); i++)
+            near += _stats.histogram[i];
+        if (last_bin < _stats.histogram.size())
+            near += uint64_t(_stats.histogram[last_bin] * double(_near & ((1 << _shift) - 1)) / (1 << _shift));
+
+        double fraction = double(near) / double(_stats.valid);
+        if (fraction < _min_fraction)
+            return false;
+
+        _last_fired = now;
+        char reason[128];
+        snprintf(reason, sizeof(reason), "sn %s depth: %.1f%% nearer than %u", serial.c_str(), 100. * fraction, _near);
+        recorder.trigger(reason, now);
+        return true;
+    }
+
+private:
+    static const int _shift = 6; // 64-unit bins
+
+    uint16_t _near;
+    double _min_fraction;
+    double _cooldown_ms;
+    double _last_fired = 0;
+    depth_roi _roi{};
+    bool _has_roi = false;
+    depth_stats _stats;
+};
@@ -0,0 +1,164 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Display options shared by the examples:
+//   --headless           capture without opening a window (stop with Ctrl+C)
+//   --display-fps <rate> cap on how often the window is redrawn (default 30)
+struct display_options
+{
+    bool headless = false;
+    double fps = 30.;
+};
+
+// Picks the display options out of the command line and removes them, so each example
+// can go on parsing its own arguments
+inline display_options parse_display_options(int& argc, char* argv[])
+{
+    display_options options;
+    int out = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--headless") options.headless = true;
+        else if (arg == "--display-fps" && i + 1 < argc) options.fps = std::stod(argv[++i]);
+        else argv[out++] = argv[i];
+    }
+    argc = out;
+    return options;
+}
+
+// Sleeps off whatever is left of the current display period
+class rate_limiter
+{
+public:
+    explicit rate_limiter(double hz)
+        : _period(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(hz > 0 ? 1. / hz : 0.))),
+          _next(std::chrono::steady_clock::now())
+    {
+    }
+
+    void wait()
+    {
+        _next += _period;
+        auto now = std::chrono::steady_clock::now();
+        if (_next > now)
+            std::this_thread::sleep_until(_next);
+        else
+            _next = now; // running late: do not try to catch up with a burst of frames
+    }
+
+private:
+    std::chrono::steady_clock::duration _period;
+    std::chrono::steady_clock::time_point _next;
+};
+
+// Hand-over slot between the capture thread and the display: capture overwrites it with
+// every frameset, the display takes only the newest one when it is about to draw
+class latest_frameset
+{
+public:
+    void publish(const rs2::frameset& fs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _frames = fs;
+        _fresh = true;
+    }
+
+    // True if a frameset arrived since the last call
+    bool take(rs2::frameset& fs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_fresh)
+            return false;
+        fs = _frames;
+        _fresh = false;
+        return true;
+    }
+
+private:
+    std::mutex _mutex;
+    rs2::frameset _frames;
+    bool _fresh = false;
+};
+
+// Calls `step` in a loop on its own thread until stopped. An exception thrown by `step`
+// ends the loop and is rethrown by stop(), so it reaches main's handlers as before.
+class capture_thread
+{
+public:
+    explicit capture_thread(std::function<void()> step)
+        : _thread([this, step]()
+          {
+              try
+              {
+                  while (_running)
+                      step();
+              }
+              catch (...)
+              {
+                  _error = std::current_exception();
+                  _running = false;
+              }
+          })
+    {
+    }
+
+    ~capture_thread()
+    {
+        _running = false;
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+    bool running() const { return _running; }
+
+    void stop()
+    {
+        _running = false;
+        if (_thread.joinable())
+            _thread.join();
+        if (_error)
+            std::rethrow_exception(_error);
+    }
+
+private:
+    std::atomic<bool> _running{ true };
+    std::exception_ptr _error;
+    std::thread _thread; // last, so the flags exist before the thread starts
+};
+
+// Headless mode: block until Ctrl+C, or until `keep_going` returns false
+inline std::atomic<bool>& interrupted()
+{
+    static std::atomic<bool> flag{ false };
+    return flag;
+}
+
+inline void wait_for_interrupt(std::function<bool()> keep_going, std::function<void()> every_second = nullptr)
+{
+    std::signal(SIGINT, [](int) { interrupted() = true; });
+    auto last = std::chrono::steady_clock::now();
+    while (!interrupted() && keep_going())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (every_second && std::chrono::steady_clock::now() - last > std::chrono::seconds(1))
+        {
+            every_second();
+            last = std::chrono::steady_clock::now();
+        }
+    }
+}
@@ -0,0 +1,1018 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAME_ENCODERS_SSE2
+#endif
+
+#include "stb_image_write.h"
+
+// Pluggable still-image encoders for the save path. None of them depend on librealsense,
+// so they can be fed synthetic buffers as easily as frames:
+//
+//   raw   - pixels as-is, rows packed
+//   png   - stb_image_write, the original path
+//   qoi   - "Quite OK Image" lossless coding for 3/4 channel 8-bit color
+//   rice  - left-delta prediction + block-adaptive Rice coding for single channel
+//           8-bit (IR) and 16-bit (depth) frames; the prediction step is SSE2-vectorized
+//   tdc   - temporal depth codec for Z16: holes coded as runs, MED spatial prediction
+//           or, row by row where it is cheaper, MED over the difference to the previous
+//           saved frame of the stream; the same Rice coding, in stripes that encode and
+//           decode in parallel
+//
+// Encoders are stateless and safe to call from several writer threads at once; a
+// temporal encoder is handed its reference frame with each call.
+
+struct image_view
+{
+    const uint8_t* data;
+    int width;
+    int height;
+    int bytes_per_pixel;
+    int stride;
+};
+
+class frame_encoder
+{
+public:
+    virtual ~frame_encoder() {}
+    virtual const char* name() const = 0;
+    virtual const char* extension() const = 0;
+    virtual bool supports(int bytes_per_pixel) const = 0;
+    // Replaces the contents of `out`; returns false if the image cannot be encoded
+    virtual bool encode(const image_view& image, std::vector<uint8_t>& out) const = 0;
+
+    // Temporal encoders predict from the previous saved frame of the same stream
+    virtual bool temporal() const { return false; }
+    // `number` identifies this frame and `reference_number` the reference, so a decoder can
+    // check it has the right one; reference == nullptr makes a keyframe
+    virtual bool encode_temporal(const image_view& image, uint64_t number, const image_view* reference,
+        uint64_t reference_number, std::vector<uint8_t>& out) const
+    {
+        (void)number; (void)reference; (void)reference_number;
+        return encode(image, out);
+    }
+};
+
+//------------------------------------------------------------------------------------------
+
+class raw_encoder : public frame_encoder
+{
+public:
+    const char* name() const override { return "raw"; }
+    const char* extension() const override { return ".raw"; }
+    bool supports(int) const override { return true; }
+
+    bool encode(const image_view& image, std::vector<uint8_t>& out) const override
+    {
+        size_t row = size_t(image.width) * image.bytes_per_pixel;
+        out.resize(row * image.height);
+        for (int y = 0; y < image.height; y++)
+            memcpy(out.data() + y * row, image.data + size_t(y) * image.stride, row);
+        return true;
+    }
+};
+
+//------------------------------------------------------------------------------------------
+
+class png_encoder : public frame_encoder
+{
+public:
+    const char* name() const override { return "png"; }
+    const char* extension() const override { return ".png"; }
+    bool supports(int bytes_per_pixel) const override { return bytes_per_pixel >= 1 && bytes_per_pixel <= 4; }
+
+    bool encode(const image_view& image, std::vector<uint8_t>& out) const override
+    {
+        out.clear();
+        return stbi_write_png_to_func([](void* context, void* data, int size)
+        {
+            auto& buffer = *static_cast<std::vector<uint8_t>*>(context);
+            auto bytes = static_cast<const uint8_t*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }, &out, image.width, image.height, image.bytes_per_pixel, image.data, image.stride) != 0;
+    }
+};
+
+//------------------------------------------------------------------------------------------
+
+namespace qoi
+{
+    const uint8_t op_index = 0x00, op_diff = 0x40, op_luma = 0x80, op_run = 0xc0, op_rgb = 0xfe, op_rgba = 0xff;
+    const uint8_t header_size = 14;
+    const uint8_t padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+    struct rgba { uint8_t r, g, b, a; };
+
+    inline int hash(const rgba& p) { return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64; }
+    inline bool equal(const rgba& a, const rgba& b) { return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a; }
+
+    inline void put32(std::vector<uint8_t>& out, uint32_t v)
+    {
+        out.push_back(uint8_t(v >> 24)); out.push_back(uint8_t(v >> 16));
+        out.push_back(uint8_t(v >> 8));  out.push_back(uint8_t(v));
+    }
+
+    inline uint32_t get32(const uint8_t* p)
+    {
+        return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+    }
+
+    // Decode into rows packed at width * channels; used to verify round trips
+    inline bool decode(const std::vector<uint8_t>& in, std::vector<uint8_t>& pixels, int& width, int& height, int& channels)
+    {
+        if (in.size() < header_size + sizeof(padding) || memcmp(in.data(), "qoif", 4) != 0)
+            return false;
+        width = int(get32(&in[4]));
+        height = int(get32(&in[8]));
+        channels = in[12];
+        size_t count = size_t(width) * height;
+        pixels.resize(count * channels);
+
+        rgba index[64] = {};
+        rgba px{ 0, 0, 0, 255 };
+        size_t pos = header_size, end = in.size() - sizeof(padding);
+        int run = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (run > 0)
+            {
+                run--;
+            }
+            else if (pos < end)
+            {
+                uint8_t b1 = in[pos++];
+                if (b1 == op_rgb) { px.r = in[pos]; px.g = in[pos + 1]; px.b = in[pos + 2]; pos += 3; }
+                else if (b1 == op_rgba) { px.r = in[pos]; px.g = in[pos + 1]; px.b = in[pos + 2]; px.a = in[pos + 3]; pos += 4; }
+                else if ((b1 & 0xc0) == op_index) px = index[b1];
+                else if ((b1 & 0xc0) == op_diff)
+                {
+                    px.r += ((b1 >> 4) & 0x03) - 2;
+                    px.g += ((b1 >> 2) & 0x03) - 2;
+                    px.b += (b1 & 0x03) - 2;
+                }
+                else if ((b1 & 0xc0) == op_luma)
+                {
+                    uint8_t b2 = in[pos++];
+                    int vg = (b1 & 0x3f) - 32;
+                    px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px.g += vg;
+                    px.b += vg - 8 + (b2 & 0x0f);
+                }
+                else run = b1 & 0x3f;
+                index[hash(px)] = px;
+            }
+            uint8_t* dst = &pixels[i * channels];
+            dst[0] = px.r; dst[1] = px.g; dst[2] = px.b;
+            if (channels == 4) dst[3] = px.a;
+        }
+        return true;
+    }
+}
+
+class qoi_encoder : public frame_encoder
+{
+public:
+    const char* name() const override { return "qoi"; }
+    const char* extension() const override { return ".qoi"; }
+    bool supports(int bytes_per_pixel) const override { return bytes_per_pixel == 3 || bytes_per_pixel == 4; }
+
+    bool encode(const image_view& image, std::vector<uint8_t>& out) const override
+    {
+        using namespace qoi;
+        if (!supports(image.bytes_per_pixel))
+            return false;
+
+        const int channels = image.bytes_per_pixel;
+        out.clear();
+        out.reserve(size_t(image.width) * image.height * (channels + 1) + header_size + sizeof(padding));
+        out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+        put32(out, uint32_t(image.width));
+        put32(out, uint32_t(image.height));
+        out.push_back(uint8_t(channels));
+        out.push_back(0); // sRGB with linear alpha
+
+        rgba index[64] = {};
+        rgba prev{ 0, 0, 0, 255 }, px = prev;
+        int run = 0;
+        const size_t count = size_t(image.width) * image.height;
+        size_t i = 0;
+        for (int y = 0; y < image.height; y++)
+        {
+            const uint8_t* row = image.data + size_t(y) * image.stride;
+            for (int x = 0; x < image.width; x++, i++)
+            {
+                const uint8_t* src = row + x * channels;
+                px.r = src[0]; px.g = src[1]; px.b = src[2];
+                if (channels == 4) px.a = src[3];
+
+                if (equal(px, prev))
+                {
+                    run++;
+                    if (run == 62 || i + 1 == count)
+                    {
+                        out.push_back(uint8_t(op_run | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0)
+                {
+                    out.push_back(uint8_t(op_run | (run - 1)));
+                    run = 0;
+                }
+
+                int h = hash(px);
+                if (equal(index[h], px))
+                {
+                    out.push_back(uint8_t(op_index | h));
+                }
+                else
+                {
+                    index[h] = px;
+                    if (px.a == prev.a)
+                    {
+                        int8_t vr = int8_t(px.r - prev.r), vg = int8_t(px.g - prev.g), vb = int8_t(px.b - prev.b);
+                        int8_t vg_r = int8_t(vr - vg), vg_b = int8_t(vb - vg);
+                        if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                        {
+                            out.push_back(uint8_t(op_diff | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)));
+                        }
+                        else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+                        {
+                            out.push_back(uint8_t(op_luma | (vg + 32)));
+                            out.push_back(uint8_t((vg_r + 8) << 4 | (vg_b + 8)));
+                        }
+                        else
+                        {
+                            out.insert(out.end(), { op_rgb, px.r, px.g, px.b });
+                        }
+                    }
+                    else
+                    {
+                        out.insert(out.end(), { op_rgba, px.r, px.g, px.b, px.a });
+                    }
+                }
+                prev = px;
+            }
+        }
+        out.insert(out.end(), padding, padding + sizeof(padding));
+        return true;
+    }
+};
+
+//------------------------------------------------------------------------------------------
+
+namespace rice
+{
+    const char magic[4] = { 'R', 'I', 'C', 'E' };
+    const int header_size = 16;   // magic, width, height, bytes per pixel, reserved
+    const int block = 16;         // residuals sharing one Rice parameter
+    const int max_unary = 24;     // longer quotients are escaped to raw bits
+
+    // Zig-zag map of a signed residual; the shift is done unsigned, as left-shifting a
+    // negative int is undefined
+    inline uint16_t zigzag16(int16_t r) { return uint16_t((uint32_t(r) << 1) ^ uint32_t(r >> 15)); }
+    inline uint8_t zigzag8(int8_t r) { return uint8_t((uint32_t(r) << 1) ^ uint32_t(r >> 7)); }
+
+    // Zig-zag mapped left-delta residuals of one row. The first pixel is predicted from
+    // the pixel above it (or 0 on the first row). Arithmetic wraps at the sample width,
+    // which keeps the transform lossless and lets SSE2 do 8 or 16 samples at a time.
+    inline void residuals16(const uint16_t* row, const uint16_t* above, int width, uint16_t* out)
+    {
+        int16_t r0 = int16_t(row[0] - (above ? above[0] : 0));
+        out[0] = zigzag16(r0);
+        int x = 1;
+#ifdef FRAME_ENCODERS_SSE2
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+            __m128i r = _mm_sub_epi16(cur, left);
+            __m128i zz = _mm_xor_si128(_mm_slli_epi16(r, 1), _mm_srai_epi16(r, 15));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), zz);
+        }
+#endif
+        for (; x < width; x++)
+        {
+            out[x] = zigzag16(int16_t(row[x] - row[x - 1]));
+        }
+    }
+
+    inline void residuals8(const uint8_t* row, const uint8_t* above, int width, uint16_t* out)
+    {
+        int8_t r0 = int8_t(row[0] - (above ? above[0] : 0));
+        out[0] = zigzag8(r0);
+        int x = 1;
+#ifdef FRAME_ENCODERS_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+            __m128i r = _mm_sub_epi8(cur, left);
+            __m128i zz = _mm_xor_si128(_mm_add_epi8(r, r), _mm_cmpgt_epi8(zero, r));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_unpacklo_epi8(zz, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 8), _mm_unpackhi_epi8(zz, zero));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            out[x] = zigzag8(int8_t(row[x] - row[x - 1]));
+        }
+    }
+
+    class bit_writer
+    {
+    public:
+        explicit bit_writer(std::vector<uint8_t>& out) : _out(out), _pos(out.size()) {}
+
+        void put(uint32_t bits, int count) // count <= 32
+        {
+            _acc = (_acc << count) | (bits & ((uint64_t(1) << count) - 1));
+            _bits += count;
+            if (_bits >= 32)
+            {
+                _bits -= 32;
+                write_word(uint32_t(_acc >> _bits));
+            }
+        }
+
+        void flush()
+        {
+            while (_bits >= 8)
+            {
+                _bits -= 8;
+                reserve(1);
+                _out[_pos++] = uint8_t(_acc >> _bits);
+            }
+            if (_bits)
+            {
+                reserve(1);
+                _out[_pos++] = uint8_t(_acc << (8 - _bits));
+            }
+            _bits = 0;
+            _out.resize(_pos);
+        }
+
+    private:
+        void reserve(size_t bytes)
+        {
+            if (_pos + bytes > _out.size())
+                _out.resize(std::max(_out.size() * 2, _pos + 4096));
+        }
+
+        void write_word(uint32_t word)
+        {
+            reserve(4);
+            uint8_t* p = &_out[_pos];
+            p[0] = uint8_t(word >> 24); p[1] = uint8_t(word >> 16); p[2] = uint8_t(word >> 8); p[3] = uint8_t(word);
+            _pos += 4;
+        }
+
+        std::vector<uint8_t>& _out;
+        size_t _pos;
+        uint64_t _acc = 0;
+        int _bits = 0;
+    };
+
+    class bit_reader
+    {
+    public:
+        bit_reader(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+
+        uint32_t get(int count)
+        {
+            while (_bits < count)
+            {
+                _acc = (_acc << 8) | (_pos < _size ? _data[_pos] : 0);
+                _pos++;
+                _bits += 8;
+            }
+            _bits -= count;
+            return uint32_t(_acc >> _bits) & uint32_t((uint64_t(1) << count) - 1);
+        }
+
+        bool overrun() const { return _pos > _size; }
+
+    private:
+        const uint8_t* _data;
+        size_t _size;
+        size_t _pos = 0;
+        uint64_t _acc = 0;
+        int _bits = 0;
+    };
+
+    // Rice parameter that roughly minimizes the code length for a block with this mean
+    inline int choose_k(uint32_t sum, int count, int max_k)
+    {
+        int k = 0;
+        while (k < max_k && (uint32_t(count) << (k + 1)) <= sum)
+            k++;
+        return k;
+    }
+
+    inline void encode_residuals(const uint16_t* r, int count, int sample_bits, bit_writer& bits)
+    {
+        for (int i = 0; i < count; i += block)
+        {
+            int n = std::min(block, count - i);
+            uint32_t sum = 0;
+            for (int j = 0; j < n; j++)
+                sum += r[i + j];
+            int k = choose_k(sum, n, sample_bits - 1);
+            bits.put(uint32_t(k), 4);
+            for (int j = 0; j < n; j++)
+            {
+                uint32_t v = r[i + j];
+                uint32_t q = v >> k;
+                if (q < uint32_t(max_unary))
+                {
+                    bits.put(1, int(q) + 1);           // q zeros then a one
+                    if (k) bits.put(v, k);
+                }
+                else
+                {
+                    bits.put(1, max_unary + 1);        // escape, then the value verbatim
+                    bits.put(v, sample_bits);
+                }
+            }
+        }
+    }
+
+    inline bool decode_residuals(bit_reader& bits, int count, int sample_bits, uint16_t* r)
+    {
+        for (int i = 0; i < count; i += block)
+        {
+            int n = std::min(block, count - i);
+            int k = int(bits.get(4));
+            for (int j = 0; j < n; j++)
+            {
+                uint32_t q = 0;
+                while (bits.get(1) == 0)
+                {
+                    if (++q > uint32_t(max_unary) || bits.overrun())
+                        return false;
+                }
+                if (q == uint32_t(max_unary))
+                    r[i + j] = uint16_t(bits.get(sample_bits));
+                else
+                    r[i + j] = uint16_t((q << k) | (k ? bits.get(k) : 0));
+            }
+        }
+        return !bits.overrun();
+    }
+
+    inline void write_header(std::vector<uint8_t>& out, int width, int height, int bytes_per_pixel)
+    {
+        uint32_t fields[3] = { uint32_t(width), uint32_t(height), uint32_t(bytes_per_pixel) };
+        out.resize(header_size);
+        memcpy(out.data(), magic, sizeof(magic));
+        memcpy(out.data() + sizeof(magic), fields, sizeof(fields));
+    }
+
+    inline bool read_header(const std::vector<uint8_t>& in, int& width, int& height, int& bytes_per_pixel)
+    {
+        if (in.size() < size_t(header_size) || memcmp(in.data(), magic, 4) != 0)
+            return false;
+        uint32_t fields[3];
+        memcpy(fields, in.data() + 4, sizeof(fields));
+        width = int(fields[0]);
+        height = int(fields[1]);
+        bytes_per_pixel = int(fields[2]);
+        return bytes_per_pixel == 1 || bytes_per_pixel == 2;
+    }
+
+    // Decode into rows packed at width * bytes_per_pixel; used to verify round trips
+    inline bool decode(const std::vector<uint8_t>& in, std::vector<uint8_t>& pixels, int& width, int& height, int& bytes_per_pixel)
+    {
+        if (!read_header(in, width, height, bytes_per_pixel))
+            return false;
+        pixels.resize(size_t(width) * height * bytes_per_pixel);
+        std::vector<uint16_t> r(width);
+        bit_reader bits(in.data() + header_size, in.size() - header_size);
+        for (int y = 0; y < height; y++)
+        {
+            if (!decode_residuals(bits, width, bytes_per_pixel * 8, r.data()))
+                return false;
+            if (bytes_per_pixel == 2)
+            {
+                auto row = reinterpret_cast<uint16_t*>(pixels.data()) + size_t(y) * width;
+                uint16_t prev = y ? row[-width] : 0;
+                for (int x = 0; x < width; x++)
+                {
+                    int16_t d = int16_t((r[x] >> 1) ^ -(r[x] & 1));
+                    prev = row[x] = uint16_t(prev + d);
+                }
+            }
+            else
+            {
+                auto row = pixels.data() + size_t(y) * width;
+                uint8_t prev = y ? row[-width] : 0;
+                for (int x = 0; x < width; x++)
+                {
+                    int8_t d = int8_t((r[x] >> 1) ^ -(r[x] & 1));
+                    prev = row[x] = uint8_t(prev + d);
+                }
+            }
+        }
+        return true;
+    }
+}
+
+class rice_encoder : public frame_encoder
+{
+public:
+    const char* name() const override { return "rice"; }
+    const char* extension() const override { return ".rice"; }
+    bool supports(int bytes_per_pixel) const override { return bytes_per_pixel == 1 || bytes_per_pixel == 2; }
+
+    bool encode(const image_view& image, std::vector<uint8_t>& out) const override
+    {
+        if (!supports(image.bytes_per_pixel))
+            return false;
+
+        out.clear();
+        rice::write_header(out, image.width, image.height, image.bytes_per_pixel);
+
+        std::vector<uint16_t> r(image.width);
+        rice::bit_writer bits(out);
+        for (int y = 0; y < image.height; y++)
+        {
+            const uint8_t* row = image.data + size_t(y) * image.stride;
+            const uint8_t* above = y ? row - image.stride : nullptr;
+            if (image.bytes_per_pixel == 2)
+                rice::residuals16(reinterpret_cast<const uint16_t*>(row), reinterpret_cast<const uint16_t*>(above), image.width, r.data());
+            else
+                rice::residuals8(row, above, image.width, r.data());
+            rice::encode_residuals(r.data(), image.width, image.bytes_per_pixel * 8, bits);
+        }
+        bits.flush();
+        return true;
+    }
+};
+
+//------------------------------------------------------------------------------------------
+
+namespace tdc
+{
+    const char magic[4] = { 'T', 'D', 'C', '1' };
+    const int header_size = 40;   // magic, width, height, flags, number, reference, stripe count, reserved
+    const uint32_t flag_keyframe = 1;
+
+    // A frame's header; after it come the byte sizes of its stripes, then the stripes
+    struct frame_info
+    {
+        int width = 0;
+        int height = 0;
+        bool keyframe = true;
+        uint64_t number = 0;
+        uint64_t reference = 0;   // number of the frame it was predicted from (delta frames)
+        int stripes = 0;
+    };
+
+    inline uint16_t zigzag(int16_t r) { return uint16_t((uint32_t(r) << 1) ^ uint32_t(r >> 15)); }
+    inline int16_t unzigzag(uint16_t z) { return int16_t((z >> 1) ^ -(z & 1)); }
+
+    // LOCO-I median edge detector. a + b - c is only taken when c lies between a and b,
+    // where it cannot overflow.
+    inline int16_t med(int16_t a, int16_t b, int16_t c)
+    {
+        int16_t mx = std::max(a, b), mn = std::min(a, b);
+        return c >= mx ? mn : c <= mn ? mx : int16_t(a + b - c);
+    }
+
+    // Zig-zag MED residuals of one row of signed samples. A stripe's first row (above ==
+    // nullptr) predicts from the left, the first column from above.
+    inline void med_residuals(const int16_t* row, const int16_t* above, int width, uint16_t* out)
+    {
+        if (!above)
+        {
+            out[0] = zigzag(row[0]);
+            for (int x = 1; x < width; x++)
+                out[x] = zigzag(int16_t(row[x] - row[x - 1]));
+            return;
+        }
+        out[0] = zigzag(int16_t(row[0] - above[0]));
+        int x = 1;
+#ifdef FRAME_ENCODERS_SSE2
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x - 1));
+            __m128i mx = _mm_max_epi16(a, b), mn = _mm_min_epi16(a, b);
+            __m128i mid = _mm_sub_epi16(_mm_add_epi16(a, b), c);
+            __m128i below_max = _mm_cmplt_epi16(c, mx), above_min = _mm_cmpgt_epi16(c, mn);
+            __m128i inner = _mm_or_si128(_mm_and_si128(above_min, mid), _mm_andnot_si128(above_min, mx));
+            __m128i pred = _mm_or_si128(_mm_and_si128(below_max, inner), _mm_andnot_si128(below_max, mn));
+            __m128i r = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), pred);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_xor_si128(_mm_slli_epi16(r, 1), _mm_srai_epi16(r, 15)));
+        }
+#endif
+        for (; x < width; x++)
+            out[x] = zigzag(int16_t(row[x] - med(row[x - 1], above[x], above[x - 1])));
+    }
+
+    // Holes (0) are neither predicted from nor coded as residuals. Each row carries its
+    // hole runs, and prediction runs on a filled copy of the row in which a hole repeats
+    // the value left of it (the filled value above it at the row start, 0 at a stripe's).
+    inline void fill_row(const uint16_t* pixels, const uint16_t* filled_above, int width, uint16_t* filled)
+    {
+        uint16_t carry = filled_above ? filled_above[0] : 0;
+        for (int x = 0; x < width; x++)
+            carry = filled[x] = pixels[x] ? pixels[x] : carry;
+    }
+
+    // Alternating run lengths of valid pixels and holes, starting with valid (possibly 0)
+    inline int hole_runs(const uint16_t* pixels, int width, uint16_t* runs)
+    {
+        int n = 0, x = 0;
+        while (x < width)
+        {
+            int start = x;
+            while (x < width && pixels[x]) x++;
+            runs[n++] = uint16_t(x - start);
+            if (x == width)
+                break;
+            start = x;
+            while (x < width && !pixels[x]) x++;
+            runs[n++] = uint16_t(x - start);
+        }
+        return n;
+    }
+
+    // The residuals of the valid pixels only; returns how many, and their sum in `total`
+    inline int valid_residuals(const uint16_t* r, const uint16_t* pixels, int width, uint16_t* out, uint32_t& total)
+    {
+        int n = 0;
+        total = 0;
+        for (int x = 0; x < width; x++)
+        {
+            if (pixels[x])
+            {
+                out[n++] = r[x];
+                total += r[x];
+            }
+        }
+        return n;
+    }
+
+    // Spatial prediction works on filled depth with the sign bit flipped, so unsigned order
+    // becomes signed order; temporal prediction on the wrapped difference to the filled reference
+    inline void spatial_samples(const uint16_t* filled, int width, int16_t* out)
+    {
+        for (int x = 0; x < width; x++)
+            out[x] = int16_t(filled[x] ^ 0x8000);
+    }
+
+    inline void temporal_samples(const uint16_t* filled, const uint16_t* filled_reference, int width, int16_t* out)
+    {
+        for (int x = 0; x < width; x++)
+            out[x] = int16_t(filled[x] - filled_reference[x]);
+    }
+
+    struct stripe_rows { int first, end; };
+
+    inline stripe_rows stripe(int index, int stripes, int height)
+    {
+        int rows = (height + stripes - 1) / stripes;
+        return stripe_rows{ std::min(height, index * rows), std::min(height, (index + 1) * rows) };
+    }
+
+    // Runs body(stripe) for every stripe on up to `threads` threads
+    template<class F>
+    void for_each_stripe(int stripes, int threads, F body)
+    {
+        threads = std::max(1, std::min(threads, stripes));
+        if (threads == 1)
+        {
+            for (int i = 0; i < stripes; i++)
+                body(i);
+            return;
+        }
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; t++)
+        {
+            pool.emplace_back([&, t]()
+            {
+                for (int i = t; i < stripes; i += threads)
+                    body(i);
+            });
+        }
+        for (auto&& t : pool)
+            t.join();
+    }
+
+    // Current and previous row of every per-row array a stripe needs
+    struct row_state
+    {
+        explicit row_state(int width) : w(width), u16(size_t(width) * 4), i16(size_t(width) * 4) {}
+
+        void next()
+        {
+            std::swap(filled, filled_above);
+            std::swap(ref_filled, ref_filled_above);
+            std::swap(spatial, spatial_above);
+            std::swap(temporal, temporal_above);
+        }
+
+        int w;
+        std::vector<uint16_t> u16;
+        std::vector<int16_t> i16;
+        uint16_t* filled = u16.data();
+        uint16_t* filled_above = filled + w;
+        uint16_t* ref_filled = filled_above + w;
+        uint16_t* ref_filled_above = ref_filled + w;
+        int16_t* spatial = i16.data();
+        int16_t* spatial_above = spatial + w;
+        int16_t* temporal = spatial_above + w;
+        int16_t* temporal_above = temporal + w;
+    };
+
+    // One stripe of rows. A row is: [temporal bit, delta frames only] [has-holes bit]
+    // [run count (16 bits) and the hole runs, if it has holes] [residuals of its valid pixels].
+    inline void encode_stripe(const image_view& image, const image_view* reference, stripe_rows rows, std::vector<uint8_t>& out)
+    {
+        const int w = image.width;
+        row_state st(w);
+        std::vector<uint16_t> all(w), spatial(w), temporal(w), runs(size_t(w) + 1);
+
+        out.clear();
+        rice::bit_writer bits(out);
+        for (int y = rows.first; y < rows.end; y++)
+        {
+            bool first = y == rows.first;
+            auto row = reinterpret_cast<const uint16_t*>(image.data + size_t(y) * image.stride);
+            fill_row(row, first ? nullptr : st.filled_above, w, st.filled);
+            spatial_samples(st.filled, w, st.spatial);
+            med_residuals(st.spatial, first ? nullptr : st.spatial_above, w, all.data());
+            uint32_t spatial_sum = 0, temporal_sum = 0;
+            int valid = valid_residuals(all.data(), row, w, spatial.data(), spatial_sum);
+            const uint16_t* chosen = spatial.data();
+            if (reference)
+            {
+                auto ref = reinterpret_cast<const uint16_t*>(reference->data + size_t(y) * reference->stride);
+                fill_row(ref, first ? nullptr : st.ref_filled_above, w, st.ref_filled);
+                temporal_samples(st.filled, st.ref_filled, w, st.temporal);
+                med_residuals(st.temporal, first ? nullptr : st.temporal_above, w, all.data());
+                valid_residuals(all.data(), row, w, temporal.data(), temporal_sum);
+                bool use_temporal = temporal_sum < spatial_sum;
+                bits.put(use_temporal ? 1 : 0, 1);
+                if (use_temporal)
+                    chosen = temporal.data();
+            }
+
+            int n = hole_runs(row, w, runs.data());
+            bits.put(n > 1 ? 1 : 0, 1);
+            if (n > 1)
+            {
+                bits.put(uint32_t(n), 16);
+                rice::encode_residuals(runs.data(), n, 16, bits);
+            }
+            rice::encode_residuals(chosen, valid, 16, bits);
+            st.next();
+        }
+        bits.flush();
+    }
+
+    inline bool decode_stripe(const uint8_t* data, size_t size, const uint16_t* reference, int width, stripe_rows rows, uint16_t* pixels)
+    {
+        const int w = width;
+        row_state st(w);
+        std::vector<uint16_t> r(w), runs(size_t(w) + 1);
+        std::vector<uint8_t> valid(w);
+
+        rice::bit_reader bits(data, size);
+        for (int y = rows.first; y < rows.end; y++)
+        {
+            bool first = y == rows.first;
+            uint16_t* row = pixels + size_t(y) * w;
+            const uint16_t* ref = reference ? reference + size_t(y) * w : nullptr;
+            bool use_temporal = ref && bits.get(1) == 1;
+
+            int count = w;
+            std::fill(valid.begin(), valid.end(), uint8_t(1));
+            if (bits.get(1) == 1)
+            {
+                int n = int(bits.get(16));
+                if (n < 2 || n > w + 1 || !rice::decode_residuals(bits, n, 16, runs.data()))
+                    return false;
+                int x = 0;
+                for (int i = 0; i < n; i++)
+                {
+                    if (x + runs[i] > w)
+                        return false;
+                    if (i & 1)
+                    {
+                        std::fill(valid.begin() + x, valid.begin() + x + runs[i], uint8_t(0));
+                        count -= runs[i];
+                    }
+                    x += runs[i];
+                }
+                if (x != w)
+                    return false;
+            }
+            if (!rice::decode_residuals(bits, count, 16, r.data()))
+                return false;
+            if (ref)
+                fill_row(ref, first ? nullptr : st.ref_filled_above, w, st.ref_filled);
+
+            // Pixel by pixel: each prediction needs the pixel decoded just before it
+            uint16_t carry = first ? 0 : st.filled_above[0];
+            int16_t* samples = use_temporal ? st.temporal : st.spatial;
+            const int16_t* above = first ? nullptr : use_temporal ? st.temporal_above : st.spatial_above;
+            for (int x = 0, k = 0; x < w; x++)
+            {
+                if (valid[x])
+                {
+                    int16_t pred = x == 0 ? (above ? above[0] : 0)
+                                 : above ? med(samples[x - 1], above[x], above[x - 1]) : samples[x - 1];
+                    int16_t v = int16_t(pred + unzigzag(r[k++]));
+                    carry = use_temporal ? uint16_t(st.ref_filled[x] + uint16_t(v)) : uint16_t(uint16_t(v) ^ 0x8000);
+                    row[x] = carry;
+                }
+                else
+                {
+                    row[x] = 0;
+                }
+                st.filled[x] = carry;
+                st.spatial[x] = int16_t(carry ^ 0x8000);
+                if (ref)
+                    st.temporal[x] = int16_t(carry - st.ref_filled[x]);
+            }
+            st.next();
+        }
+        return !bits.overrun();
+    }
+
+    inline bool read_info(const std::vector<uint8_t>& in, frame_info& info)
+    {
+        if (in.size() < size_t(header_size) || memcmp(in.data(), magic, 4) != 0)
+            return false;
+        uint32_t dims[3], stripes;
+        memcpy(dims, in.data() + 4, sizeof(dims));
+        memcpy(&info.number, in.data() + 16, 8);
+        memcpy(&info.reference, in.data() + 24, 8);
+        memcpy(&stripes, in.data() + 32, 4);
+        info.width = int(dims[0]);
+        info.height = int(dims[1]);
+        info.keyframe = (dims[2] & flag_keyframe) != 0;
+        info.stripes = int(stripes);
+        return info.width > 0 && info.height > 0 && info.stripes > 0 && info.stripes <= info.height &&
+               in.size() >= size_t(header_size) + 4 * size_t(info.stripes);
+    }
+
+    // Decode into rows packed at width; `reference` holds the packed pixels of frame
+    // info.reference and is not read for keyframes
+    inline bool decode(const std::vector<uint8_t>& in, const uint16_t* reference, std::vector<uint16_t>& pixels,
+        frame_info& info, int threads = 1)
+    {
+        if (!read_info(in, info) || (!info.keyframe && !reference))
+            return false;
+        std::vector<uint32_t> sizes(info.stripes);
+        memcpy(sizes.data(), in.data() + header_size, 4 * sizes.size());
+        std::vector<size_t> offsets(info.stripes);
+        size_t offset = header_size + 4 * sizes.size();
+        for (int i = 0; i < info.stripes; i++)
+        {
+            offsets[i] = offset;
+            offset += sizes[i];
+        }
+        if (offset > in.size())
+            return false;
+
+        pixels.resize(size_t(info.width) * info.height);
+        std::atomic<bool> ok{ true };
+        for_each_stripe(info.stripes, threads, [&](int i)
+        {
+            if (!decode_stripe(in.data() + offsets[i], sizes[i], info.keyframe ? nullptr : reference, info.width,
+                stripe(i, info.stripes, info.height), pixels.data()))
+                ok = false;
+        });
+        return ok;
+    }
+}
+
+class tdc_encoder : public frame_encoder
+{
+public:
+    // Stripes are coded independently (the format); threads only decide how many are
+    // coded at once
+    explicit tdc_encoder(int stripes = 8, int threads = 1) : _stripes(std::max(1, stripes)), _threads(std::max(1, threads)) {}
+
+    const char* name() const override { return "tdc"; }
+    const char* extension() const override { return ".tdc"; }
+    bool supports(int bytes_per_pixel) const override { return bytes_per_pixel == 2; }
+    bool temporal() const override { return true; }
+
+    bool encode(const image_view& image, std::vector<uint8_t>& out) const override
+    {
+        return encode_temporal(image, 0, nullptr, 0, out);
+    }
+
+    bool encode_temporal(const image_view& image, uint64_t number, const image_view* reference,
+        uint64_t reference_number, std::vector<uint8_t>& out) const override
+    {
+        if (!supports(image.bytes_per_pixel) || image.width <= 0 || image.width > 32767 || image.height <= 0)
+            return false;
+        // A reference of another size (a resolution change, a different crop) cannot be used
+        if (reference && (reference->width != image.width || reference->height != image.height ||
+            reference->bytes_per_pixel != image.bytes_per_pixel))
+            reference = nullptr;
+
+        int stripes = std::min(_stripes, image.height);
+        std::vector<std::vector<uint8_t>> coded(stripes);
+        tdc::for_each_stripe(stripes, _threads, [&](int i)
+        {
+            tdc::encode_stripe(image, reference, tdc::stripe(i, stripes, image.height), coded[i]);
+        });
+
+        uint32_t fields[3] = { uint32_t(image.width), uint32_t(image.height), reference ? 0u : tdc::flag_keyframe };
+        uint64_t numbers[2] = { number, reference ? reference_number : 0 };
+        uint32_t tail[2] = { uint32_t(stripes), 0 };
+        out.resize(tdc::header_size + 4 * size_t(stripes));
+        memcpy(out.data(), tdc::magic, sizeof(tdc::magic));
+        memcpy(out.data() + 4, fields, sizeof(fields));
+        memcpy(out.data() + 16, numbers, sizeof(numbers));
+        memcpy(out.data() + 32, tail, sizeof(tail));
+        for (int i = 0; i < stripes; i++)
+        {
+            uint32_t size = uint32_t(coded[i].size());
+            memcpy(out.data() + tdc::header_size + 4 * i, &size, 4);
+        }
+        for (auto&& c : coded)
+            out.insert(out.end(), c.begin(), c.end());
+        return true;
+    }
+
+private:
+    int _stripes;
+    int _threads;
+};
+
+// Decodes one stream's .tdc frames in order, keeping the last frame as the reference of
+// the next. A delta frame whose reference is not the last decoded frame (it was dropped
+// or failed to write) cannot be decoded; decoding resumes at the next keyframe.
+class tdc_decoder
+{
+public:
+    explicit tdc_decoder(int threads = 1) : _threads(threads) {}
+
+    // Packed pixels of the frame; false with `error` set if it cannot be decoded
+    bool decode(const std::vector<uint8_t>& in, std::vector<uint16_t>& pixels, tdc::frame_info& info, std::string& error)
+    {
+        if (!tdc::read_info(in, info))
+        {
+            error = "not a tdc frame";
+            return false;
+        }
+        if (!info.keyframe && (!_has_previous || _previous_number != info.reference ||
+            _previous.size() != size_t(info.width) * info.height))
+        {
+            error = "reference frame " + std::to_string(info.reference) + " missing";
+            return false;
+        }
+        if (!tdc::decode(in, _previous.data(), pixels, info, _threads))
+        {
+            error = "corrupt frame";
+            _has_previous = false;
+            return false;
+        }
+        _previous = pixels;
+        _previous_number = info.number;
+        _has_previous = true;
+        return true;
+    }
+
+private:
+    int _threads;
+    std::vector<uint16_t> _previous;
+    uint64_t _previous_number = 0;
+    bool _has_previous = false;
+};
+
+//------------------------------------------------------------------------------------------
+
+inline std::shared_ptr<frame_encoder> make_frame_encoder(const std::string& name)
+{
+    if (name == "raw")  return std::make_shared<raw_encoder>();
+    if (name == "png")  return std::make_shared<png_encoder>();
+    if (name == "qoi")  return std::make_shared<qoi_encoder>();
+    if (name == "rice") return std::make_shared<rice_encoder>();
+    if (name == "tdc")  return std::make_shared<tdc_encoder>();
+    throw std::runtime_error("Unknown encoder " + name);
+}
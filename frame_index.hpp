@@ -0,0 +1,916 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>                 // opendir, readdir
+#include <fcntl.h>                  // open, posix_fadvise
+#include <sys/mman.h>               // mmap
+#include <sys/stat.h>
+#include <unistd.h>                 // pread, close
+#endif
+
+#include "raw_container.hpp"        // raw_index_record: dimensions from container indexes
+
+// Index of a capture directory: the one-file-per-frame dumps of poll_frames() and the
+// writer threads, [tag]fc<cnt>_ts<ts>_sn<serial>_<stream>.raw|png|qoi|rice|tdc, where the
+// tag is what the save path put in front ("filtered_", "ev3_", or nothing).
+//
+// build_frame_index() walks the tree and stats the files on a pool of threads, and
+// writes one sorted index file. frame_index maps that file and answers "serial X,
+// stream Y, timestamps A..B" with binary searches, without listing a directory.
+// frame_replayer reads the selected frames in order through mmap, with the kernel
+// reading the next few files ahead (posix_fadvise WILLNEED).
+//
+// .raw files have no header. Their dimensions come, in this order, from a raw container
+// index (.rawidx) in the tree for the same serial and stream, from an encoded file of
+// the same stream (png, qoi, rice, tdc headers) whose pixel count matches, or from the
+// file size against the resolutions RealSense cameras stream at - a guess, and marked as
+// one. Rebuilding with the previous index given opens only new or changed files.
+//
+//   file:    "RSFIDX01" | uint32 record size | uint32 root string | uint32 string count
+//            | uint32 reserved | uint64 record count | uint64 string bytes
+//            | strings (padded to 8 bytes) | records
+//   string:  uint32 length | bytes        sorted, so string ids order like the strings
+//   records: sorted by serial, stream, timestamp, frame counter, tag, extension
+
+const char frame_index_magic[8] = { 'R', 'S', 'F', 'I', 'D', 'X', '0', '1' };
+
+// Indexed by frame_index_record::extension
+const char* const frame_index_extensions[] = { ".raw", ".png", ".qoi", ".rice", ".tdc" };
+const int frame_index_extension_count = sizeof(frame_index_extensions) / sizeof(frame_index_extensions[0]);
+
+// Where a record's width, height and bytes per pixel came from
+enum class frame_dims_source : uint8_t { unknown, header, container, sibling, size, count };
+
+inline const char* frame_dims_source_name(frame_dims_source s)
+{
+    switch (s)
+    {
+    case frame_dims_source::header:    return "header";
+    case frame_dims_source::container: return "container";
+    case frame_dims_source::sibling:   return "sibling";
+    case frame_dims_source::size:      return "size";
+    default:                           return "unknown";
+    }
+}
+
+#pragma pack(push, 1)
+struct frame_index_header
+{
+    char     magic[8];
+    uint32_t record_size;
+    uint32_t root;                  // string id of the directory that was scanned
+    uint32_t strings;
+    uint32_t reserved;
+    uint64_t records;
+    uint64_t string_bytes;          // including the padding
+};
+
+struct frame_index_record
+{
+    uint32_t serial;                // string ids
+    uint32_t stream;
+    uint32_t tag;
+    uint32_t directory;             // relative to the root, "" for the root itself
+    int64_t  timestamp;             // the name's _ts (backend timestamp)
+    int64_t  frame_counter;         // the name's fc
+    uint64_t size;
+    int64_t  mtime;                 // seconds
+    uint16_t width;                 // 0 if unknown
+    uint16_t height;
+    uint8_t  bytes_per_pixel;
+    uint8_t  dims;                  // frame_dims_source
+    uint8_t  extension;             // frame_index_extensions
+    uint8_t  reserved[9];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(frame_index_record) == 64, "frame_index_record is a fixed-size on-disk record");
+
+// A file name taken apart
+struct frame_file_name
+{
+    std::string tag, serial, stream;
+    int64_t frame_counter = 0;
+    int64_t timestamp = 0;
+    uint8_t extension = 0;
+};
+
+inline std::string frame_file_name_string(const std::string& tag, int64_t frame_counter, int64_t timestamp,
+    const std::string& serial, const std::string& stream, uint8_t extension)
+{
+    return tag + "fc" + std::to_string(frame_counter) + "_ts" + std::to_string(timestamp) + "_sn" + serial + "_" +
+        stream + frame_index_extensions[extension];
+}
+
+// Accepts exactly the names the save path writes: the parts must print back to `name`
+inline bool parse_frame_file_name(const std::string& name, frame_file_name& out)
+{
+    auto dot = name.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    int extension = 0;
+    while (extension < frame_index_extension_count && name.compare(dot, std::string::npos, frame_index_extensions[extension]) != 0)
+        extension++;
+    if (extension == frame_index_extension_count)
+        return false;
+
+    // The tag may itself contain "fc"; try each until one parses
+    for (auto fc = name.find("fc"); fc != std::string::npos && fc < dot; fc = name.find("fc", fc + 1))
+    {
+        const char* p = name.c_str() + fc + 2;
+        char* end = nullptr;
+        long long counter = strtoll(p, &end, 10);
+        if (end == p || strncmp(end, "_ts", 3) != 0)
+            continue;
+        p = end + 3;
+        long long timestamp = strtoll(p, &end, 10);
+        if (end == p || strncmp(end, "_sn", 3) != 0)
+            continue;
+        size_t serial = size_t(end + 3 - name.c_str());
+        size_t underscore = name.rfind('_', dot);
+        if (underscore == std::string::npos || underscore <= serial || underscore + 1 == dot)
+            continue;
+
+        out.tag = name.substr(0, fc);
+        out.serial = name.substr(serial, underscore - serial);
+        out.stream = name.substr(underscore + 1, dot - underscore - 1);
+        out.frame_counter = counter;
+        out.timestamp = timestamp;
+        out.extension = uint8_t(extension);
+        return frame_file_name_string(out.tag, counter, timestamp, out.serial, out.stream, out.extension) == name;
+    }
+    return false;
+}
+
+// Width, height and bytes per pixel from the first bytes of an encoded frame
+// (see the encoders in frame_encoders.hpp; png is whatever stb wrote)
+inline bool read_encoded_dims(const uint8_t* p, size_t n, uint8_t extension, int& width, int& height, int& bytes_per_pixel)
+{
+    auto be32 = [&](size_t at) { return uint32_t(p[at]) << 24 | uint32_t(p[at + 1]) << 16 | uint32_t(p[at + 2]) << 8 | p[at + 3]; };
+    auto le32 = [&](size_t at) { uint32_t v; memcpy(&v, p + at, 4); return v; };
+    switch (extension)
+    {
+    case 1: // png: signature, then the IHDR chunk
+    {
+        static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        if (n < 26 || memcmp(p, signature, 8) != 0 || memcmp(p + 12, "IHDR", 4) != 0)
+            return false;
+        int channels[] = { 1, 0, 3, 1, 2, 0, 4 };   // by color type
+        int depth = p[24], color = p[25];
+        if (color > 6 || !channels[color])
+            return false;
+        width = int(be32(16));
+        height = int(be32(20));
+        bytes_per_pixel = channels[color] * std::max(1, depth / 8);
+        return true;
+    }
+    case 2: // qoi: "qoif" | uint32 width, height (big endian) | channels
+        if (n < 14 || memcmp(p, "qoif", 4) != 0)
+            return false;
+        width = int(be32(4));
+        height = int(be32(8));
+        bytes_per_pixel = p[12];
+        return true;
+    case 3: // rice: "RICE" | uint32 width, height, bytes per pixel
+        if (n < 16 || memcmp(p, "RICE", 4) != 0)
+            return false;
+        width = int(le32(4));
+        height = int(le32(8));
+        bytes_per_pixel = int(le32(12));
+        return true;
+    case 4: // tdc: "TDC1" | uint32 width, height | ... (always Z16)
+        if (n < 12 || memcmp(p, "TDC1", 4) != 0)
+            return false;
+        width = int(le32(4));
+        height = int(le32(8));
+        bytes_per_pixel = 2;
+        return true;
+    default:
+        return false;
+    }
+}
+
+namespace frame_index_detail
+{
+    // A read-only file, opened first (and with `prefetch` queued for reading by the
+    // kernel) and mapped when needed. An empty file maps to nothing.
+    class file_view
+    {
+    public:
+        file_view() {}
+
+        // is_open() tells whether it opened; nothing throws until map()
+        explicit file_view(const std::string& path, bool prefetch = false)
+            : _path(path)
+        {
+#ifndef _WIN32
+            _fd = open(path.c_str(), O_RDONLY);
+            if (_fd < 0)
+                return;
+            struct stat st;
+            if (fstat(_fd, &st) != 0)
+            {
+                close(_fd);
+                _fd = -1;
+                return;
+            }
+            _size = size_t(st.st_size);
+#if defined(POSIX_FADV_WILLNEED)
+            if (prefetch)
+                posix_fadvise(_fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+#else
+            (void)prefetch;
+#endif
+        }
+
+        ~file_view()
+        {
+            reset();
+        }
+
+        file_view(const file_view&) = delete;
+        file_view& operator=(const file_view&) = delete;
+        file_view(file_view&& other) { *this = std::move(other); }
+        file_view& operator=(file_view&& other)
+        {
+            if (this != &other)
+            {
+                reset();
+                std::swap(_path, other._path);
+                std::swap(_fd, other._fd);
+                std::swap(_data, other._data);
+                std::swap(_size, other._size);
+            }
+            return *this;
+        }
+
+        bool is_open() const { return _fd >= 0; }
+        const std::string& path() const { return _path; }
+        const uint8_t* data() const { return _data; }
+        size_t size() const { return _size; }
+
+        void map()
+        {
+#ifdef _WIN32
+            throw std::runtime_error("Frame index files are read through mmap, which needs POSIX");
+#else
+            if (_fd < 0)
+                throw std::runtime_error("Failed to open " + _path);
+            if (_data || !_size)
+                return;
+            void* p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+            if (p == MAP_FAILED)
+                throw std::runtime_error("Failed to map " + _path);
+            madvise(p, _size, MADV_SEQUENTIAL);
+            _data = static_cast<const uint8_t*>(p);
+#endif
+        }
+
+        // The first bytes without mapping the file
+        size_t read_head(uint8_t* out, size_t n) const
+        {
+#ifndef _WIN32
+            ssize_t got = _fd >= 0 ? pread(_fd, out, n, 0) : -1;
+            return got > 0 ? size_t(got) : 0;
+#else
+            (void)out; (void)n;
+            return 0;
+#endif
+        }
+
+    private:
+        void reset()
+        {
+#ifndef _WIN32
+            if (_data)
+                munmap(const_cast<uint8_t*>(_data), _size);
+            if (_fd >= 0)
+                close(_fd);
+#endif
+            _fd = -1;
+            _data = nullptr;
+            _size = 0;
+        }
+
+        std::string _path;
+        int _fd = -1;
+        const uint8_t* _data = nullptr;
+        size_t _size = 0;
+    };
+
+    inline std::string join(const std::string& directory, const std::string& name)
+    {
+        if (directory.empty())
+            return name;
+        return directory.back() == '/' ? directory + name : directory + "/" + name;
+    }
+
+    // Bytes per pixel a stream is likely saved at, most likely first
+    inline std::vector<int> likely_bytes_per_pixel(const std::string& stream)
+    {
+        if (stream == "Depth")                                  return { 2 };
+        if (stream == "Infrared" || stream == "Fisheye")        return { 1, 2 };
+        if (stream == "Color")                                  return { 3, 2, 4, 1 };
+        if (stream == "Confidence")                             return { 1 };
+        return { 2, 1, 3, 4 };
+    }
+
+    // Resolutions D400 / L500 / SR300 cameras stream at, plus what decimation by 2 and 4 gives
+    const uint16_t resolutions[][2] = {
+        { 1920, 1080 }, { 1280, 800 }, { 1280, 720 }, { 1024, 768 }, { 960, 540 }, { 848, 480 }, { 848, 100 },
+        { 640, 480 }, { 640, 400 }, { 640, 360 }, { 512, 384 }, { 480, 270 }, { 424, 240 }, { 320, 240 },
+        { 320, 180 }, { 256, 144 }, { 212, 120 }, { 160, 120 }
+    };
+
+    struct dims
+    {
+        int width, height, bytes_per_pixel;
+        uint64_t bytes() const { return uint64_t(width) * height * bytes_per_pixel; }
+        bool operator<(const dims& o) const
+        {
+            return std::tie(width, height, bytes_per_pixel) < std::tie(o.width, o.height, o.bytes_per_pixel);
+        }
+    };
+
+    // A frame file found by the walk, before it has a string table
+    struct scanned_file
+    {
+        uint32_t directory;         // into the walk's directory list
+        frame_file_name name;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        dims found{ 0, 0, 0 };
+        frame_dims_source source = frame_dims_source::unknown;
+        bool missing = false;       // gone between listing and stat
+    };
+}
+
+// Frames to select; an empty serial or stream means all of them
+struct frame_query
+{
+    std::string serial;
+    std::string stream;             // as in the file names: "Depth", "Color", "Infrared", ...
+    int64_t from = std::numeric_limits<int64_t>::min();   // backend timestamps, inclusive
+    int64_t to = std::numeric_limits<int64_t>::max();
+    bool any_tag = true;
+    std::string tag;                // with any_tag false: only this prefix ("" for plain captures)
+};
+
+class frame_index
+{
+public:
+    explicit frame_index(const std::string& path)
+        : _file(path)
+    {
+        _file.map();
+        auto bad = [&]() { return std::runtime_error(path + " is not a frame index"); };
+        if (_file.size() < sizeof(frame_index_header))
+            throw bad();
+        memcpy(&_header, _file.data(), sizeof(_header));
+        if (memcmp(_header.magic, frame_index_magic, sizeof(_header.magic)) != 0 ||
+            _header.record_size != sizeof(frame_index_record) ||
+            _file.size() != sizeof(_header) + _header.string_bytes + _header.records * sizeof(frame_index_record))
+            throw bad();
+
+        const uint8_t* p = _file.data() + sizeof(_header);
+        const uint8_t* strings_end = p + _header.string_bytes;
+        for (uint32_t i = 0; i < _header.strings; i++)
+        {
+            uint32_t length;
+            if (strings_end - p < 4)
+                throw bad();
+            memcpy(&length, p, 4);
+            if (size_t(strings_end - p - 4) < length)
+                throw bad();
+            _strings.emplace_back(reinterpret_cast<const char*>(p + 4), length);
+            p += 4 + length;
+        }
+        if (_header.root >= _strings.size())
+            throw bad();
+        _records = reinterpret_cast<const frame_index_record*>(strings_end);
+    }
+
+    const std::string& root() const { return _strings[_header.root]; }
+    size_t size() const { return size_t(_header.records); }
+    const frame_index_record* begin() const { return _records; }
+    const frame_index_record* end() const { return _records + _header.records; }
+    const std::string& string(uint32_t id) const { return _strings.at(id); }
+
+    bool find_string(const std::string& s, uint32_t& id) const
+    {
+        auto it = std::lower_bound(_strings.begin(), _strings.end(), s);
+        if (it == _strings.end() || *it != s)
+            return false;
+        id = uint32_t(it - _strings.begin());
+        return true;
+    }
+
+    std::string name(const frame_index_record& r) const
+    {
+        return frame_file_name_string(string(r.tag), r.frame_counter, r.timestamp, string(r.serial), string(r.stream), r.extension);
+    }
+
+    std::string path(const frame_index_record& r) const
+    {
+        using frame_index_detail::join;
+        return join(join(root(), string(r.directory)), name(r));
+    }
+
+    // One serial / stream pair after the other, each in timestamp order
+    std::vector<std::pair<const frame_index_record*, const frame_index_record*>> streams() const
+    {
+        std::vector<std::pair<const frame_index_record*, const frame_index_record*>> out;
+        for (auto s = begin(); s != end(); )
+        {
+            auto e = std::upper_bound(s, end(), *s, same_stream_less);
+            out.emplace_back(s, e);
+            s = e;
+        }
+        return out;
+    }
+
+    // Matching frames in timestamp order (across streams by timestamp, then serial and stream)
+    std::vector<const frame_index_record*> select(const frame_query& q) const
+    {
+        std::vector<const frame_index_record*> out;
+        auto first = begin(), last = end();
+        frame_index_record key{};
+        if (!q.serial.empty())
+        {
+            if (!find_string(q.serial, key.serial))
+                return out;
+            std::tie(first, last) = std::equal_range(first, last, key,
+                [](const frame_index_record& a, const frame_index_record& b) { return a.serial < b.serial; });
+        }
+        uint32_t stream = 0;
+        if (!q.stream.empty() && !find_string(q.stream, stream))
+            return out;
+        uint32_t tag = 0;
+        if (!q.any_tag && !find_string(q.tag, tag))
+            return out;
+
+        size_t runs = 0;
+        for (auto s = first; s != last; )
+        {
+            auto e = std::upper_bound(s, last, *s, same_stream_less);
+            if (q.stream.empty() || s->stream == stream)
+            {
+                auto from = std::lower_bound(s, e, q.from, [](const frame_index_record& r, int64_t t) { return r.timestamp < t; });
+                auto to = std::upper_bound(from, e, q.to, [](int64_t t, const frame_index_record& r) { return t < r.timestamp; });
+                for (auto r = from; r != to; r++)
+                {
+                    if (q.any_tag || r->tag == tag)
+                        out.push_back(r);
+                }
+                runs++;
+            }
+            s = e;
+        }
+        if (runs > 1)
+        {
+            std::stable_sort(out.begin(), out.end(), [](const frame_index_record* a, const frame_index_record* b)
+            {
+                return a->timestamp < b->timestamp;
+            });
+        }
+        return out;
+    }
+
+private:
+    static bool same_stream_less(const frame_index_record& a, const frame_index_record& b)
+    {
+        return std::tie(a.serial, a.stream) < std::tie(b.serial, b.stream);
+    }
+
+    frame_index_detail::file_view _file;
+    frame_index_header _header;
+    std::vector<std::string> _strings;
+    const frame_index_record* _records = nullptr;
+};
+
+struct frame_index_build_stats
+{
+    uint64_t directories = 0;
+    uint64_t files = 0;             // frame files indexed
+    uint64_t ignored = 0;           // other files
+    uint64_t reused = 0;            // unchanged since the previous index: not opened
+    uint64_t bytes = 0;
+    uint64_t dims[size_t(frame_dims_source::count)] = {};
+    double seconds = 0;
+};
+
+// Scans `root` on `threads` threads and writes the index to `index_path` (replaced as a
+// whole). With `previous`, files whose size and modification time did not change keep
+// their dimensions instead of being opened again.
+inline frame_index_build_stats build_frame_index(const std::string& root, const std::string& index_path, size_t threads,
+    const frame_index* previous = nullptr)
+{
+#ifdef _WIN32
+    (void)root; (void)index_path; (void)threads; (void)previous;
+    throw std::runtime_error("Building a frame index needs POSIX directory listing");
+#else
+    using namespace frame_index_detail;
+    auto start = std::chrono::steady_clock::now();
+    threads = std::max<size_t>(1, threads);
+    frame_index_build_stats stats;
+
+    // Walk: the pool lists directories, each queueing the subdirectories it finds
+    std::mutex walk_mutex;
+    std::condition_variable walk_cv;
+    std::vector<std::string> directories{ "" };
+    std::deque<uint32_t> pending{ 0 };
+    size_t listing = 0;
+    std::vector<std::vector<scanned_file>> found(threads);
+    std::vector<std::string> containers;
+    std::atomic<uint64_t> ignored{ 0 };
+    std::string error;
+
+    auto walk = [&](size_t worker)
+    {
+        for (;;)
+        {
+            std::string relative;
+            uint32_t id;
+            {
+                std::unique_lock<std::mutex> lock(walk_mutex);
+                walk_cv.wait(lock, [&]() { return !pending.empty() || listing == 0; });
+                if (pending.empty())
+                    return;
+                id = pending.front();
+                pending.pop_front();
+                relative = directories[id];
+                listing++;
+            }
+
+            std::string full = join(root, relative);
+            std::vector<std::string> subdirectories, indexes;
+            DIR* dir = opendir(full.c_str());
+            if (dir)
+            {
+                frame_file_name name;
+                while (dirent* entry = readdir(dir))
+                {
+                    std::string file(entry->d_name);
+                    if (file == "." || file == "..")
+                        continue;
+                    bool is_dir = entry->d_type == DT_DIR;
+                    if (entry->d_type == DT_UNKNOWN)
+                    {
+                        struct stat st;
+                        is_dir = stat(join(full, file).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+                    }
+                    if (is_dir)
+                        subdirectories.push_back(join(relative, file));
+                    else if (parse_frame_file_name(file, name))
+                    {
+                        scanned_file f;
+                        f.directory = id;
+                        f.name = name;
+                        found[worker].push_back(std::move(f));
+                    }
+                    else if (file.size() > 7 && file.compare(file.size() - 7, 7, ".rawidx") == 0)
+                        indexes.push_back(join(full, file.substr(0, file.size() - 7)));
+                    else
+                        ignored++;
+                }
+                closedir(dir);
+            }
+
+            std::lock_guard<std::mutex> lock(walk_mutex);
+            if (!dir && relative.empty())
+                error = "Failed to list " + full; // an unreadable subdirectory is only left out
+            for (auto&& d : subdirectories)
+            {
+                pending.push_back(uint32_t(directories.size()));
+                directories.push_back(d);
+            }
+            containers.insert(containers.end(), indexes.begin(), indexes.end());
+            listing--;
+            walk_cv.notify_all();
+        }
+    };
+    {
+        std::vector<std::thread> pool;
+        for (size_t i = 0; i < threads; i++)
+            pool.emplace_back(walk, i);
+        for (auto&& t : pool)
+            t.join();
+    }
+    if (!error.empty())
+        throw std::runtime_error(error);
+
+    std::vector<scanned_file> files;
+    for (auto&& v : found)
+    {
+        files.insert(files.end(), std::make_move_iterator(v.begin()), std::make_move_iterator(v.end()));
+        v.clear();
+    }
+
+    // Unchanged files of the previous index, by path
+    std::unordered_map<std::string, const frame_index_record*> known;
+    if (previous && previous->root() == root)
+    {
+        for (auto& r : *previous)
+        {
+            auto source = frame_dims_source(r.dims);
+            if (source == frame_dims_source::header || source == frame_dims_source::container || source == frame_dims_source::sibling)
+                known.emplace(join(previous->string(r.directory), previous->name(r)), &r);
+        }
+    }
+
+    // Stat every file, and read the header of the encoded ones, in chunks across the pool
+    std::atomic<size_t> next{ 0 };
+    std::atomic<uint64_t> reused{ 0 };
+    auto inspect = [&]()
+    {
+        const size_t chunk = 256;
+        for (size_t begin; (begin = next.fetch_add(chunk)) < files.size(); )
+        {
+            for (size_t i = begin; i < std::min(files.size(), begin + chunk); i++)
+            {
+                auto& f = files[i];
+                std::string relative = join(directories[f.directory], frame_file_name_string(f.name.tag,
+                    f.name.frame_counter, f.name.timestamp, f.name.serial, f.name.stream, f.name.extension));
+                struct stat st;
+                if (stat(join(root, relative).c_str(), &st) != 0)
+                {
+                    f.missing = true;
+                    continue;
+                }
+                f.size = uint64_t(st.st_size);
+                f.mtime = int64_t(st.st_mtime);
+
+                auto old = known.find(relative);
+                if (old != known.end() && old->second->size == f.size && old->second->mtime == f.mtime)
+                {
+                    f.found = dims{ old->second->width, old->second->height, old->second->bytes_per_pixel };
+                    f.source = frame_dims_source(old->second->dims);
+                    reused++;
+                    continue;
+                }
+                if (f.name.extension == 0)
+                    continue; // raw: inferred below, once every header is known
+
+                file_view file(join(root, relative));
+                uint8_t head[32];
+                size_t n = file.read_head(head, sizeof(head));
+                if (read_encoded_dims(head, n, f.name.extension, f.found.width, f.found.height, f.found.bytes_per_pixel) &&
+                    f.found.width > 0 && f.found.width <= 65535 && f.found.height > 0 && f.found.height <= 65535 &&
+                    f.found.bytes_per_pixel > 0 && f.found.bytes_per_pixel <= 8)
+                    f.source = frame_dims_source::header;
+                else
+                    f.found = dims{ 0, 0, 0 };
+            }
+        }
+    };
+    {
+        std::vector<std::thread> pool;
+        for (size_t i = 0; i < threads; i++)
+            pool.emplace_back(inspect);
+        for (auto&& t : pool)
+            t.join();
+    }
+    files.erase(std::remove_if(files.begin(), files.end(), [](const scanned_file& f) { return f.missing; }), files.end());
+
+    // What each stream is known to be saved at: container indexes, then encoded files
+    typedef std::tuple<std::string, std::string, std::string> stream_key;   // serial, stream, tag
+    std::map<stream_key, std::set<dims>> container_dims, sibling_dims;
+    for (auto&& prefix : containers)
+    {
+        try
+        {
+            raw_container_reader container(prefix);
+            for (auto&& r : container.records())
+            {
+                if (!r.width || r.stride % r.width)
+                    continue;
+                // File names stop at the first space of the stream name ("Infrared 1" -> "Infrared")
+                auto stream = raw_record_stream_name(r);
+                stream = stream.substr(0, stream.find(' '));
+                container_dims[stream_key(raw_record_serial(r), stream, "")].insert(dims{ r.width, r.height, int(r.stride / r.width) });
+            }
+        }
+        catch (const std::exception&)
+        {
+            // A damaged container only means fewer known dimensions
+        }
+    }
+    for (auto&& f : files)
+    {
+        if (f.source == frame_dims_source::header)
+            sibling_dims[stream_key(f.name.serial, f.name.stream, f.name.tag)].insert(f.found);
+    }
+
+    auto match = [](const std::map<stream_key, std::set<dims>>& known_dims, const stream_key& key, uint64_t size, dims& out)
+    {
+        auto it = known_dims.find(key);
+        if (it == known_dims.end())
+            return false;
+        for (auto&& d : it->second)
+        {
+            if (d.bytes() == size)
+            {
+                out = d;
+                return true;
+            }
+        }
+        return false;
+    };
+    for (auto&& f : files)
+    {
+        if (f.name.extension != 0 || f.source != frame_dims_source::unknown)
+            continue;
+        stream_key key(f.name.serial, f.name.stream, f.name.tag), untagged(f.name.serial, f.name.stream, "");
+        if (match(container_dims, untagged, f.size, f.found))
+            f.source = frame_dims_source::container;
+        else if (match(sibling_dims, key, f.size, f.found) || match(sibling_dims, untagged, f.size, f.found))
+            f.source = frame_dims_source::sibling;
+        else
+        {
+            for (int bpp : likely_bytes_per_pixel(f.name.stream))
+            {
+                for (auto&& r : resolutions)
+                {
+                    if (f.source == frame_dims_source::unknown && uint64_t(r[0]) * r[1] * bpp == f.size)
+                    {
+                        f.found = dims{ r[0], r[1], bpp };
+                        f.source = frame_dims_source::size;
+                    }
+                }
+            }
+        }
+    }
+
+    // String table, sorted so that ids order like the strings
+    std::vector<std::string> strings{ root };
+    for (auto&& d : directories)
+        strings.push_back(d);
+    for (auto&& f : files)
+    {
+        strings.push_back(f.name.serial);
+        strings.push_back(f.name.stream);
+        strings.push_back(f.name.tag);
+    }
+    std::sort(strings.begin(), strings.end());
+    strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    auto id_of = [&](const std::string& s) { return uint32_t(std::lower_bound(strings.begin(), strings.end(), s) - strings.begin()); };
+
+    std::vector<uint32_t> directory_ids;
+    for (auto&& d : directories)
+        directory_ids.push_back(id_of(d));
+    std::vector<frame_index_record> records(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        auto& f = files[i];
+        auto& r = records[i];
+        r = frame_index_record{};
+        r.serial = id_of(f.name.serial);
+        r.stream = id_of(f.name.stream);
+        r.tag = id_of(f.name.tag);
+        r.directory = directory_ids[f.directory];
+        r.timestamp = f.name.timestamp;
+        r.frame_counter = f.name.frame_counter;
+        r.size = f.size;
+        r.mtime = f.mtime;
+        r.width = uint16_t(f.found.width);
+        r.height = uint16_t(f.found.height);
+        r.bytes_per_pixel = uint8_t(f.found.bytes_per_pixel);
+        r.dims = uint8_t(f.source);
+        r.extension = f.name.extension;
+        stats.bytes += f.size;
+        stats.dims[size_t(f.source)]++;
+    }
+    files.clear();
+    std::sort(records.begin(), records.end(), [](const frame_index_record& a, const frame_index_record& b)
+    {
+        return std::tie(a.serial, a.stream, a.timestamp, a.frame_counter, a.tag, a.extension, a.directory) <
+               std::tie(b.serial, b.stream, b.timestamp, b.frame_counter, b.tag, b.extension, b.directory);
+    });
+
+    // Written next to the old one and renamed over it, so readers never see half an index
+    std::vector<uint8_t> table;
+    for (auto&& s : strings)
+    {
+        uint32_t length = uint32_t(s.size());
+        table.insert(table.end(), reinterpret_cast<const uint8_t*>(&length), reinterpret_cast<const uint8_t*>(&length) + 4);
+        table.insert(table.end(), s.begin(), s.end());
+    }
+    table.resize((table.size() + 7) / 8 * 8);
+
+    frame_index_header header{};
+    memcpy(header.magic, frame_index_magic, sizeof(header.magic));
+    header.record_size = sizeof(frame_index_record);
+    header.root = id_of(root);
+    header.strings = uint32_t(strings.size());
+    header.records = records.size();
+    header.string_bytes = table.size();
+
+    std::string temp = index_path + ".tmp";
+    {
+        struct file_closer { void operator()(FILE* f) const { fclose(f); } };
+        std::unique_ptr<FILE, file_closer> out(fopen(temp.c_str(), "wb"));
+        bool ok = out && fwrite(&header, sizeof(header), 1, out.get()) == 1 &&
+            (table.empty() || fwrite(table.data(), table.size(), 1, out.get()) == 1) &&
+            (records.empty() || fwrite(records.data(), sizeof(frame_index_record), records.size(), out.get()) == records.size());
+        if (!ok || fflush(out.get()) != 0)
+            throw std::runtime_error("Failed to write " + temp);
+    }
+    if (std::rename(temp.c_str(), index_path.c_str()) != 0)
+        throw std::runtime_error("Failed to replace " + index_path);
+
+    stats.directories = directories.size();
+    stats.files = records.size();
+    stats.ignored = ignored;
+    stats.reused = reused;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+#endif
+}
+
+// A selected frame, mapped; `data` stays valid until the next call to next()
+struct replayed_frame
+{
+    const frame_index_record* record = nullptr;
+    std::string path;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// Reads selected frames in order. The next `read_ahead` files are kept open with the
+// kernel already reading them, so the caller rarely waits for the disk; the current
+// one is mapped, not copied.
+class frame_replayer
+{
+public:
+    frame_replayer(const frame_index& index, std::vector<const frame_index_record*> frames, size_t read_ahead = 16)
+        : _index(index), _frames(std::move(frames)), _read_ahead(std::max<size_t>(1, read_ahead)) {}
+
+    // False when every frame was read. Files gone since indexing are skipped and counted.
+    bool next(replayed_frame& f)
+    {
+        for (;;)
+        {
+            while (_ahead.size() < _read_ahead && _opened < _frames.size())
+            {
+                _ahead.emplace_back(_index.path(*_frames[_opened]), true);
+                _opened++;
+            }
+            if (_ahead.empty())
+                return false;
+
+            _current = std::move(_ahead.front());
+            _ahead.pop_front();
+            auto record = _frames[_next++];
+            if (!_current.is_open())
+            {
+                _missing++;
+                continue;
+            }
+            _current.map();
+            f.record = record;
+            f.path = _current.path();
+            f.data = _current.data();
+            f.size = _current.size();
+            return true;
+        }
+    }
+
+    size_t position() const { return _next; }
+    size_t size() const { return _frames.size(); }
+    uint64_t missing() const { return _missing; }
+
+private:
+    const frame_index& _index;
+    std::vector<const frame_index_record*> _frames;
+    size_t _read_ahead;
+    std::deque<frame_index_detail::file_view> _ahead;
+    frame_index_detail::file_view _current;
+    size_t _opened = 0, _next = 0;
+    uint64_t _missing = 0;
+};
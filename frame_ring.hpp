@@ -0,0 +1,248 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Host wall clock in milliseconds, the same domain as RS2_FRAME_METADATA_TIME_OF_ARRIVAL
+inline double host_time_ms()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(system_clock::now().time_since_epoch()).count();
+}
+
+inline size_t frame_bytes(const rs2::frame& f)
+{
+    if (auto vf = f.as<rs2::video_frame>())
+        return size_t(vf.get_height()) * vf.get_stride_in_bytes();
+    return size_t(f.get_data_size());
+}
+
+struct frame_ring_stats
+{
+    size_t frames = 0;
+    size_t bytes = 0;
+    size_t byte_budget = 0;
+    uint64_t pushed = 0;
+    uint64_t evicted = 0;
+};
+
+// Fixed-capacity ring of kept frames for one device/stream. The slots are allocated
+// once; the frames themselves stay in librealsense's buffers (no copy), and the oldest
+// ones are released as soon as the byte budget or the slot count would be exceeded.
+class frame_ring
+{
+    struct slot
+    {
+        rs2::frame frame;
+        double host_ms;
+        size_t bytes;
+    };
+
+public:
+    frame_ring(size_t byte_budget, size_t max_frames)
+        : _slots(max_frames ? max_frames : 1), _byte_budget(byte_budget)
+    {
+    }
+
+    void push(rs2::frame f, double arrival_ms = host_time_ms())
+    {
+        f.keep();
+        size_t bytes = frame_bytes(f);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (bytes > _byte_budget)
+        {
+            _evicted++; // larger than the whole budget, never retained
+            return;
+        }
+        while (_count == _slots.size() || _bytes + bytes > _byte_budget)
+            evict_oldest();
+
+        auto& s = _slots[(_head + _count) % _slots.size()];
+        s.frame = std::move(f);
+        s.host_ms = arrival_ms;
+        s.bytes = bytes;
+        _count++;
+        _bytes += bytes;
+        _pushed++;
+    }
+
+    // Frames that arrived within [from_ms, to_ms], oldest first. The returned handles
+    // share the retained buffers, so they stay valid after the ring evicts them.
+    std::vector<std::pair<double, rs2::frame>> snapshot(double from_ms, double to_ms) const
+    {
+        std::vector<std::pair<double, rs2::frame>> result;
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _count; i++)
+        {
+            auto& s = _slots[(_head + i) % _slots.size()];
+            if (s.host_ms >= from_ms && s.host_ms <= to_ms)
+                result.emplace_back(s.host_ms, s.frame);
+        }
+        return result;
+    }
+
+    frame_ring_stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        frame_ring_stats st;
+        st.frames = _count;
+        st.bytes = _bytes;
+        st.byte_budget = _byte_budget;
+        st.pushed = _pushed;
+        st.evicted = _evicted;
+        return st;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (_count)
+            evict_oldest();
+    }
+
+private:
+    void evict_oldest()
+    {
+        auto& s = _slots[_head];
+        s.frame = rs2::frame();
+        _bytes -= s.bytes;
+        _head = (_head + 1) % _slots.size();
+        _count--;
+        _evicted++;
+    }
+
+    mutable std::mutex _mutex;
+    std::vector<slot> _slots;
+    size_t _head = 0;
+    size_t _count = 0;
+    size_t _bytes = 0;
+    size_t _byte_budget;
+    uint64_t _pushed = 0;
+    uint64_t _evicted = 0;
+};
+
+// One frame_ring per device serial and stream, each with the same budget. A ring has as
+// many slots as frames of its stream's first frame's size fit in the budget, so for
+// video the byte budget is what limits retention. `max_frames_per_stream` caps the
+// slots (and so the slot array) for tiny frames such as motion samples: 65536 is
+// about 12 minutes at 90 fps.
+class frame_retention
+{
+public:
+    frame_retention(size_t byte_budget_per_stream, size_t max_frames_per_stream = 1 << 16)
+        : _byte_budget(byte_budget_per_stream), _max_frames(max_frames_per_stream),
+          _last_report(std::chrono::steady_clock::now())
+    {
+    }
+
+    // Empty frames (e.g. no depth in a color-only frameset) are ignored
+    void push(const std::string& serial, const rs2::frame& f, double arrival_ms = host_time_ms())
+    {
+        if (!f)
+            return;
+        ring_for(serial, f).push(f, arrival_ms);
+    }
+
+    struct retained_frame
+    {
+        std::string serial;
+        double host_ms;
+        rs2::frame frame;
+    };
+
+    // Every retained frame from every device/stream that arrived within [from_ms, to_ms]
+    std::vector<retained_frame> snapshot(double from_ms, double to_ms)
+    {
+        std::vector<retained_frame> result;
+        for (auto&& ring : rings())
+        {
+            for (auto&& f : ring.second->snapshot(from_ms, to_ms))
+                result.push_back(retained_frame{ ring.first.first, f.first, f.second });
+        }
+        return result;
+    }
+
+    // The last `seconds` of every stream
+    std::vector<retained_frame> snapshot_last(double seconds)
+    {
+        auto now = host_time_ms();
+        return snapshot(now - seconds * 1000., now);
+    }
+
+    frame_ring_stats total_stats()
+    {
+        frame_ring_stats total;
+        for (auto&& ring : rings())
+        {
+            auto st = ring.second->stats();
+            total.frames += st.frames;
+            total.bytes += st.bytes;
+            total.byte_budget += st.byte_budget;
+            total.pushed += st.pushed;
+            total.evicted += st.evicted;
+        }
+        return total;
+    }
+
+    // Memory in use per ring and evictions per second since the previous report
+    void print_report()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - _last_report).count();
+        _last_report = now;
+
+        for (auto&& ring : rings())
+        {
+            auto st = ring.second->stats();
+            auto& last = _last_evicted[ring.first];
+            double rate = seconds > 0 ? (st.evicted - last) / seconds : 0.;
+            last = st.evicted;
+            printf("retained sn: %s stream=%d frames=%zu mem=%.1f/%.1f MB evictions=%.1f/s\n",
+                ring.first.first.c_str(), ring.first.second, st.frames,
+                st.bytes / 1048576., st.byte_budget / 1048576., rate);
+        }
+    }
+
+private:
+    typedef std::pair<std::string, int> ring_key; // serial, stream unique id
+
+    frame_ring& ring_for(const std::string& serial, const rs2::frame& first)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& ring = _rings[ring_key(serial, first.get_profile().unique_id())];
+        if (!ring)
+        {
+            size_t slots = std::min(_byte_budget / std::max<size_t>(frame_bytes(first), 1), _max_frames);
+            ring = std::make_shared<frame_ring>(_byte_budget, slots);
+        }
+        return *ring;
+    }
+
+    std::map<ring_key, std::shared_ptr<frame_ring>> rings()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _rings;
+    }
+
+    size_t _byte_budget;
+    size_t _max_frames;
+    std::mutex _mutex;
+    std::map<ring_key, std::shared_ptr<frame_ring>> _rings;
+
+    std::chrono::steady_clock::time_point _last_report;
+    std::map<ring_key, uint64_t> _last_evicted;
+};
@@ -0,0 +1,371 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Maps one camera's hardware clock onto host time.
+//
+// Arrival time = true capture time + a positive, jittery transport latency, so fitting
+// host on device time directly is biased late and noisy. Instead the least-delayed frame
+// of every `bin_ms` of device time is kept (the lower envelope), the drift is the
+// least-squares slope through those minima over the last `bins` bins, and the offset
+// puts the line on the envelope.
+class device_clock_model
+{
+public:
+    explicit device_clock_model(double bin_ms = 1000., size_t bins = 60)
+        : _bin_ms(bin_ms), _max_bins(bins)
+    {
+    }
+
+    void add(double device_ms, double host_ms)
+    {
+        // Hardware clock reset or wrap-around: start over
+        if (_count && device_ms + 1000. < _last_device)
+            reset();
+        if (!_count)
+        {
+            _device_origin = device_ms;
+            _host_origin = host_ms;
+            _bin_start = 0;
+            _bin_min = std::make_pair(0., 0.);
+        }
+        _count++;
+        _last_device = device_ms;
+
+        double x = device_ms - _device_origin, y = host_ms - _host_origin;
+        if (x - _bin_start >= _bin_ms)
+        {
+            _bins.push_back(_bin_min);
+            if (_bins.size() > _max_bins)
+                _bins.pop_front();
+            _bin_start = x;
+            _bin_min = std::make_pair(x, y);
+            fit();
+        }
+        else if (y - x < _bin_min.second - _bin_min.first || _count == 1)
+        {
+            _bin_min = std::make_pair(x, y);
+        }
+        _offset = std::min(_offset, y - _slope * x);
+    }
+
+    double to_host(double device_ms) const
+    {
+        return _host_origin + _offset + _slope * (device_ms - _device_origin);
+    }
+
+    bool valid() const { return _count > 0; }
+    double offset_ms() const { return _host_origin + _offset - _device_origin; }    // host - device at device time 0
+    double drift_ppm() const { return (1. / _slope - 1.) * 1e6; }                  // device clock rate vs host
+
+    void reset()
+    {
+        _bins.clear();
+        _count = 0;
+        _slope = 1.;
+        _offset = 0.;
+    }
+
+private:
+    void fit()
+    {
+        double slope = 1.;
+        size_t n = _bins.size();
+        if (n >= 3)
+        {
+            double mx = 0, my = 0;
+            for (auto&& b : _bins) { mx += b.first; my += b.second; }
+            mx /= n; my /= n;
+            double sxx = 0, sxy = 0;
+            for (auto&& b : _bins)
+            {
+                sxx += (b.first - mx) * (b.first - mx);
+                sxy += (b.first - mx) * (b.second - my);
+            }
+            if (sxx > 0)
+                slope = sxy / sxx;
+            if (std::fabs(slope - 1.) > 1e-3) // > 1000 ppm is not a crystal, it is a bad fit
+                slope = 1.;
+        }
+
+        double offset = _bin_min.second - slope * _bin_min.first;
+        for (auto&& b : _bins)
+            offset = std::min(offset, b.second - slope * b.first);
+        _slope = slope;
+        _offset = offset;
+    }
+
+    double _bin_ms;
+    size_t _max_bins;
+    uint64_t _count = 0;
+    double _last_device = 0;
+    double _device_origin = 0, _host_origin = 0;
+    double _bin_start = 0;
+    std::pair<double, double> _bin_min;                 // least-delayed sample of the current bin
+    std::deque<std::pair<double, double>> _bins;        // least-delayed sample of each completed bin
+    double _slope = 1., _offset = 0.;
+};
+
+// Fixed-bin histogram for the synchronizer report
+struct sync_histogram
+{
+    sync_histogram(double bin_width, size_t bins) : width(bin_width), counts(bins + 1, 0) {}
+
+    void add(double v)
+    {
+        size_t bin = v <= 0 ? 0 : std::min(counts.size() - 1, size_t(v / width));
+        counts[bin]++;
+    }
+
+    void print(const char* label) const
+    {
+        printf("%s:", label);
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (!counts[i]) continue;
+            if (i + 1 == counts.size()) printf(" >=%.1f:%llu", i * width, (unsigned long long)counts[i]);
+            else printf(" %.1f:%llu", i * width, (unsigned long long)counts[i]);
+        }
+        printf("\n");
+    }
+
+    double width;
+    std::vector<uint64_t> counts;
+};
+
+struct sync_stats
+{
+    uint64_t frames_in = 0;
+    uint64_t frames_matched = 0;
+    uint64_t frames_dropped = 0;
+    uint64_t frames_unsynced = 0;          // handed out alone: no partner within tolerance
+    uint64_t groups = 0;
+    uint64_t partial_groups = 0;            // some camera had no frame for that instant
+    sync_histogram skew_ms{ 0.5, 40 };      // spread of host-mapped capture times within a group
+    sync_histogram latency_ms{ 1., 100 };   // time a frame waited in the synchronizer
+};
+
+// Groups frames from several cameras into cross-device sets. Every frame's hardware
+// timestamp is mapped to host time through that camera's clock model, and the frames
+// within `tolerance_ms` of the oldest pending instant form a group. A group is emitted
+// once every registered camera has either contributed or moved past that instant; a
+// camera that delivers nothing for `max_wait_ms` is skipped. Cameras that skipped the
+// instant make the group partial. A frame nobody else matched (e.g. cameras running at
+// different rates) goes to the unsynced callback on its own; it is dropped only if
+// there is none. Cameras are registered by their first frame, so one that never
+// delivers hardware timestamps never holds the others back.
+//
+// Callbacks run on the thread that called add() (or remove_device()), without the
+// synchronizer's lock, but one at a time and in the order the frames were released, so
+// a consumer sees each camera's frames in capture order.
+//
+// Payload is whatever travels with the timestamps: rs2::frameset in the capture path,
+// plain integers when fed synthetic timestamp streams.
+template<class T>
+class cross_device_synchronizer
+{
+public:
+    struct entry
+    {
+        std::string serial;
+        double capture_ms;  // device timestamp mapped to host time
+        double arrival_ms;  // host time the frame arrived
+        T payload;
+    };
+    typedef std::function<void(uint64_t group_id, const std::vector<entry>&)> group_callback;
+    typedef std::function<void(const entry&)> unsynced_callback;
+
+    cross_device_synchronizer(double tolerance_ms, double max_wait_ms, group_callback on_group,
+        unsynced_callback on_unsynced = nullptr)
+        : _tolerance(tolerance_ms), _max_wait(max_wait_ms), _on_group(on_group), _on_unsynced(on_unsynced)
+    {
+    }
+
+    // Registers a camera ahead of its first frame, so groups wait for it from the start.
+    // Only for cameras known to deliver hardware timestamps; add() registers the rest.
+    void add_device(const std::string& serial)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _devices[serial];
+    }
+
+    // Frames still queued for the camera are handed out unsynced
+    void remove_device(const std::string& serial)
+    {
+        std::vector<released> out;
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto it = _devices.find(serial);
+        if (it == _devices.end())
+            return;
+        for (auto&& e : it->second.queue)
+            release_unsynced(e, out);
+        _devices.erase(it);
+        deliver(lock, out);
+    }
+
+    // device_ms: the camera's hardware timestamp; arrival_ms: host time of arrival
+    // (RS2_FRAME_METADATA_TIME_OF_ARRIVAL), which also serves as "now"
+    void add(const std::string& serial, double device_ms, double arrival_ms, T payload)
+    {
+        std::vector<released> out;
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto& dev = _devices[serial];
+        dev.clock.add(device_ms, arrival_ms);
+        dev.queue.push_back(entry{ serial, dev.clock.to_host(device_ms), arrival_ms, payload });
+        _stats.frames_in++;
+        match(arrival_ms, out);
+        deliver(lock, out);
+    }
+
+    sync_stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+    void print_report() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        double rate = _stats.frames_in ? 100. * _stats.frames_matched / _stats.frames_in : 0.;
+        printf("sync: groups=%llu partial=%llu matched=%llu/%llu (%.1f%%) unsynced=%llu dropped=%llu\n",
+            (unsigned long long)_stats.groups, (unsigned long long)_stats.partial_groups, (unsigned long long)_stats.frames_matched,
+            (unsigned long long)_stats.frames_in, rate, (unsigned long long)_stats.frames_unsynced,
+            (unsigned long long)_stats.frames_dropped);
+        for (auto&& dev : _devices)
+        {
+            printf("sync sn: %s offset=%.3f ms drift=%.1f ppm queued=%zu\n", dev.first.c_str(),
+                dev.second.clock.offset_ms(), dev.second.clock.drift_ppm(), dev.second.queue.size());
+        }
+        _stats.skew_ms.print("sync skew ms");
+        _stats.latency_ms.print("sync latency ms");
+    }
+
+private:
+    struct device_state
+    {
+        device_clock_model clock;
+        std::deque<entry> queue;
+    };
+
+    // A group, or a single frame handed out unsynced
+    struct released
+    {
+        bool grouped;
+        uint64_t group_id;
+        std::vector<entry> entries;
+    };
+
+    // Hands `out` to the callbacks without holding _mutex, so consumers may take their
+    // time. _deliver_mutex is taken before _mutex is let go, so the next caller's
+    // frames, released after these, are also handed out after them.
+    void deliver(std::unique_lock<std::mutex>& lock, std::vector<released>& out)
+    {
+        if (out.empty())
+            return;
+        std::lock_guard<std::mutex> delivering(_deliver_mutex);
+        lock.unlock();
+        for (auto&& r : out)
+        {
+            if (r.grouped)
+                _on_group(r.group_id, r.entries);
+            else
+                _on_unsynced(r.entries.front());
+        }
+    }
+
+    // Caller holds _mutex
+    void release_unsynced(const entry& e, std::vector<released>& out)
+    {
+        if (_on_unsynced)
+        {
+            _stats.frames_unsynced++;
+            out.push_back(released{ false, 0, std::vector<entry>(1, e) });
+        }
+        else
+        {
+            _stats.frames_dropped++;
+        }
+    }
+
+    void match(double now_ms, std::vector<released>& out)
+    {
+        const size_t min_group = std::min<size_t>(2, _devices.size());
+        for (;;)
+        {
+            // The oldest pending capture instant across all cameras
+            double earliest = std::numeric_limits<double>::max();
+            const entry* oldest = nullptr;
+            bool any_empty = false;
+            for (auto&& dev : _devices)
+            {
+                if (dev.second.queue.empty())
+                {
+                    any_empty = true;
+                }
+                else if (dev.second.queue.front().capture_ms < earliest)
+                {
+                    earliest = dev.second.queue.front().capture_ms;
+                    oldest = &dev.second.queue.front();
+                }
+            }
+            if (!oldest)
+                return;
+
+            // A camera with nothing queued may still deliver this instant - wait for it,
+            // but not longer than max_wait, so a camera that went quiet cannot stall the rest
+            if (any_empty && now_ms - oldest->arrival_ms <= _max_wait)
+                return;
+
+            // Cameras whose next frame is later than the window skipped this instant
+            std::vector<entry> group;
+            double latest = earliest;
+            for (auto&& dev : _devices)
+            {
+                auto& q = dev.second.queue;
+                if (!q.empty() && q.front().capture_ms <= earliest + _tolerance)
+                {
+                    latest = std::max(latest, q.front().capture_ms);
+                    group.push_back(q.front());
+                    q.pop_front();
+                }
+            }
+
+            if (group.size() < min_group)
+            {
+                for (auto&& e : group)
+                    release_unsynced(e, out);
+                continue;
+            }
+            for (auto&& e : group)
+                _stats.latency_ms.add(now_ms - e.arrival_ms);
+            _stats.skew_ms.add(latest - earliest);
+            _stats.frames_matched += group.size();
+            if (group.size() < _devices.size())
+                _stats.partial_groups++;
+            out.push_back(released{ true, _stats.groups++, std::move(group) });
+        }
+    }
+
+    double _tolerance;
+    double _max_wait;
+    group_callback _on_group;
+    unsynced_callback _on_unsynced;
+
+    mutable std::mutex _mutex;
+    std::mutex _deliver_mutex; // taken while holding _mutex, never the other way round
+    std::map<std::string, device_state> _devices;
+    sync_stats _stats;
+};
@@ -0,0 +1,343 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async_frame_writer.hpp"   // writer_stats
+
+// Per camera and stream health: frame counter gaps, effective against configured fps,
+// frame interval jitter, metadata anomalies and, per camera, the writer backlog.
+//
+// Each stream is written by its capture thread only. Per frame it costs a few metadata
+// reads and O(1) window updates, and publishes its figures through relaxed atomics, so
+// the capture path takes no lock (only a stream's first frame registers it). Readers
+// (the on-screen overlay, the metrics file) may look at any time.
+//
+// The metrics are exposed pull-style, as a Prometheus text-format file that is replaced
+// atomically (point node_exporter's textfile collector at it, or read it directly).
+
+class stream_health
+{
+public:
+    // Frame intervals the jitter and fps are taken over
+    static const int window = 64;
+
+    stream_health(const std::string& serial, const std::string& stream)
+        : _serial(serial), _stream(stream) {}
+
+    const std::string& serial() const { return _serial; }
+    const std::string& stream() const { return _stream; }
+
+    // Capture thread: a (re)started stream; counters carry on, the sequence starts over
+    void begin(int configured_fps)
+    {
+        _configured_fps.store(configured_fps, std::memory_order_relaxed);
+        _has_last = false;
+        _intervals = 0;
+        _next = 0;
+        _sum = _sum_sq = _max = 0;
+    }
+
+    // Capture thread, once per frame; host_ms is the host wall clock
+    void on_frame(const rs2::frame& f, double host_ms)
+    {
+        bump(_frames);
+        _last_host_ms.store(host_ms, std::memory_order_relaxed);
+
+        bool has_counter = f.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER);
+        long long counter = has_counter ? (long long)f.get_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER)
+                                        : (long long)f.get_frame_number();
+        if (!has_counter)
+            bump(_missing_metadata);
+        double timestamp = f.get_timestamp();
+
+        if (_has_last)
+        {
+            if (counter > _last_counter + 1)
+            {
+                bump(_gaps);
+                add(_missing, uint64_t(counter - _last_counter - 1));
+            }
+            else if (counter == _last_counter)
+            {
+                bump(_repeated);
+            }
+            else if (counter < _last_counter)
+            {
+                bump(_counter_resets);
+            }
+
+            double interval = timestamp - _last_timestamp;
+            if (interval <= 0)
+                bump(_timestamp_regressions);
+            else
+                add_interval(interval);
+        }
+        _has_last = true;
+        _last_counter = counter;
+        _last_timestamp = timestamp;
+    }
+
+    int configured_fps() const { return _configured_fps.load(std::memory_order_relaxed); }
+    uint64_t frames() const { return _frames.load(std::memory_order_relaxed); }
+    uint64_t gaps() const { return _gaps.load(std::memory_order_relaxed); }
+    uint64_t missing() const { return _missing.load(std::memory_order_relaxed); }
+    uint64_t repeated() const { return _repeated.load(std::memory_order_relaxed); }
+    uint64_t counter_resets() const { return _counter_resets.load(std::memory_order_relaxed); }
+    uint64_t timestamp_regressions() const { return _timestamp_regressions.load(std::memory_order_relaxed); }
+    uint64_t missing_metadata() const { return _missing_metadata.load(std::memory_order_relaxed); }
+    double fps() const { return _fps.load(std::memory_order_relaxed); }
+    double jitter_ms() const { return _jitter_ms.load(std::memory_order_relaxed); }
+    double max_interval_ms() const { return _max_interval_ms.load(std::memory_order_relaxed); }
+    double last_host_ms() const { return _last_host_ms.load(std::memory_order_relaxed); }
+
+    // Lost frames as a share of the frames that should have arrived
+    double loss_ratio() const
+    {
+        double expected = double(frames() + missing());
+        return expected > 0 ? missing() / expected : 0.;
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& counter) { add(counter, 1); }
+    static void add(std::atomic<uint64_t>& counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // Running sums over the last `window` intervals (recomputed once per lap, so rounding
+    // cannot build up); the maximum is rescanned only when the interval leaving was it
+    void add_interval(double interval)
+    {
+        bool full = _intervals == window;
+        double leaving = 0;
+        if (full)
+        {
+            leaving = _ring[_next];
+            _sum -= leaving;
+            _sum_sq -= leaving * leaving;
+        }
+        else
+        {
+            _intervals++;
+        }
+        _ring[_next] = interval;
+        _next = (_next + 1) % window;
+        _sum += interval;
+        _sum_sq += interval * interval;
+        if (_next == 0)
+        {
+            _sum = _sum_sq = 0;
+            for (int i = 0; i < _intervals; i++)
+            {
+                _sum += _ring[i];
+                _sum_sq += _ring[i] * _ring[i];
+            }
+        }
+
+        if (interval >= _max)
+            _max = interval;
+        else if (full && leaving >= _max)
+            _max = *std::max_element(_ring, _ring + _intervals);
+
+        double mean = _sum / _intervals;
+        double variance = std::max(0., _sum_sq / _intervals - mean * mean);
+        _fps.store(1000. / mean, std::memory_order_relaxed);
+        _jitter_ms.store(std::sqrt(variance), std::memory_order_relaxed);
+        _max_interval_ms.store(_max, std::memory_order_relaxed);
+    }
+
+    const std::string _serial, _stream;
+
+    // Capture thread only
+    bool _has_last = false;
+    long long _last_counter = 0;
+    double _last_timestamp = 0;
+    double _ring[window] = {};
+    int _intervals = 0, _next = 0;
+    double _sum = 0, _sum_sq = 0, _max = 0;
+
+    // Written by the capture thread, read by anyone
+    std::atomic<int> _configured_fps{ 0 };
+    std::atomic<uint64_t> _frames{ 0 }, _gaps{ 0 }, _missing{ 0 }, _repeated{ 0 };
+    std::atomic<uint64_t> _counter_resets{ 0 }, _timestamp_regressions{ 0 }, _missing_metadata{ 0 };
+    std::atomic<double> _fps{ 0 }, _jitter_ms{ 0 }, _max_interval_ms{ 0 }, _last_host_ms{ 0 };
+};
+
+class health_monitor
+{
+public:
+    // The stream's record, created on first use; a reconnected stream gets its old one.
+    // Takes a lock: call once per stream, not per frame.
+    stream_health* stream(const std::string& serial, const std::string& stream)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& s = _streams[std::make_pair(serial, stream)];
+        if (!s)
+            s = std::make_shared<stream_health>(serial, stream);
+        return s.get();
+    }
+
+    std::vector<std::shared_ptr<const stream_health>> streams() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<std::shared_ptr<const stream_health>> out;
+        for (auto&& s : _streams)
+            out.push_back(s.second);
+        return out;
+    }
+
+    // One line for the overlay or the console
+    static std::string summary(const stream_health& s, double now_ms)
+    {
+        char text[192];
+        double idle_ms = s.last_host_ms() > 0 ? now_ms - s.last_host_ms() : 0;
+        snprintf(text, sizeof(text), "%.1f/%d fps  jitter %.2f ms  gaps %llu (%llu lost)%s%s",
+            s.fps(), s.configured_fps(), s.jitter_ms(), (unsigned long long)s.gaps(), (unsigned long long)s.missing(),
+            anomalies(s) ? "  metadata anomalies" : "", stalled(s, idle_ms) ? "  STALLED" : "");
+        return text;
+    }
+
+    // No frame for five configured frame periods (and at least half a second)
+    static bool stalled(const stream_health& s, double idle_ms)
+    {
+        double period_ms = s.configured_fps() > 0 ? 1000. / s.configured_fps() : 100.;
+        return s.frames() > 0 && idle_ms > std::max(500., 5 * period_ms);
+    }
+
+    static uint64_t anomalies(const stream_health& s)
+    {
+        return s.repeated() + s.counter_resets() + s.timestamp_regressions() + s.missing_metadata();
+    }
+
+    void print_report(double now_ms) const
+    {
+        for (auto&& s : streams())
+            printf("health sn: %s %s: %s\n", s->serial().c_str(), s->stream().c_str(), summary(*s, now_ms).c_str());
+    }
+
+    // A label value: backslash, quote and newline escaped (playback "serials" are paths)
+    static std::string label(const std::string& value)
+    {
+        std::string out;
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"') out += '\\';
+            if (c == '\n') { out += "\\n"; continue; }
+            out += c;
+        }
+        return out;
+    }
+
+    // Prometheus text exposition format. Counts are written as integers, so they stay
+    // exact however large they get; gauges with full double precision.
+    std::string prometheus_text(const std::map<std::string, std::shared_ptr<writer_stats>>& writers, double now_ms) const
+    {
+        auto all = streams();
+        std::ostringstream out;
+        out.precision(17);
+        auto family = [&](const char* name, const char* type, const char* help)
+        {
+            out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+        };
+        auto per_stream_count = [&](const char* name, const char* type, const char* help, uint64_t (*value)(const stream_health&))
+        {
+            family(name, type, help);
+            for (auto&& s : all)
+                out << name << "{serial=\"" << label(s->serial()) << "\",stream=\"" << label(s->stream()) << "\"} " << value(*s) << "\n";
+        };
+        auto per_stream_gauge = [&](const char* name, const char* help, double (*value)(const stream_health&))
+        {
+            family(name, "gauge", help);
+            for (auto&& s : all)
+                out << name << "{serial=\"" << label(s->serial()) << "\",stream=\"" << label(s->stream()) << "\"} " << value(*s) << "\n";
+        };
+
+        per_stream_count("realsense_frames_total", "counter", "Frames received",
+            [](const stream_health& s) { return s.frames(); });
+        per_stream_count("realsense_frame_counter_gaps_total", "counter", "Jumps in the frame counter",
+            [](const stream_health& s) { return s.gaps(); });
+        per_stream_count("realsense_frames_missing_total", "counter", "Frames the frame counter skipped",
+            [](const stream_health& s) { return s.missing(); });
+        per_stream_gauge("realsense_fps", "Frame rate over the last frame intervals, by frame timestamp",
+            [](const stream_health& s) { return s.fps(); });
+        per_stream_count("realsense_fps_configured", "gauge", "Frame rate the stream was started with",
+            [](const stream_health& s) { return uint64_t(s.configured_fps()); });
+        per_stream_gauge("realsense_frame_interval_jitter_ms", "Standard deviation of the last frame intervals",
+            [](const stream_health& s) { return s.jitter_ms(); });
+        per_stream_gauge("realsense_frame_interval_max_ms", "Longest of the last frame intervals",
+            [](const stream_health& s) { return s.max_interval_ms(); });
+
+        family("realsense_metadata_anomalies_total", "counter", "Repeated or reset frame counters, non-increasing timestamps, missing frame counter metadata");
+        for (auto&& s : all)
+        {
+            std::pair<const char*, uint64_t> kinds[] = { { "repeated_counter", s->repeated() }, { "counter_reset", s->counter_resets() },
+                { "timestamp_regression", s->timestamp_regressions() }, { "missing_counter", s->missing_metadata() } };
+            for (auto&& k : kinds)
+                out << "realsense_metadata_anomalies_total{serial=\"" << label(s->serial()) << "\",stream=\"" << label(s->stream())
+                    << "\",kind=\"" << k.first << "\"} " << k.second << "\n";
+        }
+
+        family("realsense_seconds_since_last_frame", "gauge", "Host time since the stream's last frame");
+        for (auto&& s : all)
+            out << "realsense_seconds_since_last_frame{serial=\"" << label(s->serial()) << "\",stream=\"" << label(s->stream()) << "\"} "
+                << (s->last_host_ms() > 0 ? (now_ms - s->last_host_ms()) / 1000. : 0.) << "\n";
+
+        auto per_writer_count = [&](const char* name, const char* type, const char* help, int64_t (*value)(const writer_stats&))
+        {
+            family(name, type, help);
+            for (auto&& w : writers)
+                out << name << "{serial=\"" << label(w.first) << "\"} " << value(*w.second) << "\n";
+        };
+        per_writer_count("realsense_writer_queue_depth", "gauge", "Frames waiting to be written",
+            [](const writer_stats& w) { return int64_t(w.queue_depth.load()); });
+        per_writer_count("realsense_writer_queue_depth_max", "gauge", "Largest writer backlog so far",
+            [](const writer_stats& w) { return int64_t(w.max_queue_depth.load()); });
+        per_writer_count("realsense_writer_written_total", "counter", "Frames written",
+            [](const writer_stats& w) { return int64_t(w.written.load()); });
+        per_writer_count("realsense_writer_dropped_total", "counter", "Frames the writer queue dropped",
+            [](const writer_stats& w) { return int64_t(w.dropped.load()); });
+        per_writer_count("realsense_writer_failed_total", "counter", "Frames that failed to encode or write",
+            [](const writer_stats& w) { return int64_t(w.failed.load()); });
+        family("realsense_writer_latency_p99_ms", "gauge", "99th percentile of arrival on the host to written");
+        for (auto&& w : writers)
+            out << "realsense_writer_latency_p99_ms{serial=\"" << label(w.first) << "\"} " << w.second->latency_ms.percentile(99) << "\n";
+        return out.str();
+    }
+
+    // Replaces `path` as a whole, so a scraper never sees a half-written file
+    bool write_prometheus(const std::string& path, const std::map<std::string, std::shared_ptr<writer_stats>>& writers,
+        double now_ms) const
+    {
+        std::string text = prometheus_text(writers, now_ms);
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file.write(text.data(), text.size()))
+                return false;
+        }
+#ifdef _WIN32
+        std::remove(path.c_str()); // rename does not replace on Windows; on POSIX it is atomic
+#endif
+        return std::rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<stream_health>> _streams;
+};
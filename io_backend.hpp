@@ -0,0 +1,805 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>                     // _chsize_s, _fileno, _commit
+#include <malloc.h>                 // _aligned_malloc
+#else
+#include <fcntl.h>                  // open, posix_fallocate, O_DIRECT
+#include <sys/mman.h>               // mmap
+#include <sys/stat.h>
+#include <sys/uio.h>                // pwritev
+#include <unistd.h>                 // ftruncate, fdatasync
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define IO_BACKEND_URING 1
+#endif
+#endif
+#endif
+
+// Pluggable output files for the save path.
+//
+//   buffered  stdio with a 1 MB buffer: frame -> stdio buffer -> page cache (what we always did)
+//   mmap      the preallocated file is mapped and frames are copied straight into the
+//             page cache; writeback of finished ranges is started as the file grows
+//   direct    O_DIRECT: frames are copied once into aligned staging buffers from a
+//             shared pool, which the disk reads directly. Full buffers are submitted
+//             in batches through io_uring where the kernel allows it, else with one
+//             pwritev per batch. The last buffer is padded and the file trimmed on close.
+//             Open files keep their partly filled buffer between appends, so the pool
+//             grows when it runs dry and the waiting file has nothing of its own to finish.
+//
+// Files are preallocated where the size is known, and always end up exactly as long as
+// what was appended. Errors throw std::runtime_error. On Windows every backend is buffered.
+
+enum class io_backend { buffered, mmap, direct };
+
+inline bool parse_io_backend(const std::string& name, io_backend& backend)
+{
+    if (name == "buffered")     backend = io_backend::buffered;
+    else if (name == "mmap")    backend = io_backend::mmap;
+    else if (name == "direct")  backend = io_backend::direct;
+    else return false;
+    return true;
+}
+
+inline const char* io_backend_name(io_backend backend)
+{
+    switch (backend)
+    {
+    case io_backend::mmap:   return "mmap";
+    case io_backend::direct: return "direct";
+    default:                 return "buffered";
+    }
+}
+
+struct io_options
+{
+    io_backend backend = io_backend::buffered;
+    size_t staging_bytes = 4 << 20;     // direct: one staging buffer
+    size_t staging_buffers = 32;        // direct: buffers shared by every open file
+    size_t batch = 4;                   // direct: full buffers submitted together
+    bool use_uring = true;              // direct: io_uring where available
+    bool sync_on_close = false;         // fdatasync before a file is closed
+};
+
+// O_DIRECT needs buffers, offsets and sizes aligned to the logical block size; a page
+// covers every common disk
+const size_t io_alignment = 4096;
+
+inline size_t io_round_up(size_t size, size_t alignment = io_alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+inline bool resize_open_file(FILE* f, uint64_t size, bool preallocate)
+{
+    fflush(f);
+#ifdef _WIN32
+    (void)preallocate;
+    return _chsize_s(_fileno(f), static_cast<__int64>(size)) == 0;
+#else
+    if (preallocate)
+        return posix_fallocate(fileno(f), 0, static_cast<off_t>(size)) == 0;
+    return ftruncate(fileno(f), static_cast<off_t>(size)) == 0;
+#endif
+}
+
+inline int seek_file(FILE* f, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, static_cast<__int64>(offset), SEEK_SET);
+#else
+    return fseeko(f, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+
+inline bool sync_file(int fd)
+{
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#elif defined(__APPLE__)
+    return fsync(fd) == 0;
+#else
+    return fdatasync(fd) == 0;
+#endif
+}
+
+inline std::runtime_error io_error(const std::string& what, const std::string& path, int error = errno)
+{
+    return std::runtime_error(what + " " + path + ": " + strerror(error));
+}
+
+// Set of aligned buffers, handed out and returned by the direct backend. It starts with
+// `count` buffers and only grows on request.
+class staging_pool
+{
+public:
+    staging_pool(size_t buffer_bytes, size_t count)
+        : _bytes(io_round_up(std::max<size_t>(buffer_bytes, 1)))
+    {
+        for (size_t i = 0; i < std::max<size_t>(count, 1); i++)
+            _all.push_back(allocate());
+        _free = _all;
+    }
+
+    ~staging_pool()
+    {
+        for (auto p : _all)
+        {
+#ifdef _WIN32
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+    }
+
+    staging_pool(const staging_pool&) = delete;
+    staging_pool& operator=(const staging_pool&) = delete;
+
+    // nullptr if no buffer became free within `wait`
+    uint8_t* acquire(std::chrono::milliseconds wait = std::chrono::milliseconds(0))
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_free.empty())
+        {
+            _waits++;
+            if (!_cv.wait_for(lock, wait, [this]() { return !_free.empty(); }))
+                return nullptr;
+        }
+        auto p = _free.back();
+        _free.pop_back();
+        return p;
+    }
+
+    void release(uint8_t* p)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _free.push_back(p);
+        }
+        _cv.notify_one();
+    }
+
+    // A new buffer, owned by the pool from now on like the others
+    uint8_t* grow()
+    {
+        auto p = allocate();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _all.push_back(p);
+        return p;
+    }
+
+    size_t buffer_bytes() const { return _bytes; }
+    uint64_t waits() const { std::lock_guard<std::mutex> lock(_mutex); return _waits; }
+
+private:
+    uint8_t* allocate() const
+    {
+        void* p = nullptr;
+#ifdef _WIN32
+        p = _aligned_malloc(_bytes, io_alignment);
+#else
+        if (posix_memalign(&p, io_alignment, _bytes) != 0)
+            p = nullptr;
+#endif
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<uint8_t*>(p);
+    }
+
+    size_t _bytes;
+    std::vector<uint8_t*> _all;
+    std::vector<uint8_t*> _free;
+    uint64_t _waits = 0;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+};
+
+// A file written front to back
+class output_file
+{
+public:
+    virtual ~output_file() {}
+
+    virtual void append(const void* data, size_t size) = 0;
+
+    // Writes out whatever is pending and trims the file to the bytes appended
+    virtual void close() = 0;
+
+    uint64_t size() const { return _size; }
+    const std::string& path() const { return _path; }
+
+protected:
+    explicit output_file(const std::string& path) : _path(path) {}
+
+    std::string _path;
+    uint64_t _size = 0;
+};
+
+class buffered_output_file : public output_file
+{
+public:
+    buffered_output_file(const std::string& path, uint64_t preallocate, bool sync_on_close)
+        : output_file(path), _preallocated(preallocate > 0), _sync(sync_on_close)
+    {
+        _file = fopen(path.c_str(), "wb");
+        if (!_file)
+            throw io_error("Failed to create", path);
+        setvbuf(_file, nullptr, _IOFBF, 1 << 20);
+        if (_preallocated)
+            resize_open_file(_file, preallocate, true);
+    }
+
+    ~buffered_output_file()
+    {
+        try { close(); } catch (const std::exception&) {}
+    }
+
+    void append(const void* data, size_t size) override
+    {
+        if (fwrite(data, 1, size, _file) != size)
+            throw io_error("Failed to write", _path);
+        _size += size;
+    }
+
+    void close() override
+    {
+        if (!_file)
+            return;
+        FILE* f = _file;
+        _file = nullptr;
+        bool ok = fflush(f) == 0;
+        if (_preallocated)
+            ok = resize_open_file(f, _size, false) && ok; // trim the preallocated tail
+        if (_sync)
+            ok = sync_file(fileno(f)) && ok;
+        ok = fclose(f) == 0 && ok;
+        if (!ok)
+            throw io_error("Failed to close", _path);
+    }
+
+private:
+    FILE* _file = nullptr;
+    bool _preallocated;
+    bool _sync;
+};
+
+#ifndef _WIN32
+
+class mmap_output_file : public output_file
+{
+public:
+    mmap_output_file(const std::string& path, uint64_t preallocate, bool sync_on_close)
+        : output_file(path), _sync(sync_on_close)
+    {
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0)
+            throw io_error("Failed to create", path);
+        map(std::max<uint64_t>(preallocate, io_alignment));
+    }
+
+    ~mmap_output_file()
+    {
+        try { close(); } catch (const std::exception&) {}
+    }
+
+    void append(const void* data, size_t size) override
+    {
+        if (_size + size > _mapped)
+            map(std::max<uint64_t>(_mapped * 2, _size + size));
+        memcpy(_map + _size, data, size);
+        _size += size;
+#ifdef SYNC_FILE_RANGE_WRITE
+        // Start writeback of what is complete, so dirty pages do not pile up until the
+        // kernel stalls us all at once
+        const uint64_t writeback_step = 32 << 20;
+        if (_size - _written_back >= writeback_step)
+        {
+            uint64_t end = _size / io_alignment * io_alignment;
+            sync_file_range(_fd, off64_t(_written_back), off64_t(end - _written_back), SYNC_FILE_RANGE_WRITE);
+            _written_back = end;
+        }
+#endif
+    }
+
+    void close() override
+    {
+        if (_fd < 0)
+            return;
+        int fd = _fd;
+        _fd = -1;
+        bool ok = true;
+        if (_map)
+            ok = munmap(_map, _mapped) == 0;
+        _map = nullptr;
+        ok = ftruncate(fd, off_t(_size)) == 0 && ok;
+        if (_sync)
+            ok = sync_file(fd) && ok;
+        ok = ::close(fd) == 0 && ok;
+        if (!ok)
+            throw io_error("Failed to close", _path);
+    }
+
+private:
+    void map(uint64_t size)
+    {
+        size = io_round_up(size_t(size));
+        if (_map)
+            munmap(_map, _mapped);
+        _map = nullptr;
+        // Only a file system that cannot preallocate gets a sparse file: writing into the
+        // mapping of one the disk has no room for would raise SIGBUS, not an error
+        int error = posix_fallocate(_fd, 0, off_t(size));
+        if (error == EOPNOTSUPP || error == EINVAL)
+            error = ftruncate(_fd, off_t(size)) == 0 ? 0 : errno;
+        if (error)
+            throw io_error("Failed to size", _path, error);
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (p == MAP_FAILED)
+            throw io_error("Failed to map", _path);
+        madvise(p, size, MADV_SEQUENTIAL);
+        _map = static_cast<uint8_t*>(p);
+        _mapped = size;
+    }
+
+    int _fd = -1;
+    uint8_t* _map = nullptr;
+    uint64_t _mapped = 0;
+    uint64_t _written_back = 0;
+    bool _sync;
+};
+
+#ifdef IO_BACKEND_URING
+// Just enough io_uring for batched writes, on the raw system calls (no liburing)
+class uring_queue
+{
+public:
+    explicit uring_queue(unsigned entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        _fd = int(syscall(__NR_io_uring_setup, entries, &p));
+        if (_fd < 0)
+            return; // not available: no kernel support, or blocked (e.g. in containers)
+
+        _sq_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cq_bytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+            _sq_bytes = _cq_bytes = std::max(_sq_bytes, _cq_bytes);
+        _sqe_bytes = p.sq_entries * sizeof(io_uring_sqe);
+
+        _sq = mmap(nullptr, _sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        _cq = single_mmap ? _sq : mmap(nullptr, _cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        void* sqes = mmap(nullptr, _sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_sq == MAP_FAILED || _cq == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            if (sqes != MAP_FAILED) munmap(sqes, _sqe_bytes);
+            release();
+            return;
+        }
+        _sqes = static_cast<io_uring_sqe*>(sqes);
+
+        auto sq = static_cast<char*>(_sq);
+        auto cq = static_cast<char*>(_cq);
+        _sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        _sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        _sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        _sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        _cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        _cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        _entries = p.sq_entries;
+        _cq_entries = p.cq_entries;
+        _iov.resize(_entries);
+    }
+
+    ~uring_queue()
+    {
+        if (_sqes)
+            munmap(_sqes, _sqe_bytes);
+        release();
+    }
+
+    uring_queue(const uring_queue&) = delete;
+    uring_queue& operator=(const uring_queue&) = delete;
+
+    bool ok() const { return _fd >= 0; }
+
+    // Writes that may be in flight at once: a completion that finds the completion ring
+    // full may be dropped (kernels without IORING_FEAT_NODROP), and then never reaped
+    unsigned capacity() const { return _cq_entries; }
+
+    // Queues a write for the next submit(); false when the submission ring is full
+    bool write(int fd, const void* data, size_t size, uint64_t offset, uint64_t user_data)
+    {
+        unsigned tail = *_sq_tail;
+        if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _entries)
+            return false;
+        unsigned index = tail & _sq_mask;
+        _iov[index].iov_base = const_cast<void*>(data);
+        _iov[index].iov_len = size;
+        io_uring_sqe& sqe = _sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITEV;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(&_iov[index]);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        _sq_array[index] = index;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        _queued++;
+        return true;
+    }
+
+    // Submits everything queued and waits until at least `wait_for` writes completed
+    bool submit(unsigned wait_for)
+    {
+        for (;;)
+        {
+            int r = int(syscall(__NR_io_uring_enter, _fd, _queued, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+            if (r >= 0)
+            {
+                _queued -= std::min<unsigned>(_queued, unsigned(r));
+                return true;
+            }
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    // Calls f(user_data, result) for every completed write
+    template<class F>
+    void reap(F f)
+    {
+        unsigned head = *_cq_head;
+        unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const io_uring_cqe& cqe = _cqes[head & _cq_mask];
+            f(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void release()
+    {
+        if (_cq && _cq != MAP_FAILED && _cq != _sq)
+            munmap(_cq, _cq_bytes);
+        if (_sq && _sq != MAP_FAILED)
+            munmap(_sq, _sq_bytes);
+        if (_fd >= 0)
+            ::close(_fd);
+        _sq = _cq = nullptr;
+        _fd = -1;
+    }
+
+    int _fd = -1;
+    void* _sq = nullptr;
+    void* _cq = nullptr;
+    size_t _sq_bytes = 0, _cq_bytes = 0, _sqe_bytes = 0;
+    io_uring_sqe* _sqes = nullptr;
+    unsigned *_sq_head = nullptr, *_sq_tail = nullptr, *_sq_array = nullptr;
+    unsigned *_cq_head = nullptr, *_cq_tail = nullptr;
+    unsigned _sq_mask = 0, _cq_mask = 0, _entries = 0, _cq_entries = 0;
+    io_uring_cqe* _cqes = nullptr;
+    unsigned _queued = 0;
+    std::vector<iovec> _iov; // per submission slot; the kernel reads it at submit time
+};
+#endif
+
+class direct_output_file : public output_file
+{
+public:
+    direct_output_file(const std::string& path, uint64_t preallocate, const io_options& options, staging_pool& pool)
+        : output_file(path), _options(options), _pool(pool)
+    {
+#ifdef O_DIRECT
+        _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (_fd < 0 && errno == EINVAL)
+#endif
+        {
+            // The file system does not do direct I/O (tmpfs, some network mounts); keep
+            // the aligned batched path over the page cache
+            _direct = false;
+            _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (_fd < 0)
+            throw io_error("Failed to create", path);
+        if (preallocate)
+            posix_fallocate(_fd, 0, off_t(io_round_up(size_t(preallocate))));
+
+#ifdef IO_BACKEND_URING
+        // A ring pays off for files that span several batches, not for a single frame
+        if (options.use_uring && preallocate >= options.batch * pool.buffer_bytes())
+        {
+            _ring.reset(new uring_queue(unsigned(std::max<size_t>(options.batch * 2, 8))));
+            if (!_ring->ok())
+                _ring.reset();
+        }
+#endif
+    }
+
+    ~direct_output_file()
+    {
+        try { close(); } catch (const std::exception&) {}
+        drop_buffers();
+    }
+
+    void append(const void* data, size_t size) override
+    {
+        auto src = static_cast<const uint8_t*>(data);
+        while (size)
+        {
+            if (!_current)
+            {
+                _current = take_buffer();
+                _fill = 0;
+            }
+            size_t n = std::min(size, _pool.buffer_bytes() - _fill);
+            memcpy(_current + _fill, src, n); // the one copy of the frame
+            _fill += n;
+            src += n;
+            size -= n;
+            _size += n;
+            if (_fill == _pool.buffer_bytes())
+                queue_current(_fill);
+        }
+    }
+
+    void close() override
+    {
+        if (_fd < 0)
+            return;
+        std::string error;
+        try
+        {
+            if (_current)
+            {
+                // Pad the tail to a whole block; the file is trimmed back below
+                size_t padded = io_round_up(_fill);
+                memset(_current + _fill, 0, padded - _fill);
+                queue_current(padded);
+            }
+            submit();
+            while (!_in_flight.empty())
+                complete(1);
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what(); // still close the file
+        }
+
+        int fd = _fd;
+        _fd = -1;
+        bool ok = ftruncate(fd, off_t(_size)) == 0;
+        if (_options.sync_on_close)
+            ok = sync_file(fd) && ok;
+        ok = ::close(fd) == 0 && ok;
+        if (!error.empty())
+            throw std::runtime_error(error);
+        if (!ok)
+            throw io_error("Failed to close", _path);
+    }
+
+    bool is_direct() const { return _direct; }
+
+private:
+    struct pending_write
+    {
+        uint8_t* buffer;
+        uint64_t offset;
+        size_t size;
+    };
+
+    void queue_current(size_t size)
+    {
+        _pending.push_back(pending_write{ _current, _offset, size });
+        _offset += size;
+        _current = nullptr;
+        if (_pending.size() >= _options.batch)
+            submit();
+    }
+
+    uint8_t* take_buffer()
+    {
+        for (;;)
+        {
+            if (auto p = _pool.acquire())
+                return p;
+            // Our own writes hold buffers too: finish one of those before waiting on others
+            if (!_pending.empty())
+                submit();
+            else if (!_in_flight.empty())
+                complete(1);
+            else if (auto p = _pool.acquire(std::chrono::milliseconds(10)))
+                return p;
+            else
+                return _pool.grow(); // other open files hold every buffer, maybe for good
+        }
+    }
+
+    void submit()
+    {
+        if (_pending.empty())
+            return;
+#ifdef IO_BACKEND_URING
+        if (_ring)
+        {
+            for (auto&& w : _pending)
+            {
+                while (_in_flight.size() >= _ring->capacity() ||
+                       !_ring->write(_fd, w.buffer, w.size, w.offset, reinterpret_cast<uint64_t>(w.buffer)))
+                    complete(1);
+                _in_flight.push_back(w);
+            }
+            _pending.clear();
+            if (!_ring->submit(0))
+                fail("Failed to submit to");
+            return;
+        }
+#endif
+        // Buffers of one batch are contiguous in the file: one system call for all of them
+        std::vector<iovec> iov;
+        size_t total = 0;
+        for (auto&& w : _pending)
+        {
+            iov.push_back(iovec{ w.buffer, w.size });
+            total += w.size;
+        }
+        uint64_t offset = _pending.front().offset;
+        size_t done = 0;
+        while (done < total)
+        {
+            ssize_t r = pwritev(_fd, iov.data(), int(iov.size()), off_t(offset + done));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                fail("Failed to write");
+            done += size_t(r);
+            // Short write: skip what went out and go again
+            size_t skip = size_t(r);
+            while (!iov.empty() && skip >= iov.front().iov_len)
+            {
+                skip -= iov.front().iov_len;
+                iov.erase(iov.begin());
+            }
+            if (!iov.empty())
+            {
+                iov.front().iov_base = static_cast<uint8_t*>(iov.front().iov_base) + skip;
+                iov.front().iov_len -= skip;
+            }
+        }
+        for (auto&& w : _pending)
+            _pool.release(w.buffer);
+        _pending.clear();
+    }
+
+    // Waits for at least `count` in-flight writes and returns their buffers
+    void complete(unsigned count)
+    {
+#ifdef IO_BACKEND_URING
+        if (!_ring->submit(count))
+            fail("Failed to wait for");
+        std::string error;
+        _ring->reap([&](uint64_t user_data, int result)
+        {
+            auto it = std::find_if(_in_flight.begin(), _in_flight.end(),
+                [&](const pending_write& w) { return reinterpret_cast<uint64_t>(w.buffer) == user_data; });
+            if (it == _in_flight.end())
+                return;
+            if (result < 0 || size_t(result) != it->size)
+                error = result < 0 ? strerror(-result) : "short write";
+            _pool.release(it->buffer);
+            _in_flight.erase(it);
+        });
+        if (!error.empty())
+            throw std::runtime_error("Failed to write " + _path + ": " + error);
+#else
+        (void)count;
+#endif
+    }
+
+    [[noreturn]] void fail(const char* what)
+    {
+        throw io_error(what, _path);
+    }
+
+    void drop_buffers()
+    {
+        // Only after a failed close: return what the kernel is not using
+        if (_current)
+            _pool.release(_current);
+        for (auto&& w : _pending)
+            _pool.release(w.buffer);
+        _current = nullptr;
+        _pending.clear();
+    }
+
+    io_options _options;
+    staging_pool& _pool;
+    int _fd = -1;
+    bool _direct = true;
+    uint8_t* _current = nullptr;
+    size_t _fill = 0;
+    uint64_t _offset = 0;
+    std::deque<pending_write> _pending;
+    std::deque<pending_write> _in_flight;
+#ifdef IO_BACKEND_URING
+    std::unique_ptr<uring_queue> _ring;
+#endif
+};
+
+#endif // !_WIN32
+
+// Opens output files with the configured backend; shared by all writer threads
+class frame_io
+{
+public:
+    explicit frame_io(const io_options& options = io_options())
+        : _options(options)
+    {
+#ifdef _WIN32
+        _options.backend = io_backend::buffered;
+#endif
+        if (_options.backend == io_backend::direct)
+            _pool.reset(new staging_pool(_options.staging_bytes, _options.staging_buffers));
+    }
+
+    // preallocate: expected size, 0 if unknown
+    std::unique_ptr<output_file> open(const std::string& path, uint64_t preallocate = 0) const
+    {
+#ifndef _WIN32
+        if (_options.backend == io_backend::mmap)
+            return std::unique_ptr<output_file>(new mmap_output_file(path, preallocate, _options.sync_on_close));
+        if (_options.backend == io_backend::direct)
+            return std::unique_ptr<output_file>(new direct_output_file(path, preallocate, _options, *_pool));
+#endif
+        return std::unique_ptr<output_file>(new buffered_output_file(path, preallocate, _options.sync_on_close));
+    }
+
+    // A whole file in one go, e.g. one frame; returns its size
+    size_t write_file(const std::string& path, const void* data, size_t size) const
+    {
+        auto file = open(path, _options.backend == io_backend::buffered ? 0 : size);
+        file->append(data, size);
+        file->close();
+        return size;
+    }
+
+    const io_options& options() const { return _options; }
+
+    // How often a direct-I/O writer found the staging pool empty
+    uint64_t staging_waits() const { return _pool ? _pool->waits() : 0; }
+
+private:
+    io_options _options;
+    std::unique_ptr<staging_pool> _pool;
+};
@@ -0,0 +1,278 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Persistent per-stream frame metadata log.
+//
+// The set of supported attributes is discovered once, from the first frame of each
+// stream profile, and written as the file header. Every frame then appends one
+// fixed-width record: frame number, host time, and one int64 per attribute. Values
+// missing from a particular frame are stored as metadata_log_missing.
+//
+//   header: "RSMDLOG1" | uint32 column count | uint32 rs2_frame_metadata_value[count]
+//   record: uint64 frame number | double host ms | int64 value[count]
+
+const char metadata_log_magic[8] = { 'R', 'S', 'M', 'D', 'L', 'O', 'G', '1' };
+const int64_t metadata_log_missing = std::numeric_limits<int64_t>::min();
+
+class metadata_stream_log
+{
+public:
+    metadata_stream_log(const std::string& filename, const rs2::frame& first)
+    {
+        for (int i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
+        {
+            if (first.supports_frame_metadata(rs2_frame_metadata_value(i)))
+                _columns.push_back(rs2_frame_metadata_value(i));
+        }
+
+        _file = fopen(filename.c_str(), "wb");
+        if (!_file)
+            throw std::runtime_error("Failed to create " + filename);
+        setvbuf(_file, nullptr, _IOFBF, 256 << 10);
+
+        uint32_t count = uint32_t(_columns.size());
+        fwrite(metadata_log_magic, sizeof(metadata_log_magic), 1, _file);
+        fwrite(&count, sizeof(count), 1, _file);
+        for (auto c : _columns)
+        {
+            uint32_t id = uint32_t(c);
+            fwrite(&id, sizeof(id), 1, _file);
+        }
+        _record.resize(sizeof(uint64_t) + sizeof(double) + _columns.size() * sizeof(int64_t));
+    }
+
+    ~metadata_stream_log()
+    {
+        if (_file)
+            fclose(_file);
+    }
+
+    void append(const rs2::frame& f, double host_ms)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint8_t* p = _record.data();
+        uint64_t number = f.get_frame_number();
+        memcpy(p, &number, sizeof(number));
+        memcpy(p + 8, &host_ms, sizeof(host_ms));
+        p += 16;
+        for (auto c : _columns)
+        {
+            int64_t v = f.supports_frame_metadata(c) ? int64_t(f.get_frame_metadata(c)) : metadata_log_missing;
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+        }
+        fwrite(_record.data(), _record.size(), 1, _file);
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        fflush(_file);
+    }
+
+private:
+    std::mutex _mutex;
+    FILE* _file = nullptr;
+    std::vector<rs2_frame_metadata_value> _columns;
+    std::vector<uint8_t> _record;
+};
+
+// One log per device serial and stream profile, created on the stream's first frame.
+// A log that cannot be created is reported once, and that stream is not logged.
+class metadata_logger
+{
+public:
+    explicit metadata_logger(const std::string& prefix = "rs-save-to-disk-output-")
+        : _prefix(prefix)
+    {
+    }
+
+    void append(const std::string& serial, const rs2::frame& f, double host_ms)
+    {
+        if (auto log = log_for(serial, f))
+            log->append(f, host_ms);
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto&& log : _logs)
+        {
+            if (log.second)
+                log.second->flush();
+        }
+    }
+
+private:
+    // nullptr if the stream's log could not be created
+    metadata_stream_log* log_for(const std::string& serial, const rs2::frame& f)
+    {
+        auto profile = f.get_profile();
+        auto key = std::make_pair(serial, profile.unique_id());
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _logs.find(key);
+        if (it != _logs.end())
+            return it->second.get();
+
+        std::string filename = _prefix + file_safe(serial) + "-" + file_safe(profile.stream_name()) + "-metadata.mdlog";
+        std::shared_ptr<metadata_stream_log> log;
+        try
+        {
+            log = std::make_shared<metadata_stream_log>(filename, f);
+        }
+        catch (const std::exception& e)
+        {
+            fprintf(stderr, "%s; metadata of this stream is not logged\n", e.what());
+        }
+        _logs[key] = log;
+        return log.get();
+    }
+
+    // The serial and stream name go into the file name, not the path
+    static std::string file_safe(std::string name)
+    {
+        for (auto& c : name)
+        {
+            if (c == ' ')
+                c = '_';
+            else if (c == '/' || c == '\\' || c == ':')
+                c = '-';
+        }
+        return name;
+    }
+
+    std::string _prefix;
+    std::mutex _mutex;
+    std::map<std::pair<std::string, int>, std::shared_ptr<metadata_stream_log>> _logs;
+};
+
+// Loads a metadata log back, sorted by frame number, and converts it for offline analysis
+class metadata_log_reader
+{
+public:
+    explicit metadata_log_reader(const std::string& filename)
+    {
+        std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(filename.c_str(), "rb"), fclose);
+        if (!file)
+            throw std::runtime_error("Failed to open " + filename);
+
+        char magic[sizeof(metadata_log_magic)];
+        uint32_t count = 0;
+        if (fread(magic, sizeof(magic), 1, file.get()) != 1 ||
+            memcmp(magic, metadata_log_magic, sizeof(magic)) != 0 ||
+            fread(&count, sizeof(count), 1, file.get()) != 1 ||
+            count > RS2_FRAME_METADATA_COUNT)
+            throw std::runtime_error(filename + " is not a metadata log");
+
+        _columns.resize(count);
+        for (auto& c : _columns)
+        {
+            uint32_t id;
+            if (fread(&id, sizeof(id), 1, file.get()) != 1)
+                throw std::runtime_error(filename + " has a truncated header");
+            c = rs2_frame_metadata_value(id);
+        }
+
+        record r;
+        r.values.resize(count);
+        while (fread(&r.frame_number, sizeof(r.frame_number), 1, file.get()) == 1 &&
+               fread(&r.host_ms, sizeof(r.host_ms), 1, file.get()) == 1 &&
+               (count == 0 || fread(r.values.data(), sizeof(int64_t), count, file.get()) == count))
+        {
+            _records.push_back(r);
+        }
+
+        // Writer threads may append a stream's frames slightly out of order
+        std::stable_sort(_records.begin(), _records.end(),
+            [](const record& a, const record& b) { return a.frame_number < b.frame_number; });
+    }
+
+    struct record
+    {
+        uint64_t frame_number;
+        double host_ms;
+        std::vector<int64_t> values;
+    };
+
+    const std::vector<rs2_frame_metadata_value>& columns() const { return _columns; }
+    const std::vector<record>& records() const { return _records; }
+
+    // One row per frame, one column per attribute; missing values are left empty
+    void to_csv(const std::string& filename) const
+    {
+        std::unique_ptr<FILE, int(*)(FILE*)> csv(fopen(filename.c_str(), "w"), fclose);
+        if (!csv)
+            throw std::runtime_error("Failed to create " + filename);
+
+        fprintf(csv.get(), "Frame Number,Host Time");
+        for (auto c : _columns)
+            fprintf(csv.get(), ",%s", rs2_frame_metadata_to_string(c));
+        fprintf(csv.get(), "\n");
+
+        for (auto&& r : _records)
+        {
+            fprintf(csv.get(), "%llu,%.3f", (unsigned long long)r.frame_number, r.host_ms);
+            for (auto v : r.values)
+            {
+                if (v == metadata_log_missing) fprintf(csv.get(), ",");
+                else fprintf(csv.get(), ",%lld", (long long)v);
+            }
+            fprintf(csv.get(), "\n");
+        }
+    }
+
+    // Columnar layout: <prefix>.schema lists the columns, and each column is a packed
+    // little-endian array in <prefix>.<column>.col, so analysis tools can map just the
+    // attributes they need
+    void to_columns(const std::string& prefix) const
+    {
+        std::unique_ptr<FILE, int(*)(FILE*)> schema(fopen((prefix + ".schema").c_str(), "w"), fclose);
+        if (!schema)
+            throw std::runtime_error("Failed to create " + prefix + ".schema");
+        fprintf(schema.get(), "rows %zu\nframe_number uint64\nhost_ms float64\n", _records.size());
+
+        write_column(prefix + ".frame_number.col", [](const record& r) { return r.frame_number; });
+        write_column(prefix + ".host_ms.col", [](const record& r) { return r.host_ms; });
+        for (size_t i = 0; i < _columns.size(); i++)
+        {
+            std::string name = rs2_frame_metadata_to_string(_columns[i]);
+            std::replace(name.begin(), name.end(), ' ', '_');
+            fprintf(schema.get(), "%s int64\n", name.c_str());
+            write_column(prefix + "." + name + ".col", [i](const record& r) { return r.values[i]; });
+        }
+    }
+
+private:
+    template<class F>
+    void write_column(const std::string& filename, F value) const
+    {
+        std::unique_ptr<FILE, int(*)(FILE*)> col(fopen(filename.c_str(), "wb"), fclose);
+        if (!col)
+            throw std::runtime_error("Failed to create " + filename);
+        for (auto&& r : _records)
+        {
+            auto v = value(r);
+            fwrite(&v, sizeof(v), 1, col.get());
+        }
+    }
+
+    std::vector<rs2_frame_metadata_value> _columns;
+    std::vector<record> _records;
+};
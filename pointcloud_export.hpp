@@ -0,0 +1,516 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+#include <librealsense2/rsutil.h>   // rs2_deproject_pixel_to_point
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "io_backend.hpp"           // frame_io, output_file
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define POINTCLOUD_AVX2
+#endif
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define POINTCLOUD_SSE41
+#endif
+
+// Depth -> point cloud stage for the writer threads.
+//
+//   ray_table          - per-pixel (x, y) of the ray through the pixel at depth 1, from
+//                        rs2_deproject_pixel_to_point itself, built once per stream profile.
+//                        A point is then ray * depth, bit for bit what the per-pixel
+//                        rsutil call gives, distortion included, for two multiplies.
+//   deproject_depth    - Z16 -> points in meters, holes (and points beyond max_m) left
+//                        out. AVX2 does 8 pixels at a time and SSE4.1 4, both packing the
+//                        valid lanes through a shuffle table; scalar at row ends.
+//   point_cloud        - structure-of-arrays x / y / z, from a point_cloud_pool so the
+//                        writer threads do not allocate per frame.
+//   voxel_grid         - optional downsampling to one centroid per occupied voxel.
+//   write_point_cloud  - binary little-endian PLY, or headerless float32 XYZ triples,
+//                        streamed through frame_io in interleaved chunks.
+
+enum class point_format { ply, xyz };
+
+inline bool parse_point_format(const std::string& name, point_format& format)
+{
+    if (name == "ply")      format = point_format::ply;
+    else if (name == "xyz") format = point_format::xyz;
+    else return false;
+    return true;
+}
+
+inline const char* point_format_extension(point_format format)
+{
+    return format == point_format::ply ? ".ply" : ".xyz";
+}
+
+// Unit-depth rays for every pixel of one stream profile
+class ray_table
+{
+public:
+    explicit ray_table(const rs2_intrinsics& intrinsics)
+        : _intrinsics(intrinsics), _width(intrinsics.width), _height(intrinsics.height),
+          x(size_t(_width) * _height), y(size_t(_width) * _height)
+    {
+        for (int v = 0; v < _height; v++)
+        {
+            for (int u = 0; u < _width; u++)
+            {
+                float pixel[2] = { float(u), float(v) }, point[3];
+                rs2_deproject_pixel_to_point(point, &_intrinsics, pixel, 1.f);
+                x[size_t(v) * _width + u] = point[0];
+                y[size_t(v) * _width + u] = point[1];
+            }
+        }
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    bool matches(const rs2_intrinsics& i) const
+    {
+        return i.width == _intrinsics.width && i.height == _intrinsics.height &&
+               i.ppx == _intrinsics.ppx && i.ppy == _intrinsics.ppy &&
+               i.fx == _intrinsics.fx && i.fy == _intrinsics.fy && i.model == _intrinsics.model &&
+               std::equal(i.coeffs, i.coeffs + 5, _intrinsics.coeffs);
+    }
+
+private:
+    rs2_intrinsics _intrinsics;
+    int _width, _height;
+
+public:
+    std::vector<float> x, y;    // row-major, width * height
+};
+
+// Points in meters, structure-of-arrays; only the first size() are valid
+struct point_cloud
+{
+    std::vector<float> x, y, z;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+
+    // Room for `points` plus the lanes a vector store may write past the last point
+    void reserve(size_t points)
+    {
+        if (x.size() < points + 8)
+        {
+            x.resize(points + 8);
+            y.resize(points + 8);
+            z.resize(points + 8);
+        }
+        count = 0;
+    }
+};
+
+// Recycles point clouds between frames; clouds go back to the pool when the last
+// reference is dropped, even after the pool itself is gone
+class point_cloud_pool
+{
+    struct state
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<point_cloud>> free;
+        size_t max_free;
+    };
+
+public:
+    explicit point_cloud_pool(size_t max_free = 8)
+        : _state(std::make_shared<state>())
+    {
+        _state->max_free = max_free;
+    }
+
+    std::shared_ptr<point_cloud> acquire(size_t points)
+    {
+        std::unique_ptr<point_cloud> cloud;
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            if (!_state->free.empty())
+            {
+                cloud = std::move(_state->free.back());
+                _state->free.pop_back();
+            }
+        }
+        if (!cloud)
+            cloud.reset(new point_cloud());
+        cloud->reserve(points);
+
+        auto pool = _state;
+        return std::shared_ptr<point_cloud>(cloud.release(), [pool](point_cloud* c)
+        {
+            std::unique_ptr<point_cloud> owned(c);
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            if (pool->free.size() < pool->max_free)
+                pool->free.push_back(std::move(owned));
+        });
+    }
+
+private:
+    std::shared_ptr<state> _state;
+};
+
+namespace pointcloud_detail
+{
+    inline int valid_lanes(unsigned mask)
+    {
+        static const uint8_t bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+        return bits[mask & 15] + bits[(mask >> 4) & 15];
+    }
+
+#if defined(POINTCLOUD_AVX2)
+    // For each 8-lane validity mask, the lanes to move to the front, in order
+    struct pack8_table
+    {
+        alignas(32) int32_t lanes[256][8];
+
+        pack8_table()
+        {
+            for (int m = 0; m < 256; m++)
+            {
+                int n = 0;
+                for (int i = 0; i < 8; i++)
+                    if (m & (1 << i))
+                        lanes[m][n++] = i;
+                for (; n < 8; n++)
+                    lanes[m][n] = 0;
+            }
+        }
+    };
+#endif
+
+#if defined(POINTCLOUD_SSE41)
+    // The same for 4 lanes, as pshufb byte indices
+    struct pack4_table
+    {
+        alignas(16) uint8_t bytes[16][16];
+
+        pack4_table()
+        {
+            for (int m = 0; m < 16; m++)
+            {
+                int n = 0;
+                for (int i = 0; i < 4; i++)
+                    if (m & (1 << i))
+                    {
+                        for (int b = 0; b < 4; b++)
+                            bytes[m][n * 4 + b] = uint8_t(i * 4 + b);
+                        n++;
+                    }
+                for (; n < 4; n++)
+                    for (int b = 0; b < 4; b++)
+                        bytes[m][n * 4 + b] = 0x80;
+            }
+        }
+    };
+#endif
+}
+
+// Deprojects a Z16 image (stride in bytes, the size of `rays`) into `out`, leaving out
+// holes and, with max_m > 0, points farther than max_m. Returns the number of points.
+inline size_t deproject_depth(const uint16_t* depth, int stride, float depth_scale, const ray_table& rays,
+    point_cloud& out, float max_m = 0, bool allow_simd = true)
+{
+    const int w = rays.width(), h = rays.height();
+    out.reserve(size_t(w) * h);
+    const float far = max_m > 0 ? max_m : std::numeric_limits<float>::max();
+    float* ox = out.x.data();
+    float* oy = out.y.data();
+    float* oz = out.z.data();
+    size_t n = 0;
+
+#if defined(POINTCLOUD_AVX2)
+    static const pointcloud_detail::pack8_table pack8;
+#endif
+#if defined(POINTCLOUD_SSE41)
+    static const pointcloud_detail::pack4_table pack4;
+#endif
+#if !defined(POINTCLOUD_AVX2) && !defined(POINTCLOUD_SSE41)
+    (void)allow_simd;
+#endif
+
+    for (int v = 0; v < h; v++)
+    {
+        auto row = reinterpret_cast<const uint16_t*>(reinterpret_cast<const uint8_t*>(depth) + size_t(v) * stride);
+        const float* rx = rays.x.data() + size_t(v) * w;
+        const float* ry = rays.y.data() + size_t(v) * w;
+        int u = 0;
+
+#if defined(POINTCLOUD_AVX2)
+        if (allow_simd)
+        {
+            const __m256 scale = _mm256_set1_ps(depth_scale);
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 limit = _mm256_set1_ps(far);
+            for (; u + 8 <= w; u += 8)
+            {
+                __m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + u)));
+                __m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(d), scale);
+                unsigned mask = unsigned(_mm256_movemask_ps(_mm256_and_ps(
+                    _mm256_cmp_ps(z, zero, _CMP_GT_OQ), _mm256_cmp_ps(z, limit, _CMP_LE_OQ))));
+                if (!mask)
+                    continue;
+                __m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(pack8.lanes[mask]));
+                __m256 px = _mm256_mul_ps(_mm256_loadu_ps(rx + u), z);
+                __m256 py = _mm256_mul_ps(_mm256_loadu_ps(ry + u), z);
+                _mm256_storeu_ps(ox + n, _mm256_permutevar8x32_ps(px, lanes));
+                _mm256_storeu_ps(oy + n, _mm256_permutevar8x32_ps(py, lanes));
+                _mm256_storeu_ps(oz + n, _mm256_permutevar8x32_ps(z, lanes));
+                n += pointcloud_detail::valid_lanes(mask);
+            }
+        }
+#endif
+#if defined(POINTCLOUD_SSE41)
+        if (allow_simd)
+        {
+            const __m128 scale = _mm_set1_ps(depth_scale);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 limit = _mm_set1_ps(far);
+            for (; u + 4 <= w; u += 4)
+            {
+                __m128i d = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + u)));
+                __m128 z = _mm_mul_ps(_mm_cvtepi32_ps(d), scale);
+                unsigned mask = unsigned(_mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(z, zero), _mm_cmple_ps(z, limit))));
+                if (!mask)
+                    continue;
+                __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(pack4.bytes[mask]));
+                __m128 px = _mm_mul_ps(_mm_loadu_ps(rx + u), z);
+                __m128 py = _mm_mul_ps(_mm_loadu_ps(ry + u), z);
+                _mm_storeu_ps(ox + n, _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(px), bytes)));
+                _mm_storeu_ps(oy + n, _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(py), bytes)));
+                _mm_storeu_ps(oz + n, _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(z), bytes)));
+                n += pointcloud_detail::valid_lanes(mask);
+            }
+        }
+#endif
+        for (; u < w; u++)
+        {
+            float z = float(row[u]) * depth_scale;
+            if (!(z > 0.f && z <= far))
+                continue;
+            ox[n] = rx[u] * z;
+            oy[n] = ry[u] * z;
+            oz[n] = z;
+            n++;
+        }
+    }
+    out.count = n;
+    return n;
+}
+
+// Replaces the points of a cloud by the centroid of each occupied voxel, in the order
+// the voxels were first hit. Keeps its tables between calls; one per thread.
+class voxel_grid
+{
+public:
+    size_t downsample(point_cloud& cloud, float voxel_m)
+    {
+        if (voxel_m <= 0 || cloud.size() == 0)
+            return cloud.size();
+
+        // Sized for the voxels rather than the points, which keeps it in cache: as large
+        // as the last frame needed, grown (and rehashed) whenever it gets half full
+        reset_table(std::max(_bits, 12));
+        _sums.resize(cloud.size());
+
+        // Neighbouring pixels mostly share a voxel, and a row of pixels mostly revisits
+        // the voxels of the rows above it: a small direct-mapped cache of recent voxels
+        // answers most lookups before the table is touched
+        _recent.assign(recent_size, cell{ empty_key(), 0 });
+        const double inv = 1. / voxel_m;
+        uint32_t voxels = 0;
+        for (size_t i = 0; i < cloud.size(); i++)
+        {
+            uint64_t key = voxel_key(cloud.x[i] * inv) | (voxel_key(cloud.y[i] * inv) << 21) | (voxel_key(cloud.z[i] * inv) << 42);
+            cell& recent = _recent[size_t((key * 0x9E3779B97F4A7C15ULL) >> 54)];
+            if (recent.key != key)
+            {
+                cell& c = find(key);
+                if (c.key == empty_key())
+                {
+                    c = cell{ key, voxels };
+                    _sums[voxels++] = sum{ 0, 0, 0, 0 };
+                }
+                recent = c;
+                if (voxels * 2 > _cells.size())
+                    grow();
+            }
+            auto& s = _sums[recent.slot];
+            s.x += cloud.x[i];
+            s.y += cloud.y[i];
+            s.z += cloud.z[i];
+            s.n++;
+        }
+
+        for (uint32_t v = 0; v < voxels; v++)
+        {
+            auto& s = _sums[v];
+            cloud.x[v] = float(s.x / s.n);
+            cloud.y[v] = float(s.y / s.n);
+            cloud.z[v] = float(s.z / s.n);
+        }
+        cloud.count = voxels;
+        return voxels;
+    }
+
+private:
+    struct cell { uint64_t key; uint32_t slot; };
+    struct sum { float x, y, z; uint32_t n; };
+
+    static uint64_t empty_key() { return ~0ULL; }
+    static const size_t recent_size = 1024; // indexed by the top 10 bits of the key hash
+
+    void reset_table(int bits)
+    {
+        _bits = bits;
+        _cells.assign(size_t(1) << bits, cell{ empty_key(), 0 });
+    }
+
+    // The cell holding `key`, or the empty one where it belongs
+    cell& find(uint64_t key)
+    {
+        const size_t mask = _cells.size() - 1;
+        // y and z are mixed, x added after: voxels next to each other along a row stay
+        // next to each other in the table
+        size_t h = size_t(((key >> 21) * 0x9E3779B97F4A7C15ULL) >> (64 - _bits)) + size_t(key & 0x1FFFFF);
+        h &= mask;
+        while (_cells[h].key != empty_key() && _cells[h].key != key)
+            h = (h + 1) & mask;
+        return _cells[h];
+    }
+
+    // Both tables keep their memory between frames; fresh pages cost more than the probing
+    void grow()
+    {
+        _spare.swap(_cells);
+        reset_table(_bits + 1);
+        for (auto&& c : _spare)
+        {
+            if (c.key != empty_key())
+                find(c.key) = c;
+        }
+    }
+
+    // 21 bits per axis: +-1M voxels around the camera
+    static uint64_t voxel_key(double v)
+    {
+        v = std::min(std::max(v, -double(1 << 20)), double((1 << 20) - 1));
+        int64_t i = int64_t(v);
+        i -= i > v; // floor without a libm call
+        return uint64_t(i + (1 << 20));
+    }
+
+    int _bits = 0;
+    std::vector<cell> _cells, _spare, _recent;
+    std::vector<sum> _sums;
+};
+
+// Writes the cloud as binary PLY or raw float32 XYZ triples (host byte order, which is
+// little-endian on every platform librealsense runs on). Returns the bytes written.
+inline size_t write_point_cloud(const frame_io& io, const std::string& path, const point_cloud& cloud, point_format format)
+{
+    std::string header;
+    if (format == point_format::ply)
+    {
+        header = "ply\nformat binary_little_endian 1.0\ncomment depth in meters\nelement vertex " +
+            std::to_string(cloud.size()) + "\nproperty float x\nproperty float y\nproperty float z\nend_header\n";
+    }
+
+    size_t total = header.size() + cloud.size() * 3 * sizeof(float);
+    auto file = io.open(path, total);
+    if (!header.empty())
+        file->append(header.data(), header.size());
+
+    // Interleave in chunks that stay in cache
+    const size_t chunk = 16384;
+    static thread_local std::vector<float> xyz;
+    xyz.resize(chunk * 3);
+    for (size_t first = 0; first < cloud.size(); first += chunk)
+    {
+        size_t n = std::min(chunk, cloud.size() - first);
+        for (size_t i = 0; i < n; i++)
+        {
+            xyz[i * 3 + 0] = cloud.x[first + i];
+            xyz[i * 3 + 1] = cloud.y[first + i];
+            xyz[i * 3 + 2] = cloud.z[first + i];
+        }
+        file->append(xyz.data(), n * 3 * sizeof(float));
+    }
+    file->close();
+    return total;
+}
+
+// The whole stage: depth frame -> pooled cloud -> file. Safe to share between writer threads.
+class pointcloud_exporter
+{
+public:
+    // voxel_m = 0: no downsampling; max_m = 0: no range limit
+    pointcloud_exporter(point_format format, float voxel_m, float max_m,
+        std::shared_ptr<const frame_io> io = std::make_shared<frame_io>())
+        : _format(format), _voxel_m(voxel_m), _max_m(max_m), _io(io)
+    {
+    }
+
+    const char* extension() const { return point_format_extension(_format); }
+
+    // Deprojected (and downsampled) points of a Z16 depth frame
+    std::shared_ptr<point_cloud> deproject(const rs2::depth_frame& depth)
+    {
+        auto rays = rays_for(depth.get_profile().as<rs2::video_stream_profile>());
+        auto cloud = _pool.acquire(size_t(rays->width()) * rays->height());
+        deproject_depth(static_cast<const uint16_t*>(depth.get_data()), depth.get_stride_in_bytes(),
+            depth.get_units(), *rays, *cloud, _max_m);
+        if (_voxel_m > 0)
+        {
+            static thread_local voxel_grid grid;
+            grid.downsample(*cloud, _voxel_m);
+        }
+        return cloud;
+    }
+
+    // Writes to path_stem + extension(); returns the bytes written
+    size_t write(const point_cloud& cloud, const std::string& path_stem) const
+    {
+        return write_point_cloud(*_io, path_stem + extension(), cloud, _format);
+    }
+
+    size_t export_frame(const rs2::depth_frame& depth, const std::string& path_stem)
+    {
+        return write(*deproject(depth), path_stem);
+    }
+
+private:
+    // Built on the first frame of a profile, rebuilt only if its intrinsics change
+    std::shared_ptr<const ray_table> rays_for(const rs2::video_stream_profile& profile)
+    {
+        auto intrinsics = profile.get_intrinsics();
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& rays = _rays[profile.unique_id()];
+        if (!rays || !rays->matches(intrinsics))
+            rays = std::make_shared<const ray_table>(intrinsics);
+        return rays;
+    }
+
+    point_format _format;
+    float _voxel_m, _max_m;
+    std::shared_ptr<const frame_io> _io;
+    point_cloud_pool _pool;
+    std::mutex _mutex;
+    std::map<int, std::shared_ptr<const ray_table>> _rays;
+};
@@ -0,0 +1,354 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "async_frame_writer.hpp"   // bounded_mpmc_queue
+#include "stage_profiler.hpp"       // stage_histogram, pipeline_stage::filter
+
+// Depth post-processing (librealsense's filter blocks) off the capture thread.
+//
+// The chain is given as "name[:value],...", applied in that order, e.g.
+//
+//   decimation:2,spatial,temporal:0.4,hole-filling:1
+//
+//   decimation    value: magnitude (2..8)
+//   spatial       value: iterations (1..5)
+//   temporal      value: smooth alpha (0..1)
+//   hole-filling  value: mode (0 fill from left, 1 farthest, 2 nearest)
+//   threshold     value: max distance in meters
+//
+// Every stream gets its own instances of the filters: the temporal filter keeps state
+// from frame to frame and must see one stream's frames, all of them, in order. A pool of
+// threads runs the chains. A stream is handed to one thread at a time (it is queued for
+// the pool only when its queue goes from empty to non-empty, and given back after a
+// few frames), so frames of a stream are filtered in capture order while different
+// streams use different threads. Handing a frame over takes no lock: the submitting
+// thread puts it in the stream's lock-free queue and, if the stream was idle, the stream
+// on the pool's. A stream whose queue is full drops the new frame (counted); the
+// temporal filter then sees a gap, as it would from the camera.
+//
+// Each frame travels with a tag, given back with the filtered frame, so the caller can
+// tell how the source frame was saved (e.g. its event or sync group).
+
+struct filter_spec
+{
+    std::string name;
+    float value = 0;
+    bool has_value = false;
+};
+
+inline std::vector<filter_spec> parse_filter_chain(const std::string& chain)
+{
+    std::vector<filter_spec> specs;
+    std::stringstream in(chain);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        if (item.empty())
+            continue;
+        filter_spec spec;
+        auto colon = item.find(':');
+        spec.name = item.substr(0, colon);
+        if (colon != std::string::npos)
+        {
+            char* end = nullptr;
+            std::string value = item.substr(colon + 1);
+            spec.value = strtof(value.c_str(), &end);
+            if (value.empty() || *end)
+                throw std::runtime_error("Filter " + spec.name + ": not a number: " + value);
+            spec.has_value = true;
+        }
+        if (spec.name != "decimation" && spec.name != "spatial" && spec.name != "temporal" &&
+            spec.name != "hole-filling" && spec.name != "threshold")
+            throw std::runtime_error("Unknown filter " + spec.name);
+        specs.push_back(spec);
+    }
+    if (specs.empty())
+        throw std::runtime_error("Empty filter chain");
+    return specs;
+}
+
+inline rs2::filter make_filter(const filter_spec& spec)
+{
+    auto configured = [&](rs2::filter f, rs2_option option)
+    {
+        if (spec.has_value)
+            f.set_option(option, spec.value);
+        return f;
+    };
+    if (spec.name == "decimation")   return configured(rs2::decimation_filter(), RS2_OPTION_FILTER_MAGNITUDE);
+    if (spec.name == "spatial")      return configured(rs2::spatial_filter(), RS2_OPTION_FILTER_MAGNITUDE);
+    if (spec.name == "temporal")     return configured(rs2::temporal_filter(), RS2_OPTION_FILTER_SMOOTH_ALPHA);
+    if (spec.name == "hole-filling") return configured(rs2::hole_filling_filter(), RS2_OPTION_HOLES_FILL);
+    if (spec.name == "threshold")    return configured(rs2::threshold_filter(), RS2_OPTION_MAX_DISTANCE);
+    throw std::runtime_error("Unknown filter " + spec.name);
+}
+
+class post_processor
+{
+public:
+    // What is handed back with a filtered frame: the source's file prefix, and whether
+    // the source was saved at all
+    struct frame_tag
+    {
+        std::string prefix;
+        bool saved = true;
+    };
+
+    // Called on a pool thread with each filtered frame, in order per stream
+    typedef std::function<void(const std::string& serial, rs2::frame filtered, const frame_tag& tag)> output_fn;
+
+    // One stream's filters, queue and costs
+    class chain
+    {
+    public:
+        const std::string& serial() const { return _serial; }
+        const std::string& stream() const { return _stream; }
+
+    private:
+        friend class post_processor;
+
+        chain(const std::string& serial, const std::string& stream, const std::vector<filter_spec>& specs,
+            size_t capacity, int channel)
+            : _serial(serial), _stream(stream), _queue(capacity + 1), _channel(channel)
+        {
+            for (auto&& spec : specs)
+            {
+                _filters.push_back(make_filter(spec));
+                _cost_ns.emplace_back(new stage_histogram());
+            }
+        }
+
+        struct queued_frame
+        {
+            rs2::frame frame;
+            frame_tag tag;
+        };
+
+        std::string _serial, _stream;
+        std::vector<rs2::filter> _filters;
+        std::vector<std::unique_ptr<stage_histogram>> _cost_ns;   // per filter; written by the owning pool thread
+        bounded_mpmc_queue<queued_frame> _queue;
+        std::atomic<int64_t> _pending{ 0 };                       // queued + being filtered
+        std::atomic<uint64_t> _processed{ 0 }, _dropped{ 0 }, _failed{ 0 };
+        int _channel;
+    };
+
+    // Idle until started; held by value (the ready queue is cache-line aligned)
+    explicit post_processor(stage_profiler& profiler)
+        : _profiler(profiler), _ready(1024) {}
+
+    // Once, before the first chain_for
+    void start(const std::vector<filter_spec>& specs, size_t threads, size_t queue_per_stream, output_fn output)
+    {
+        if (running())
+            throw std::runtime_error("Post-processing already started");
+        _specs = specs;
+        _capacity = std::max<size_t>(1, queue_per_stream);
+        _output = output;
+        for (size_t i = 0; i < std::max<size_t>(1, threads); i++)
+            _workers.emplace_back([this]() { worker_loop(); });
+    }
+
+    bool running() const { return !_workers.empty(); }
+
+    ~post_processor()
+    {
+        stop();
+    }
+
+    post_processor(const post_processor&) = delete;
+    post_processor& operator=(const post_processor&) = delete;
+
+    // The chain of a stream, created on first use; a reconnected stream keeps its chain.
+    // Takes a short lock.
+    chain* chain_for(const std::string& serial, const std::string& stream)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& c = _chains[std::make_pair(serial, stream)];
+        if (!c)
+            c.reset(new chain(serial, stream, _specs, _capacity, _profiler.channel(serial, stream)));
+        return c.get();
+    }
+
+    // Queue a frame for its stream; false if the stream's queue is full. Frames of one
+    // stream must come from one thread at a time, in order.
+    bool submit(chain* c, rs2::frame f, const frame_tag& tag)
+    {
+        if (_stopping || c->_pending.load(std::memory_order_acquire) >= int64_t(_capacity))
+        {
+            c->_dropped++;
+            return false;
+        }
+        f.keep();
+        chain::queued_frame item{ f, tag };
+        while (!c->_queue.try_push(item))
+            std::this_thread::yield(); // the last item is still being popped
+        _in_flight++;
+        if (c->_pending.fetch_add(1, std::memory_order_acq_rel) == 0)
+            schedule(c);
+        return true;
+    }
+
+    // Blocks until every frame submitted so far was filtered and handed on
+    void flush()
+    {
+        while (_in_flight.load() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Filters what is queued, then joins the pool
+    void stop()
+    {
+        if (!running())
+            return;
+        flush();
+        _stopping = true;
+        _wake.notify_all();
+        for (auto&& w : _workers)
+            w.join();
+        _workers.clear();
+    }
+
+    // Per stream: frames filtered, dropped and failed, and each filter's cost
+    std::string report_text() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::ostringstream out;
+        char line[256];
+        for (auto&& c : _chains)
+        {
+            snprintf(line, sizeof(line), "filters sn: %s %s: filtered=%llu dropped=%llu failed=%llu queued=%lld\n",
+                c.second->_serial.c_str(), c.second->_stream.c_str(), (unsigned long long)c.second->_processed.load(),
+                (unsigned long long)c.second->_dropped.load(), (unsigned long long)c.second->_failed.load(),
+                (long long)c.second->_pending.load());
+            out << line;
+            for (size_t i = 0; i < _specs.size(); i++)
+            {
+                stage_summary cost;
+                cost.add(*c.second->_cost_ns[i]);
+                snprintf(line, sizeof(line), "    %-14s p50=%8.1fus p99=%8.1fus max=%8.1fus\n", _specs[i].name.c_str(),
+                    cost.percentile(50) / 1000., cost.percentile(99) / 1000., cost.max / 1000.);
+                out << line;
+            }
+        }
+        return out.str();
+    }
+
+    void print_report() const
+    {
+        printf("%s", report_text().c_str());
+    }
+
+private:
+    // Frames a pool thread filters from one stream before giving the others a turn
+    static const int batch = 4;
+
+    void schedule(chain* c)
+    {
+        while (!_ready.try_push(c))
+            std::this_thread::yield(); // more streams than the queue holds; never in practice
+        if (_sleepers.load(std::memory_order_acquire) > 0)
+            _wake.notify_one();
+    }
+
+    void worker_loop()
+    {
+        _profiler.name_thread("filter");
+        for (;;)
+        {
+            chain* c = nullptr;
+            if (_ready.try_pop(c))
+            {
+                run(*c);
+                continue;
+            }
+            if (_stopping)
+                return;
+
+            // Nothing to do - sleep until a stream is scheduled (bounded, in case a wakeup raced)
+            std::unique_lock<std::mutex> lock(_wake_mutex);
+            _sleepers++;
+            _wake.wait_for(lock, std::chrono::milliseconds(2));
+            _sleepers--;
+        }
+    }
+
+    // This thread owns the stream until its queue is empty or it hands it back
+    void run(chain& c)
+    {
+        for (int n = 0;; n++)
+        {
+            chain::queued_frame item;
+            if (c._queue.try_pop(item))
+                filter(c, item.frame, item.tag);
+            _in_flight--;
+            if (c._pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                return; // drained; the next submit schedules it again
+            if (n + 1 == batch)
+            {
+                schedule(&c);
+                return;
+            }
+        }
+    }
+
+    void filter(chain& c, rs2::frame f, const frame_tag& tag)
+    {
+        stage_timer timer(_profiler, c._channel, pipeline_stage::filter, frame_arrival_ms(f));
+        try
+        {
+            for (size_t i = 0; i < c._filters.size(); i++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                f = c._filters[i].process(f);
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                c._cost_ns[i]->add(uint64_t(ns));
+            }
+            c._processed++;
+            _output(c._serial, f, tag);
+        }
+        catch (const std::exception& e)
+        {
+            if (c._failed++ == 0)
+                std::cerr << "sn: " << c._serial << " " << c._stream << " filtering failed: " << e.what() << std::endl;
+        }
+    }
+
+    stage_profiler& _profiler;
+    std::vector<filter_spec> _specs;
+    size_t _capacity = 1;
+    output_fn _output;
+
+    mutable std::mutex _mutex; // guards _chains (not the chains themselves)
+    std::map<std::pair<std::string, std::string>, std::unique_ptr<chain>> _chains;
+
+    bounded_mpmc_queue<chain*> _ready;
+    std::vector<std::thread> _workers;
+    std::atomic<bool> _stopping{ false };
+    std::atomic<int64_t> _in_flight{ 0 };
+    std::mutex _wake_mutex;
+    std::condition_variable _wake;
+    std::atomic<int> _sleepers{ 0 };
+};
@@ -0,0 +1,353 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+#include <librealsense2/rs_advanced_mode.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Startup configuration of advanced-mode presets.
+//
+// A preset file is read, parsed and validated once; presets are cached by a hash of
+// their normalized content, so the same preset under another name or formatting is not
+// parsed again. Applying a preset to a device first compares it with what the device
+// reports through serialize_json() and skips load_json() when nothing would change;
+// advanced mode is only toggled when it is off (toggling resets the device, which is
+// then waited for). All connected devices are configured concurrently, and every
+// device reports how long each phase took.
+
+// Flattened preset: nested objects and arrays become dotted keys, values keep their
+// JSON text (strings unquoted)
+typedef std::map<std::string, std::string> preset_values;
+
+// Minimal JSON reader for preset files; throws std::runtime_error with the byte offset
+class preset_parser
+{
+public:
+    explicit preset_parser(const std::string& text) : _text(text) {}
+
+    preset_values parse()
+    {
+        preset_values values;
+        skip_space();
+        if (peek() != '{')
+            fail("a preset must be a JSON object");
+        value("", values);
+        skip_space();
+        if (_pos != _text.size())
+            fail("trailing characters");
+        return values;
+    }
+
+private:
+    void value(const std::string& key, preset_values& values)
+    {
+        skip_space();
+        char c = peek();
+        if (c == '{')
+        {
+            _pos++;
+            skip_space();
+            if (peek() == '}') { _pos++; return; }
+            for (;;)
+            {
+                skip_space();
+                std::string name = string();
+                skip_space();
+                expect(':');
+                value(key.empty() ? name : key + "." + name, values);
+                skip_space();
+                if (peek() == ',') { _pos++; continue; }
+                expect('}');
+                return;
+            }
+        }
+        if (c == '[')
+        {
+            _pos++;
+            skip_space();
+            if (peek() == ']') { _pos++; return; }
+            for (int i = 0;; i++)
+            {
+                value(key + "." + std::to_string(i), values);
+                skip_space();
+                if (peek() == ',') { _pos++; continue; }
+                expect(']');
+                return;
+            }
+        }
+        if (key.empty())
+            fail("expected an object");
+        if (c == '"')
+        {
+            values[key] = string();
+            return;
+        }
+        // number, true, false or null
+        size_t start = _pos;
+        while (_pos < _text.size() && std::string(",}] \t\r\n").find(_text[_pos]) == std::string::npos)
+            _pos++;
+        std::string literal = _text.substr(start, _pos - start);
+        if (literal != "true" && literal != "false" && literal != "null")
+        {
+            char* end = nullptr;
+            strtod(literal.c_str(), &end);
+            if (literal.empty() || *end)
+                fail("invalid value '" + literal + "'");
+        }
+        values[key] = literal;
+    }
+
+    std::string string()
+    {
+        expect('"');
+        std::string out;
+        while (_pos < _text.size() && _text[_pos] != '"')
+        {
+            if (_text[_pos] == '\\' && _pos + 1 < _text.size())
+                _pos++;
+            out += _text[_pos++];
+        }
+        expect('"');
+        return out;
+    }
+
+    void skip_space()
+    {
+        while (_pos < _text.size() && isspace(static_cast<unsigned char>(_text[_pos])))
+            _pos++;
+    }
+
+    char peek() const { return _pos < _text.size() ? _text[_pos] : '\0'; }
+
+    void expect(char c)
+    {
+        if (peek() != c)
+            fail(std::string("expected '") + c + "'");
+        _pos++;
+    }
+
+    void fail(const std::string& what) const
+    {
+        throw std::runtime_error("preset JSON: " + what + " at offset " + std::to_string(_pos));
+    }
+
+    const std::string& _text;
+    size_t _pos = 0;
+};
+
+// True if every value of the preset is already what the device reports. Numbers are
+// compared numerically, since devices print them in their own format.
+inline bool preset_matches(const preset_values& preset, const preset_values& device)
+{
+    for (auto&& kv : preset)
+    {
+        auto it = device.find(kv.first);
+        if (it == device.end())
+            return false;
+        if (it->second == kv.second)
+            continue;
+        char *end_a = nullptr, *end_b = nullptr;
+        double a = strtod(kv.second.c_str(), &end_a), b = strtod(it->second.c_str(), &end_b);
+        if (*end_a || *end_b || kv.second.empty() || it->second.empty() ||
+            std::fabs(a - b) > 1e-6 * std::max(1., std::fabs(a)))
+            return false;
+    }
+    return true;
+}
+
+struct device_preset
+{
+    std::string path;
+    std::string json;       // as read, passed to load_json
+    preset_values values;
+    uint64_t hash;          // of the normalized values
+};
+
+class preset_cache
+{
+public:
+    std::shared_ptr<const device_preset> load(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Failed to open preset " + path);
+        std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return load_json(path, json);
+    }
+
+    std::shared_ptr<const device_preset> load_json(const std::string& path, const std::string& json)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto by_text = _by_text_hash.find(fnv1a(json));
+        if (by_text != _by_text_hash.end())
+            return by_text->second;
+
+        auto values = preset_parser(json).parse(); // validates
+        uint64_t hash = hash_values(values);
+        auto& preset = _by_hash[hash];
+        if (!preset)
+            preset = std::make_shared<device_preset>(device_preset{ path, json, values, hash });
+        _by_text_hash[fnv1a(json)] = preset;
+        return preset;
+    }
+
+    static uint64_t fnv1a(const std::string& data, uint64_t h = 14695981039346656037ULL)
+    {
+        for (unsigned char c : data)
+        {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static uint64_t hash_values(const preset_values& values)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for (auto&& kv : values)
+            h = fnv1a(kv.second + '\n', fnv1a(kv.first + '=', h));
+        return h;
+    }
+
+private:
+    std::mutex _mutex;
+    std::map<uint64_t, std::shared_ptr<const device_preset>> _by_text_hash;
+    std::map<uint64_t, std::shared_ptr<const device_preset>> _by_hash;
+};
+
+struct preset_report
+{
+    std::string serial;
+    std::string result;     // "applied", "unchanged", "not supported" or the error
+    std::vector<std::pair<std::string, double>> phases_ms;
+};
+
+// Waits for a device (after an advanced-mode toggle reset it) to come back with advanced mode on
+inline rs2::device wait_for_advanced_mode(rs2::context& ctx, const std::string& serial, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        try
+        {
+            for (auto&& dev : ctx.query_devices())
+            {
+                if (dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER) == serial &&
+                    dev.is<rs400::advanced_mode>() && dev.as<rs400::advanced_mode>().is_enabled())
+                    return dev;
+            }
+        }
+        catch (const rs2::error&)
+        {
+            // the device list changes under us while the device re-enumerates
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    throw std::runtime_error("sn " + serial + " did not come back in advanced mode");
+}
+
+// allow_reset: whether advanced mode may be switched on. That resets the device, which
+// must not happen from inside a devices-changed callback (the reconnect is never seen there).
+inline preset_report apply_preset(rs2::context& ctx, rs2::device dev, const device_preset& preset,
+    bool allow_reset = true, std::chrono::milliseconds reset_timeout = std::chrono::milliseconds(10000))
+{
+    preset_report report;
+    report.serial = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+    auto phase_start = std::chrono::steady_clock::now();
+    auto phase = [&](const char* name)
+    {
+        auto now = std::chrono::steady_clock::now();
+        report.phases_ms.emplace_back(name, std::chrono::duration<double, std::milli>(now - phase_start).count());
+        phase_start = now;
+    };
+
+    try
+    {
+        if (!dev.is<rs400::advanced_mode>())
+        {
+            report.result = "not supported";
+            return report;
+        }
+        auto advanced = dev.as<rs400::advanced_mode>();
+        if (!advanced.is_enabled())
+        {
+            if (!allow_reset)
+            {
+                report.result = "advanced mode off";
+                return report;
+            }
+            advanced.toggle_advanced_mode(true);
+            advanced = wait_for_advanced_mode(ctx, report.serial, reset_timeout).as<rs400::advanced_mode>();
+        }
+        phase("advanced-mode");
+
+        auto current = advanced.serialize_json();
+        phase("read");
+        bool unchanged = preset_matches(preset.values, preset_parser(current).parse());
+        phase("compare");
+        if (unchanged)
+        {
+            report.result = "unchanged";
+            return report;
+        }
+
+        advanced.load_json(preset.json);
+        phase("load");
+        report.result = "applied";
+    }
+    catch (const std::exception& e)
+    {
+        phase("failed");
+        report.result = e.what();
+    }
+    return report;
+}
+
+// Applies the preset to every connected device at once; reports are in device order
+inline std::vector<preset_report> apply_preset_to_all(rs2::context& ctx, const device_preset& preset)
+{
+    std::vector<rs2::device> devices;
+    for (auto&& dev : ctx.query_devices())
+        devices.push_back(dev);
+
+    std::vector<preset_report> reports(devices.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < devices.size(); i++)
+        workers.emplace_back([&, i]() { reports[i] = apply_preset(ctx, devices[i], preset); });
+    for (auto&& t : workers)
+        t.join();
+    return reports;
+}
+
+inline void print_preset_reports(const device_preset& preset, const std::vector<preset_report>& reports, double total_ms)
+{
+    printf("preset %s (hash %016llx, %zu values): %zu devices in %.1f ms\n", preset.path.c_str(),
+        (unsigned long long)preset.hash, preset.values.size(), reports.size(), total_ms);
+    for (auto&& r : reports)
+    {
+        printf("preset sn: %s %s", r.serial.c_str(), r.result.c_str());
+        for (auto&& p : r.phases_ms)
+            printf(" %s=%.1fms", p.first.c_str(), p.second);
+        printf("\n");
+    }
+}
@@ -0,0 +1,287 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "io_backend.hpp"           // Buffered / mmap / direct output files
+
+// Segmented, append-only container for raw frame dumps.
+//
+//   <prefix>_00000.rawseg, <prefix>_00001.rawseg, ...   frame payloads back-to-back
+//   <prefix>.rawidx                                     fixed-size index records
+//
+// Segments are preallocated to their maximum size when opened and trimmed to the
+// bytes actually used when they are closed, so the file system sees a handful of
+// large files instead of one small file per frame. Segments are written through a
+// frame_io backend (buffered by default); the index always goes through stdio.
+
+const char raw_index_magic[8] = { 'R', 'S', 'R', 'A', 'W', 'I', 'X', '2' };
+
+#pragma pack(push, 1)
+struct raw_index_record
+{
+    char     serial[64];            // zero padded; long enough for playback names
+    uint8_t  stream_type;           // rs2_stream
+    uint8_t  stream_index;
+    uint16_t format;                // rs2_format
+    uint16_t width;
+    uint16_t height;
+    uint32_t stride;
+    uint32_t segment;
+    uint32_t size;
+    uint64_t offset;                // within the segment
+    int64_t  frame_counter;         // RS2_FRAME_METADATA_FRAME_COUNTER, else the frame number
+    int64_t  backend_timestamp;     // RS2_FRAME_METADATA_BACKEND_TIMESTAMP, else the frame timestamp
+};
+#pragma pack(pop)
+
+inline std::string raw_segment_name(const std::string& prefix, uint32_t segment)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%05u.rawseg", segment);
+    return prefix + suffix;
+}
+
+inline std::string raw_record_serial(const raw_index_record& r)
+{
+    return std::string(r.serial, strnlen(r.serial, sizeof(r.serial)));
+}
+
+// Same as rs2::stream_profile::stream_name(): "Depth", "Infrared 1", ...
+inline std::string raw_record_stream_name(const raw_index_record& r)
+{
+    std::stringstream ss;
+    ss << rs2_stream_to_string(rs2_stream(r.stream_type));
+    if (r.stream_index != 0)
+        ss << " " << int(r.stream_index);
+    return ss.str();
+}
+
+// The name save_frame_raw_data() used for the same frame: fc<cnt>_ts<ts>_sn<serial>_<stream>.raw
+inline std::string raw_record_filename(const raw_index_record& r)
+{
+    std::stringstream file;
+    std::string filename;
+    file << "fc" << r.frame_counter << "_ts" << r.backend_timestamp << "_sn" << raw_record_serial(r)
+         << "_" << raw_record_stream_name(r) << ".raw";
+    file >> filename;
+    return filename;
+}
+
+class raw_container_writer
+{
+public:
+    // Roll over to a new segment when it would exceed segment_bytes or has been open
+    // longer than segment_duration (zero disables the time limit)
+    raw_container_writer(const std::string& prefix, uint64_t segment_bytes = 1ull << 30,
+        std::chrono::seconds segment_duration = std::chrono::seconds(0),
+        std::shared_ptr<const frame_io> io = std::make_shared<frame_io>())
+        : _prefix(prefix), _segment_bytes(segment_bytes), _segment_duration(segment_duration), _io(io)
+    {
+        _index = fopen((prefix + ".rawidx").c_str(), "wb");
+        if (!_index)
+            throw std::runtime_error("Failed to create " + prefix + ".rawidx");
+        uint32_t record_size = sizeof(raw_index_record);
+        fwrite(raw_index_magic, sizeof(raw_index_magic), 1, _index);
+        fwrite(&record_size, sizeof(record_size), 1, _index);
+    }
+
+    ~raw_container_writer()
+    {
+        try
+        {
+            close_segment();
+        }
+        catch (const std::exception& e)
+        {
+            fprintf(stderr, "%s\n", e.what());
+        }
+        if (_index)
+            fclose(_index);
+    }
+
+    raw_container_writer(const raw_container_writer&) = delete;
+    raw_container_writer& operator=(const raw_container_writer&) = delete;
+
+    // Append one video frame; returns the payload size, 0 if the frame is not a video frame
+    size_t append(const std::string& serial, const rs2::frame& frame)
+    {
+        auto image = frame.as<rs2::video_frame>();
+        if (!image)
+            return 0;
+        return append(serial, frame, image.get_data(), image.get_width(), image.get_height(), image.get_stride_in_bytes());
+    }
+
+    // Append other pixels in place of the frame's own (e.g. cropped or downscaled), with
+    // the frame's stream, format and metadata
+    size_t append(const std::string& serial, const rs2::frame& frame, const void* pixels, int width, int height, int stride)
+    {
+        auto image = frame.as<rs2::video_frame>();
+        if (!image)
+            return 0;
+
+        raw_index_record r{};
+        if (serial.size() > sizeof(r.serial))
+            throw std::runtime_error("Device name " + serial + " is too long for " + _prefix + ".rawidx");
+        strncpy(r.serial, serial.c_str(), sizeof(r.serial));
+        auto profile = image.get_profile();
+        r.stream_type = uint8_t(profile.stream_type());
+        r.stream_index = uint8_t(profile.stream_index());
+        r.format = uint16_t(profile.format());
+        r.width = uint16_t(width);
+        r.height = uint16_t(height);
+        r.stride = uint32_t(stride);
+        r.size = r.stride * r.height;
+        // Recordings and software devices may lack metadata; fall back as the save path's names do
+        r.frame_counter = image.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) ?
+            image.get_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) : int64_t(image.get_frame_number());
+        r.backend_timestamp = image.supports_frame_metadata(RS2_FRAME_METADATA_BACKEND_TIMESTAMP) ?
+            image.get_frame_metadata(RS2_FRAME_METADATA_BACKEND_TIMESTAMP) : int64_t(image.get_timestamp());
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (!_segment ||
+            _used + r.size > _segment_bytes ||
+            (_segment_duration.count() && now - _segment_opened > _segment_duration))
+        {
+            open_segment(now, r.size);
+        }
+
+        r.segment = _segment_id;
+        r.offset = _used;
+        _segment->append(pixels, r.size);
+        if (fwrite(&r, sizeof(r), 1, _index) != 1)
+            throw std::runtime_error("Failed to append to " + _prefix + ".rawidx");
+        _used += r.size;
+        return r.size;
+    }
+
+    // Flushes the index; segment data goes out as its backend writes it, and all of it on close
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        fflush(_index);
+    }
+
+    uint32_t segment_count() const { return _segment ? _segment_id + 1 : _segment_id; }
+
+private:
+    void open_segment(std::chrono::steady_clock::time_point now, uint64_t first_record)
+    {
+        if (_segment)
+        {
+            close_segment();
+            _segment_id++;
+        }
+
+        // Preallocated to the maximum; a single oversized frame still gets its own segment
+        _allocated = std::max(_segment_bytes, first_record);
+        _segment = _io->open(raw_segment_name(_prefix, _segment_id), _allocated);
+        _used = 0;
+        _segment_opened = now;
+        fflush(_index); // index is durable up to the previous segment
+    }
+
+    void close_segment()
+    {
+        if (!_segment)
+            return;
+        auto segment = std::move(_segment);
+        segment->close(); // trims the preallocated tail
+    }
+
+    std::string _prefix;
+    uint64_t _segment_bytes;
+    std::chrono::seconds _segment_duration;
+    std::shared_ptr<const frame_io> _io;
+
+    std::mutex _mutex;
+    FILE* _index = nullptr;
+    std::unique_ptr<output_file> _segment;
+    uint32_t _segment_id = 0;
+    uint64_t _used = 0;
+    uint64_t _allocated = 0;
+    std::chrono::steady_clock::time_point _segment_opened;
+};
+
+class raw_container_reader
+{
+    struct file_closer { void operator()(FILE* f) const { fclose(f); } };
+
+public:
+    explicit raw_container_reader(const std::string& prefix)
+        : _prefix(prefix)
+    {
+        std::unique_ptr<FILE, file_closer> index(fopen((prefix + ".rawidx").c_str(), "rb"));
+        if (!index)
+            throw std::runtime_error("Failed to open " + prefix + ".rawidx");
+
+        char magic[sizeof(raw_index_magic)];
+        uint32_t record_size = 0;
+        if (fread(magic, sizeof(magic), 1, index.get()) != 1 ||
+            memcmp(magic, raw_index_magic, sizeof(magic)) != 0 ||
+            fread(&record_size, sizeof(record_size), 1, index.get()) != 1 ||
+            record_size != sizeof(raw_index_record))
+            throw std::runtime_error(prefix + ".rawidx is not a raw container index");
+
+        raw_index_record r;
+        while (fread(&r, sizeof(r), 1, index.get()) == 1)
+            _records.push_back(r);
+    }
+
+    const std::vector<raw_index_record>& records() const { return _records; }
+
+    void read(const raw_index_record& r, std::vector<uint8_t>& data)
+    {
+        auto& segment = _segments[r.segment];
+        if (!segment)
+        {
+            auto name = raw_segment_name(_prefix, r.segment);
+            segment.reset(fopen(name.c_str(), "rb"));
+            if (!segment)
+                throw std::runtime_error("Failed to open " + name);
+        }
+
+        data.resize(r.size);
+        if (seek_file(segment.get(), r.offset) != 0 ||
+            fread(data.data(), 1, r.size, segment.get()) != r.size)
+            throw std::runtime_error("Truncated record in " + raw_segment_name(_prefix, r.segment));
+    }
+
+    // Write every record back out as one file per frame, using the original naming
+    size_t export_files(const std::string& directory)
+    {
+        std::vector<uint8_t> data;
+        size_t count = 0;
+        for (auto&& r : _records)
+        {
+            read(r, data);
+            auto filename = directory + raw_record_filename(r);
+            std::unique_ptr<FILE, file_closer> out(fopen(filename.c_str(), "wb"));
+            if (!out || fwrite(data.data(), 1, data.size(), out.get()) != data.size())
+                throw std::runtime_error("Failed to write " + filename);
+            count++;
+        }
+        return count;
+    }
+
+private:
+    std::string _prefix;
+    std::vector<raw_index_record> _records;
+    std::map<uint32_t, std::unique_ptr<FILE, file_closer>> _segments;
+};
@@ -0,0 +1,229 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Auto-exposure ROI for every ROI-capable sensor of a set of devices.
+//
+// The ROI is given as a fraction of the image and turned into pixels from each sensor's
+// active stream profile, so it follows whatever resolution is streaming. Instead of a
+// fixed sleep before each call, every set_region_of_interest() is read back and
+// retried with a bounded exponential backoff until the device reports the ROI that was
+// asked for. Devices are configured in parallel (sensors of one device in turn, since
+// they share its control channel). request() applies a new ROI on a background thread,
+// coalescing requests, so a capture loop can move the ROI without waiting on the device.
+
+// Fractions of the stream width and height, 0..1
+struct roi_fraction
+{
+    float min_x, min_y, max_x, max_y;
+};
+
+inline rs2::region_of_interest roi_pixels(const roi_fraction& f, int width, int height)
+{
+    auto to_px = [](float v, int size) { return std::min(size - 1, std::max(0, int(v * size))); };
+    rs2::region_of_interest roi{};
+    roi.min_x = to_px(f.min_x, width);
+    roi.min_y = to_px(f.min_y, height);
+    roi.max_x = std::max(roi.min_x, to_px(f.max_x, width));
+    roi.max_y = std::max(roi.min_y, to_px(f.max_y, height));
+    return roi;
+}
+
+struct roi_retry
+{
+    int max_attempts = 6;
+    std::chrono::milliseconds first_backoff{ 10 };
+    std::chrono::milliseconds max_backoff{ 320 };
+};
+
+struct roi_result
+{
+    std::string serial;
+    std::string sensor;
+    rs2::region_of_interest roi;
+    int attempts = 0;
+    double ms = 0;
+    bool ok = false;
+    std::string error;      // last failure, if any attempt failed
+};
+
+// Sets the ROI on one sensor and reads it back until it sticks
+inline roi_result apply_roi(const std::string& serial, rs2::sensor sensor, const roi_fraction& fraction, const roi_retry& retry)
+{
+    roi_result result;
+    result.serial = serial;
+    result.sensor = sensor.supports(RS2_CAMERA_INFO_NAME) ? sensor.get_info(RS2_CAMERA_INFO_NAME) : "sensor";
+    auto start = std::chrono::steady_clock::now();
+    auto backoff = retry.first_backoff;
+
+    for (result.attempts = 1; result.attempts <= retry.max_attempts; result.attempts++)
+    {
+        try
+        {
+            // The active profile can change between attempts, so derive the ROI each time
+            rs2::video_stream_profile profile;
+            for (auto&& p : sensor.get_active_streams())
+                if ((profile = p.as<rs2::video_stream_profile>()))
+                    break;
+            if (!profile)
+                throw std::runtime_error("not streaming");
+
+            result.roi = roi_pixels(fraction, profile.width(), profile.height());
+            auto roi_sensor = sensor.as<rs2::roi_sensor>();
+            roi_sensor.set_region_of_interest(result.roi);
+            auto actual = roi_sensor.get_region_of_interest();
+            if (actual.min_x == result.roi.min_x && actual.min_y == result.roi.min_y &&
+                actual.max_x == result.roi.max_x && actual.max_y == result.roi.max_y)
+            {
+                result.ok = true;
+                break;
+            }
+            result.error = "read back a different ROI";
+        }
+        catch (const std::exception& e)
+        {
+            result.error = e.what();
+        }
+        if (result.attempts == retry.max_attempts)
+            break;
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(retry.max_backoff, backoff * 2);
+    }
+    result.attempts = std::min(result.attempts, retry.max_attempts);
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+class roi_manager
+{
+public:
+    // include_depth: also set the stereo module's AE ROI, not only color
+    roi_manager(const std::vector<rs2::device>& devices, bool include_depth = true, roi_retry retry = roi_retry())
+        : _retry(retry), _worker([this]() { run(); })
+    {
+        for (auto&& dev : devices)
+        {
+            target t;
+            t.serial = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+            for (auto&& s : dev.query_sensors())
+            {
+                if (!s.is<rs2::roi_sensor>()) continue;
+                if (!include_depth && s.is<rs2::depth_sensor>()) continue;
+                t.sensors.push_back(s);
+            }
+            if (!t.sensors.empty())
+                _targets.push_back(t);
+        }
+    }
+
+    ~roi_manager()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _worker.join();
+    }
+
+    // Applies now, on one thread per device, and returns once every sensor is done
+    std::vector<roi_result> apply(const roi_fraction& fraction)
+    {
+        std::lock_guard<std::mutex> applying(_apply_mutex); // one ROI change at a time per device
+        std::vector<std::vector<roi_result>> per_device(_targets.size());
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < _targets.size(); i++)
+        {
+            threads.emplace_back([&, i]()
+            {
+                for (auto&& s : _targets[i].sensors)
+                    per_device[i].push_back(apply_roi(_targets[i].serial, s, fraction, _retry));
+            });
+        }
+        for (auto&& t : threads)
+            t.join();
+
+        std::vector<roi_result> results;
+        for (auto&& r : per_device)
+            results.insert(results.end(), r.begin(), r.end());
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _last = results;
+        }
+        return results;
+    }
+
+    // Returns immediately; the background thread applies the newest request
+    void request(const roi_fraction& fraction)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending = fraction;
+            _has_pending = true;
+        }
+        _cv.notify_one();
+    }
+
+    std::vector<roi_result> last_results() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _last;
+    }
+
+    static void print(const std::vector<roi_result>& results)
+    {
+        for (auto&& r : results)
+        {
+            printf("roi sn: %s %s [%d,%d]-[%d,%d] %s after %d attempt(s) %.1f ms%s%s\n", r.serial.c_str(), r.sensor.c_str(),
+                r.roi.min_x, r.roi.min_y, r.roi.max_x, r.roi.max_y, r.ok ? "set" : "FAILED", r.attempts, r.ms,
+                r.error.empty() ? "" : ": ", r.error.c_str());
+        }
+    }
+
+private:
+    struct target
+    {
+        std::string serial;
+        std::vector<rs2::sensor> sensors;
+    };
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            _cv.wait(lock, [this]() { return _stop || _has_pending; });
+            if (_stop)
+                return;
+            roi_fraction fraction = _pending;
+            _has_pending = false;
+            lock.unlock();
+            apply(fraction);
+            lock.lock();
+        }
+    }
+
+    roi_retry _retry;
+    std::vector<target> _targets;
+    std::mutex _apply_mutex;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    roi_fraction _pending{};
+    bool _has_pending = false;
+    bool _stop = false;
+    std::vector<roi_result> _last;
+    std::thread _worker; // last, so everything it uses exists before it starts
+};
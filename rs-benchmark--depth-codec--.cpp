@@ -0,0 +1,228 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// 3rd party header for writing png files
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "frame_encoders.hpp"
+
+// Depth Codec Benchmark measures the temporal depth codec (tdc) against the spatial-only
+// rice codec on depth sequences: compression ratio, encode and decode MB/s (of Z16
+// input), and a lossless check of every frame through tdc_decoder. tdc runs intra-only
+// (every frame a keyframe) and temporal with a keyframe every N frames, on one thread
+// and with its stripes spread over several.
+//
+// Sequences are synthetic (a static rig with sensor noise and flickering holes, and the
+// same scene with an object moving through it) or recorded: the raw Z16 dumps the save
+// path writes, given with their size.
+//
+// Usage: rs-benchmark--depth-codec-- [--frames <n>] [--keyframe-interval <n>] [--threads <n>]
+//            [--stripes <n>] [--raw <width>x<height> <file.raw>...]
+
+struct sequence
+{
+    std::string label;
+    int width, height;
+    std::vector<std::vector<uint16_t>> frames;
+
+    size_t frame_bytes() const { return size_t(width) * height * 2; }
+};
+
+// A static scene: floor, a box and a slanted wall with fixed surface texture; per frame,
+// small depth noise on part of the pixels and holes that come and go. With `moving`, a
+// nearer object crosses it.
+sequence make_sequence(int w, int h, int frames, bool moving)
+{
+    sequence seq{ moving ? "synthetic moving 848x480" : "synthetic static 848x480", w, h, {} };
+    std::mt19937 rng(2017);
+    std::uniform_int_distribution<int> noise(-3, 3);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> texture(-15, 15);
+
+    std::vector<uint16_t> scene(size_t(w) * h);
+    std::vector<bool> unstable(scene.size());
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            scene[size_t(y) * w + x] = uint16_t(y > h * 2 / 3 ? 900 + (h - y) * 4 : (x > w / 3 && x < w / 2) ? 1200 : 3000 + x) + texture(rng);
+            unstable[size_t(y) * w + x] = percent(rng) < 4; // edges and dark spots
+        }
+
+    for (int f = 0; f < frames; f++)
+    {
+        std::vector<uint16_t> depth(scene.size());
+        for (size_t i = 0; i < depth.size(); i++)
+        {
+            int p = percent(rng);
+            if (unstable[i] && p < 50)
+                depth[i] = 0;
+            else
+                depth[i] = uint16_t(scene[i] + (p < 40 ? noise(rng) : 0));
+        }
+        if (moving)
+        {
+            int x0 = (f * 8) % w, y0 = h / 4;
+            for (int y = y0; y < y0 + h / 3; y++)
+                for (int x = x0; x < std::min(w, x0 + w / 6); x++)
+                    depth[size_t(y) * w + x] = uint16_t(700 + (x - x0) / 4 + noise(rng));
+        }
+        seq.frames.push_back(std::move(depth));
+    }
+    return seq;
+}
+
+sequence load_raw(int w, int h, const std::vector<std::string>& files)
+{
+    sequence seq{ "recorded " + std::to_string(w) + "x" + std::to_string(h) + " (" + std::to_string(files.size()) + " files)", w, h, {} };
+    for (auto&& name : files)
+    {
+        std::ifstream file(name, std::ios::binary);
+        std::vector<uint16_t> depth(size_t(w) * h);
+        if (!file.read(reinterpret_cast<char*>(depth.data()), depth.size() * 2))
+            throw std::runtime_error("Failed to read " + name + " as " + std::to_string(w) + "x" + std::to_string(h) + " Z16");
+        seq.frames.push_back(std::move(depth));
+    }
+    return seq;
+}
+
+struct result
+{
+    uint64_t input = 0, output = 0;
+    double encode_s = 0, decode_s = 0;
+    bool lossless = true;
+};
+
+image_view view_of(const sequence& seq, size_t i)
+{
+    return image_view{ reinterpret_cast<const uint8_t*>(seq.frames[i].data()), seq.width, seq.height, 2, seq.width * 2 };
+}
+
+// keyframe_interval 1: intra only
+result run_tdc(const sequence& seq, int stripes, int threads, int keyframe_interval)
+{
+    tdc_encoder encoder(stripes, threads);
+    std::vector<std::vector<uint8_t>> encoded(seq.frames.size());
+    result r;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < seq.frames.size(); i++)
+    {
+        bool keyframe = i % size_t(keyframe_interval) == 0;
+        image_view previous = keyframe ? image_view{} : view_of(seq, i - 1);
+        encoder.encode_temporal(view_of(seq, i), i, keyframe ? nullptr : &previous, i - 1, encoded[i]);
+        r.input += seq.frame_bytes();
+        r.output += encoded[i].size();
+    }
+    r.encode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    tdc_decoder decoder(threads);
+    std::vector<std::vector<uint16_t>> decoded(seq.frames.size());
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < seq.frames.size(); i++)
+    {
+        tdc::frame_info info;
+        std::string error;
+        if (!decoder.decode(encoded[i], decoded[i], info, error))
+            r.lossless = false;
+    }
+    r.decode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < seq.frames.size(); i++)
+        r.lossless = r.lossless && decoded[i] == seq.frames[i];
+    return r;
+}
+
+result run_rice(const sequence& seq)
+{
+    rice_encoder encoder;
+    std::vector<std::vector<uint8_t>> encoded(seq.frames.size());
+    result r;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < seq.frames.size(); i++)
+    {
+        encoder.encode(view_of(seq, i), encoded[i]);
+        r.input += seq.frame_bytes();
+        r.output += encoded[i].size();
+    }
+    r.encode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < seq.frames.size(); i++)
+    {
+        std::vector<uint8_t> pixels;
+        int w, h, bpp;
+        r.lossless = rice::decode(encoded[i], pixels, w, h, bpp) &&
+            !memcmp(pixels.data(), seq.frames[i].data(), seq.frame_bytes()) && r.lossless;
+    }
+    r.decode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+void print(const sequence& seq, const std::string& codec, const result& r)
+{
+    const double mb = r.input / 1048576.;
+    printf("%-34s %-22s %7.2f:1 %8.1f MB/s %8.1f MB/s %s\n", seq.label.c_str(), codec.c_str(),
+        double(r.input) / double(r.output), mb / r.encode_s, mb / r.decode_s, r.lossless ? "lossless" : "MISMATCH");
+}
+
+int main(int argc, char * argv[]) try
+{
+    int frames = 60, keyframe_interval = 30, stripes = 8;
+    int threads = int(std::max(2u, std::thread::hardware_concurrency()));
+    int raw_w = 0, raw_h = 0;
+    std::vector<std::string> raw_files;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--raw" && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &raw_w, &raw_h) == 2)
+        {
+            for (i += 2; i < argc && argv[i][0] != '-'; i++)
+                raw_files.push_back(argv[i]);
+            i--;
+        }
+        else if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+        else if (arg == "--frames") frames = std::max(2, std::stoi(argv[++i]));
+        else if (arg == "--keyframe-interval") keyframe_interval = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--threads") threads = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--stripes") stripes = std::max(1, std::stoi(argv[++i]));
+        else throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    std::vector<sequence> sequences;
+    sequences.push_back(make_sequence(848, 480, frames, false));
+    sequences.push_back(make_sequence(848, 480, frames, true));
+    if (!raw_files.empty())
+        sequences.push_back(load_raw(raw_w, raw_h, raw_files));
+
+    printf("%-34s %-22s %8s %13s %13s\n", "sequence", "codec", "ratio", "encode", "decode");
+    bool all_lossless = true;
+    for (auto&& seq : sequences)
+    {
+        std::vector<std::pair<std::string, result>> results;
+        results.emplace_back("rice", run_rice(seq));
+        results.emplace_back("tdc intra", run_tdc(seq, stripes, 1, 1));
+        results.emplace_back("tdc key/" + std::to_string(keyframe_interval), run_tdc(seq, stripes, 1, keyframe_interval));
+        results.emplace_back("tdc key/" + std::to_string(keyframe_interval) + " " + std::to_string(threads) + " thr",
+            run_tdc(seq, stripes, threads, keyframe_interval));
+        for (auto&& r : results)
+        {
+            print(seq, r.first, r.second);
+            all_lossless = all_lossless && r.second.lossless;
+        }
+    }
+    return all_lossless ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
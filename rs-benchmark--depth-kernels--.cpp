@@ -0,0 +1,118 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "depth_kernels.hpp"
+
+// Depth Kernels Benchmark compares the project colorizer (depth_colormap) against
+// rs2::colorizer, and times the fused ROI statistics kernel, on synthetic 848x480 and
+// 1280x720 Z16 frames. The library colorizer is fed real frames from a software_device.
+//
+// Usage: rs-benchmark--depth-kernels-- [iterations]
+
+std::vector<uint16_t> make_depth(int w, int h)
+{
+    std::mt19937 rng(2017);
+    std::uniform_int_distribution<int> noise(-6, 6);
+    std::uniform_int_distribution<int> hole(0, 19);
+    std::vector<uint16_t> depth(size_t(w) * h);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            int v = y > h * 2 / 3 ? 900 + (h - y) * 4 : (x > w / 3 && x < w / 2) ? 1200 : 3000 + x;
+            depth[size_t(y) * w + x] = hole(rng) == 0 ? 0 : uint16_t(v + noise(rng));
+        }
+    return depth;
+}
+
+// Wraps the synthetic buffer in an rs2::frame via a software_device
+rs2::frame make_frame(const std::vector<uint16_t>& depth, int w, int h)
+{
+    rs2::software_device dev;
+    auto sensor = dev.add_sensor("Depth");
+    rs2_intrinsics intrinsics{ w, h, w / 2.f, h / 2.f, 380.f, 380.f, RS2_DISTORTION_BROWN_CONRADY ,{ 0,0,0,0,0 } };
+    auto stream = sensor.add_video_stream({ RS2_STREAM_DEPTH, 0, 0, w, h, 30, 2, RS2_FORMAT_Z16, intrinsics });
+
+    rs2::frame_queue queue(1, true);
+    sensor.open(stream);
+    sensor.start(queue);
+    auto pixels = new uint16_t[depth.size()];
+    std::copy(depth.begin(), depth.end(), pixels);
+    sensor.on_video_frame({ pixels, [](void* p) { delete[] static_cast<uint16_t*>(p); },
+        w * 2, 2, 0., RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK, 0, stream.get() });
+    rs2::frame f = queue.wait_for_frame();
+    sensor.stop();
+    sensor.close();
+    return f;
+}
+
+template<class F>
+double time_ms(int iterations, F body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        body();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char * argv[]) try
+{
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 200;
+
+#if defined(DEPTH_KERNELS_AVX2)
+    const char* isa = "avx2";
+#elif defined(DEPTH_KERNELS_SSE41)
+    const char* isa = "sse4.1";
+#else
+    const char* isa = "scalar";
+#endif
+    printf("depth kernels built for %s, %d iterations\n", isa, iterations);
+    printf("%-10s %-28s %10s\n", "frame", "kernel", "ms/frame");
+
+    depth_colormap colormap(300, 4000);
+    for (auto size : { std::make_pair(848, 480), std::make_pair(1280, 720) })
+    {
+        int w = size.first, h = size.second;
+        auto depth = make_depth(w, h);
+        std::vector<uint8_t> rgb(size_t(w) * h * 3);
+        std::string label = std::to_string(w) + "x" + std::to_string(h);
+
+        rs2::frame frame = make_frame(depth, w, h);
+        rs2::colorizer library;
+        library.process(frame); // warm-up: first call allocates the output pool
+        printf("%-10s %-28s %10.3f\n", label.c_str(), "rs2::colorizer",
+            time_ms(iterations, [&]() { library.process(frame); }));
+
+        printf("%-10s %-28s %10.3f\n", label.c_str(), "depth_colormap",
+            time_ms(iterations, [&]() { colormap.colorize(depth.data(), w, h, w * 2, rgb.data(), w * 3); }));
+
+        depth_stats stats;
+        printf("%-10s %-28s %10.3f\n", label.c_str(), "depth_statistics (frame)",
+            time_ms(iterations, [&]() { depth_statistics(depth.data(), w, h, w * 2, nullptr, stats); }));
+
+        depth_roi roi{ w / 4, h / 4, w * 3 / 4 - 1, h * 3 / 4 - 1 };
+        printf("%-10s %-28s %10.3f\n", label.c_str(), "depth_statistics (50% ROI)",
+            time_ms(iterations, [&]() { depth_statistics(depth.data(), w, h, w * 2, &roi, stats); }));
+        printf("%-10s roi: min=%u max=%u mean=%.1f valid=%.1f%%\n", label.c_str(),
+            stats.min, stats.max, stats.mean, 100. * stats.valid_ratio);
+    }
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error & e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
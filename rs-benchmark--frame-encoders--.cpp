@@ -0,0 +1,154 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 3rd party header for writing png files
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "frame_encoders.hpp"
+
+// Frame Encoders Benchmark compares the save-path encoders on synthetic frames shaped
+// like what the cameras produce: 1280x720 RGB8 color, 848x480 Y8 infrared and 848x480
+// Z16 depth. For each encoder it reports throughput (MB/s of input) and compression
+// ratio, encoding on N threads at once the way the writer pool does.
+//
+// Usage: rs-benchmark--frame-encoders-- [threads] [frames per thread]
+
+struct synthetic_image
+{
+    std::string label;
+    std::vector<uint8_t> pixels;
+    image_view view;
+};
+
+synthetic_image make_color(int w, int h, std::mt19937& rng)
+{
+    synthetic_image img{ "color 1280x720 RGB8", std::vector<uint8_t>(size_t(w) * h * 3), {} };
+    std::uniform_int_distribution<int> noise(-2, 2);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            uint8_t* p = &img.pixels[(size_t(y) * w + x) * 3];
+            bool object = ((x / 160) + (y / 120)) % 3 == 0;        // flat-colored objects over gradients
+            p[0] = uint8_t(object ? 200 : (x * 255 / w) + noise(rng));
+            p[1] = uint8_t(object ? 80 : (y * 255 / h) + noise(rng));
+            p[2] = uint8_t(object ? 40 : 128 + noise(rng));
+        }
+    img.view = image_view{ img.pixels.data(), w, h, 3, w * 3 };
+    return img;
+}
+
+synthetic_image make_infrared(int w, int h, std::mt19937& rng)
+{
+    synthetic_image img{ "infrared 848x480 Y8", std::vector<uint8_t>(size_t(w) * h), {} };
+    std::uniform_int_distribution<int> noise(-4, 4);
+    std::uniform_int_distribution<int> dot(0, 30);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            int v = 60 + (x + y) / 20 + noise(rng);
+            if (dot(rng) == 0) v += 120;                            // projector speckle
+            img.pixels[size_t(y) * w + x] = uint8_t(std::min(255, std::max(0, v)));
+        }
+    img.view = image_view{ img.pixels.data(), w, h, 1, w };
+    return img;
+}
+
+synthetic_image make_depth(int w, int h, std::mt19937& rng)
+{
+    synthetic_image img{ "depth 848x480 Z16", std::vector<uint8_t>(size_t(w) * h * 2), {} };
+    auto depth = reinterpret_cast<uint16_t*>(img.pixels.data());
+    std::uniform_int_distribution<int> noise(-6, 6);
+    std::uniform_int_distribution<int> hole(0, 19);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            int v = y > h * 2 / 3 ? 900 + (h - y) * 4                // floor
+                  : (x > w / 3 && x < w / 2) ? 1200                 // box
+                  : 3000 + x;                                       // slanted wall
+            v += noise(rng);
+            depth[size_t(y) * w + x] = hole(rng) == 0 ? 0 : uint16_t(v);
+        }
+    img.view = image_view{ img.pixels.data(), w, h, 2, w * 2 };
+    return img;
+}
+
+bool round_trip(const frame_encoder& encoder, const synthetic_image& img, const std::vector<uint8_t>& encoded)
+{
+    std::vector<uint8_t> decoded;
+    int w = 0, h = 0, bpp = 0;
+    std::string name = encoder.name();
+    if (name == "qoi" && !qoi::decode(encoded, decoded, w, h, bpp)) return false;
+    if (name == "rice" && !rice::decode(encoded, decoded, w, h, bpp)) return false;
+    if (name != "qoi" && name != "rice") return true; // raw is trivially lossless, png is stb's
+    return decoded == img.pixels;
+}
+
+void run(const frame_encoder& encoder, const synthetic_image& img, int threads, int frames)
+{
+    if (!encoder.supports(img.view.bytes_per_pixel))
+        return;
+
+    std::vector<uint8_t> sample;
+    encoder.encode(img.view, sample);
+    bool lossless = round_trip(encoder, img, sample);
+
+    std::atomic<uint64_t> encoded_bytes{ 0 };
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+        pool.emplace_back([&]()
+        {
+            std::vector<uint8_t> out;
+            for (int i = 0; i < frames; i++)
+            {
+                encoder.encode(img.view, out);
+                encoded_bytes += out.size();
+            }
+        });
+    }
+    for (auto&& t : pool)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double input_mb = double(img.pixels.size()) * threads * frames / (1024. * 1024.);
+    printf("%-22s %-5s %9.1f MB/s %8.1f fps %7.2f:1 %s\n", img.label.c_str(), encoder.name(),
+        input_mb / seconds, threads * frames / seconds,
+        double(img.pixels.size()) * threads * frames / double(encoded_bytes), lossless ? "lossless" : "MISMATCH");
+}
+
+int main(int argc, char * argv[]) try
+{
+    int threads = argc > 1 ? std::stoi(argv[1]) : int(std::max(1u, std::thread::hardware_concurrency()));
+    int frames = argc > 2 ? std::stoi(argv[2]) : 30;
+
+    std::mt19937 rng(2017);
+    std::vector<synthetic_image> images;
+    images.push_back(make_color(1280, 720, rng));
+    images.push_back(make_infrared(848, 480, rng));
+    images.push_back(make_depth(848, 480, rng));
+
+    printf("%d threads x %d frames per image\n", threads, frames);
+    printf("%-22s %-5s %14s %12s %9s\n", "image", "codec", "throughput", "rate", "ratio");
+    for (auto&& img : images)
+    {
+        for (auto name : { "png", "qoi", "rice", "raw" })
+            run(*make_frame_encoder(name), img, threads, frames);
+    }
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,196 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io_backend.hpp"
+
+// I/O Backends Benchmark compares sustained write throughput and tail latency of the
+// buffered, mmap and direct (O_DIRECT, io_uring where available) backends on a local
+// disk. N threads write depth-sized frames for a fixed time, either appended to
+// preallocated segment files the way raw_container_writer does or as one file per
+// frame the way the per-frame dumps do. Every file is synced before it is closed and
+// the time for that is included, so the page cache cannot hide the disk. Reported
+// latency is per frame (append, or create+write+close for one file per frame).
+//
+// Usage: rs-benchmark--io-backends-- [--dir <directory on the disk to test>] [--threads <n>]
+//            [--seconds <s per run>] [--frame-bytes <n>] [--segment-mb <n>] [--fps <per thread, 0 = flat out>]
+//            [--mode segments|files|both] [--backend buffered|mmap|direct]...
+
+struct benchmark_options
+{
+    std::string dir = ".";
+    int threads = 4;
+    double seconds = 5;
+    size_t frame_bytes = 848 * 480 * 2;
+    uint64_t segment_mb = 1024;
+    double fps = 0;
+    bool segments = true, files = true;
+    std::vector<io_backend> backends;
+};
+
+struct run_result
+{
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    std::vector<double> latency_ms;
+};
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = std::min(sorted.size() - 1, size_t(p / 100. * sorted.size()));
+    return sorted[rank];
+}
+
+run_result run(const benchmark_options& opt, io_backend backend, bool segments)
+{
+    io_options io;
+    io.backend = backend;
+    io.sync_on_close = true;
+    frame_io output(io);
+
+    std::vector<run_result> per_thread(opt.threads);
+    std::vector<std::string> errors(opt.threads);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(opt.seconds));
+    std::vector<std::thread> pool;
+    for (int t = 0; t < opt.threads; t++)
+    {
+        pool.emplace_back([&, t]()
+        {
+            auto& r = per_thread[t];
+            std::vector<uint8_t> frame(opt.frame_bytes);
+            for (size_t i = 0; i < frame.size(); i++)
+                frame[i] = uint8_t(i * 7 + t);
+            std::string prefix = opt.dir + "/io_bench_" + std::to_string(t) + "_";
+            std::vector<std::string> written;
+            auto period = opt.fps > 0 ? std::chrono::duration<double>(1. / opt.fps) : std::chrono::duration<double>(0);
+            auto next = std::chrono::steady_clock::now();
+            try
+            {
+                std::unique_ptr<output_file> segment;
+                uint64_t segment_bytes = opt.segment_mb << 20;
+                while (std::chrono::steady_clock::now() < deadline)
+                {
+                    auto frame_start = std::chrono::steady_clock::now();
+                    if (segments)
+                    {
+                        if (!segment || segment->size() + frame.size() > segment_bytes)
+                        {
+                            if (segment)
+                                segment->close();
+                            written.push_back(prefix + std::to_string(written.size()) + ".rawseg");
+                            segment = output.open(written.back(), segment_bytes);
+                        }
+                        segment->append(frame.data(), frame.size());
+                    }
+                    else
+                    {
+                        written.push_back(prefix + std::to_string(written.size()) + ".raw");
+                        output.write_file(written.back(), frame.data(), frame.size());
+                    }
+                    r.latency_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count());
+                    r.frames++;
+                    r.bytes += frame.size();
+                    if (opt.fps > 0)
+                    {
+                        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+                        std::this_thread::sleep_until(next);
+                    }
+                }
+                if (segment)
+                {
+                    // The final sync counts: it is data the disk still had to take
+                    auto close_start = std::chrono::steady_clock::now();
+                    segment->close();
+                    r.latency_ms.back() += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - close_start).count();
+                }
+            }
+            catch (const std::exception& e)
+            {
+                errors[t] = e.what();
+            }
+            r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            for (auto&& name : written)
+                std::remove(name.c_str());
+        });
+    }
+    for (auto&& t : pool)
+        t.join();
+    for (auto&& e : errors)
+    {
+        if (!e.empty())
+            throw std::runtime_error(e);
+    }
+
+    run_result total;
+    for (auto&& r : per_thread)
+    {
+        total.frames += r.frames;
+        total.bytes += r.bytes;
+        total.seconds = std::max(total.seconds, r.seconds);
+        total.latency_ms.insert(total.latency_ms.end(), r.latency_ms.begin(), r.latency_ms.end());
+    }
+    std::sort(total.latency_ms.begin(), total.latency_ms.end());
+    return total;
+}
+
+benchmark_options parse_options(int argc, char* argv[])
+{
+    benchmark_options opt;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg(argv[i]), value(argv[i + 1]);
+        io_backend backend;
+        if (arg == "--dir") opt.dir = value;
+        else if (arg == "--threads") opt.threads = std::max(1, std::stoi(value));
+        else if (arg == "--seconds") opt.seconds = std::stod(value);
+        else if (arg == "--frame-bytes") opt.frame_bytes = std::stoul(value);
+        else if (arg == "--segment-mb") opt.segment_mb = std::stoull(value);
+        else if (arg == "--fps") opt.fps = std::stod(value);
+        else if (arg == "--mode") { opt.segments = value != "files"; opt.files = value != "segments"; }
+        else if (arg == "--backend" && parse_io_backend(value, backend)) opt.backends.push_back(backend);
+        else throw std::runtime_error("Unknown argument " + arg);
+    }
+    if (opt.backends.empty())
+        opt.backends = { io_backend::buffered, io_backend::mmap, io_backend::direct };
+    return opt;
+}
+
+int main(int argc, char * argv[]) try
+{
+    auto opt = parse_options(argc, argv);
+
+    printf("%d threads x %.0f s, %zu-byte frames%s, into %s\n", opt.threads, opt.seconds, opt.frame_bytes,
+        opt.fps > 0 ? (" at " + std::to_string(int(opt.fps)) + " fps each").c_str() : "", opt.dir.c_str());
+    printf("%-9s %-9s %11s %10s %9s %9s %9s %9s\n", "backend", "mode", "throughput", "rate", "p50", "p99", "p99.9", "max");
+    for (auto mode : { true, false })
+    {
+        if ((mode && !opt.segments) || (!mode && !opt.files))
+            continue;
+        for (auto backend : opt.backends)
+        {
+            auto r = run(opt, backend, mode);
+            printf("%-9s %-9s %6.0f MB/s %6.0f fps %7.3fms %7.3fms %7.3fms %7.3fms\n", io_backend_name(backend),
+                mode ? "segments" : "files", r.bytes / r.seconds / 1048576., r.frames / r.seconds,
+                percentile(r.latency_ms, 50), percentile(r.latency_ms, 99), percentile(r.latency_ms, 99.9),
+                r.latency_ms.empty() ? 0. : r.latency_ms.back());
+        }
+    }
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,149 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+#include <librealsense2/rsutil.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pointcloud_export.hpp"
+
+// Point Cloud Benchmark compares the per-pixel rs2_deproject_pixel_to_point loop that
+// offline conversion uses against pointcloud_export.hpp: the ray table (scalar and
+// SIMD), voxel downsampling and the PLY writer, on synthetic 848x480 and 1280x720 Z16
+// frames with inverse Brown-Conrady intrinsics. It also checks that the ray-table
+// points are bit-identical to the rsutil ones.
+//
+// Usage: rs-benchmark--pointcloud-- [iterations] [output directory for the PLY test]
+
+std::vector<uint16_t> make_depth(int w, int h)
+{
+    std::mt19937 rng(2017);
+    std::uniform_int_distribution<int> noise(-6, 6);
+    std::uniform_int_distribution<int> hole(0, 19);
+    std::vector<uint16_t> depth(size_t(w) * h);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            int v = y > h * 2 / 3 ? 900 + (h - y) * 4 : (x > w / 3 && x < w / 2) ? 1200 : 3000 + x;
+            depth[size_t(y) * w + x] = hole(rng) == 0 ? 0 : uint16_t(v + noise(rng));
+        }
+    return depth;
+}
+
+// What the offline converter does: one rsutil call per valid pixel
+size_t deproject_rsutil(const std::vector<uint16_t>& depth, float depth_scale, const rs2_intrinsics& intrinsics, point_cloud& out)
+{
+    out.reserve(depth.size());
+    size_t n = 0;
+    for (int v = 0; v < intrinsics.height; v++)
+        for (int u = 0; u < intrinsics.width; u++)
+        {
+            float z = float(depth[size_t(v) * intrinsics.width + u]) * depth_scale;
+            if (!(z > 0.f))
+                continue;
+            float pixel[2] = { float(u), float(v) }, point[3];
+            rs2_deproject_pixel_to_point(point, &intrinsics, pixel, z);
+            out.x[n] = point[0];
+            out.y[n] = point[1];
+            out.z[n] = point[2];
+            n++;
+        }
+    out.count = n;
+    return n;
+}
+
+bool identical(const point_cloud& a, const point_cloud& b)
+{
+    size_t bytes = a.size() * sizeof(float);
+    return a.size() == b.size() && !memcmp(a.x.data(), b.x.data(), bytes) &&
+           !memcmp(a.y.data(), b.y.data(), bytes) && !memcmp(a.z.data(), b.z.data(), bytes);
+}
+
+template<class F>
+double time_ms(int iterations, F body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        body();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char * argv[]) try
+{
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 100;
+    std::string out_dir = argc > 2 ? argv[2] : ".";
+
+#if defined(POINTCLOUD_AVX2)
+    const char* isa = "avx2";
+#elif defined(POINTCLOUD_SSE41)
+    const char* isa = "sse4.1";
+#else
+    const char* isa = "scalar";
+#endif
+    printf("point cloud built for %s, %d iterations\n", isa, iterations);
+    printf("%-10s %-28s %10s %10s\n", "frame", "stage", "ms/frame", "points");
+
+    const float depth_scale = 0.001f;
+    frame_io io;
+    bool all_identical = true;
+    for (auto size : { std::make_pair(848, 480), std::make_pair(1280, 720) })
+    {
+        int w = size.first, h = size.second;
+        auto depth = make_depth(w, h);
+        std::string label = std::to_string(w) + "x" + std::to_string(h);
+        rs2_intrinsics intrinsics{ w, h, w / 2.f + 3.5f, h / 2.f - 2.25f, w * 0.72f, w * 0.72f,
+            RS2_DISTORTION_INVERSE_BROWN_CONRADY, { -0.055f, 0.065f, 0.0004f, 0.0007f, -0.021f } };
+
+        point_cloud reference, cloud;
+        double ms = time_ms(iterations, [&]() { deproject_rsutil(depth, depth_scale, intrinsics, reference); });
+        printf("%-10s %-28s %10.3f %10zu\n", label.c_str(), "rsutil per pixel", ms, reference.size());
+
+        std::shared_ptr<ray_table> rays;
+        printf("%-10s %-28s %10.3f %10s\n", label.c_str(), "ray table build (once)",
+            time_ms(1, [&]() { rays = std::make_shared<ray_table>(intrinsics); }), "");
+
+        ms = time_ms(iterations, [&]() { deproject_depth(depth.data(), w * 2, depth_scale, *rays, cloud, 0, false); });
+        printf("%-10s %-28s %10.3f %10zu\n", label.c_str(), "ray table, scalar", ms, cloud.size());
+        bool scalar_ok = identical(reference, cloud);
+
+        ms = time_ms(iterations, [&]() { deproject_depth(depth.data(), w * 2, depth_scale, *rays, cloud); });
+        printf("%-10s %-28s %10.3f %10zu\n", label.c_str(), (std::string("ray table, ") + isa).c_str(), ms, cloud.size());
+        bool simd_ok = identical(reference, cloud);
+
+        ms = time_ms(iterations, [&]() { deproject_depth(depth.data(), w * 2, depth_scale, *rays, cloud, 2.f); });
+        printf("%-10s %-28s %10.3f %10zu\n", label.c_str(), "ray table, max 2 m", ms, cloud.size());
+
+        voxel_grid grid;
+        ms = time_ms(iterations, [&]() { deproject_depth(depth.data(), w * 2, depth_scale, *rays, cloud); grid.downsample(cloud, 0.01f); });
+        printf("%-10s %-28s %10.3f %10zu\n", label.c_str(), "deproject + 1 cm voxels", ms, cloud.size());
+
+        deproject_depth(depth.data(), w * 2, depth_scale, *rays, cloud);
+        std::string path = out_dir + "/pointcloud_bench_" + label + ".ply";
+        size_t bytes = 0;
+        double write_ms = time_ms(std::max(1, iterations / 10), [&]() { bytes = write_point_cloud(io, path, cloud, point_format::ply); });
+        printf("%-10s %-28s %10.3f %10zu (%.0f MB/s)\n", label.c_str(), "write binary ply", write_ms, cloud.size(),
+            bytes / write_ms / 1048.576);
+        std::remove(path.c_str());
+
+        printf("%-10s bit-identical to rsutil: scalar %s, %s %s\n", label.c_str(),
+            scalar_ok ? "yes" : "NO", isa, simd_ok ? "yes" : "NO");
+        all_identical = all_identical && scalar_ok && simd_ok;
+    }
+    return all_identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+catch (const rs2::error & e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,323 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 3rd party header for writing png files
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "device_container.hpp"     // The multicam capture and save path under test
+
+// Save Path Benchmark runs device_container - per-device capture threads, writer pool,
+// encoders, metadata log - without cameras, so save-path throughput can be tracked for
+// regressions. Frames come either from recorded .bag files or from software devices
+// that generate Z16 depth (and RGB8 color) at a set resolution, rate and camera count.
+// It reports frames/s, end-to-end latency percentiles (arrival on the host to written), drops,
+// bytes written and the per-stage timings (with --filters, also each depth filter's
+// cost), and with --json writes the same as one JSON object; --trace writes the stage
+// spans as a Chrome trace.
+//
+// Usage: rs-benchmark--save-path-- [--bag <file>]... [--cameras <n>] [--width <w>] [--height <h>]
+//            [--fps <rate>] [--seconds <s>] [--no-color] [--writers <n>] [--queue <frames>]
+//            [--policy block|drop-oldest|drop-newest] [--depth-codec <c>] [--color-codec <c>]
+//            [--keyframe-interval <frames>] [--shm <name>] [--filters <chain>] [--filter-threads <n>]
+//            [--io buffered|mmap|direct] [--capture-policy <file.json>]
+//            [--out <existing directory>] [--json <file>] [--trace <file>]
+
+struct benchmark_options
+{
+    std::vector<std::string> bags;
+    int cameras = 2, width = 848, height = 480, fps = 30;
+    double seconds = 10;
+    bool color = true;
+    size_t writers = 2, queue = 256;
+    backpressure_policy policy = backpressure_policy::block;
+    std::string depth_codec = "raw", color_codec = "png";
+    int keyframe_interval = 30;
+    std::string shm;
+    std::string filters;
+    size_t filter_threads = 2;
+    io_options io;
+    std::string capture_policy;
+    std::string out = ".";
+    std::string json;
+    std::string trace;
+};
+
+// One simulated camera: a software device with a depth and optionally a color sensor,
+// fed from its own thread at the configured rate
+class synthetic_camera
+{
+public:
+    synthetic_camera(rs2::context& ctx, int index, const benchmark_options& opt)
+        : _opt(opt), _serial("sw-" + std::to_string(1000 + index))
+    {
+        _dev.register_info(RS2_CAMERA_INFO_SERIAL_NUMBER, _serial);
+        _dev.register_info(RS2_CAMERA_INFO_NAME, "Software Camera");
+
+        int w = opt.width, h = opt.height;
+        rs2_intrinsics intrinsics{ w, h, w / 2.f, h / 2.f, 380.f, 380.f, RS2_DISTORTION_BROWN_CONRADY ,{ 0,0,0,0,0 } };
+        _depth_sensor = _dev.add_sensor("Depth");
+        _depth = _depth_sensor.add_video_stream({ RS2_STREAM_DEPTH, 0, 0, w, h, opt.fps, 2, RS2_FORMAT_Z16, intrinsics }, true);
+        _depth_pixels.resize(size_t(w) * h * 2);
+        auto depth = reinterpret_cast<uint16_t*>(_depth_pixels.data());
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                depth[size_t(y) * w + x] = uint16_t((x * 7 + y * 13) % 19 == 0 ? 0 : 800 + x + y); // slanted plane with holes
+        if (opt.color)
+        {
+            _color_sensor = _dev.add_sensor("Color");
+            _color = _color_sensor.add_video_stream({ RS2_STREAM_COLOR, 0, 1, w, h, opt.fps, 3, RS2_FORMAT_RGB8, intrinsics }, true);
+            _color_pixels.resize(size_t(w) * h * 3);
+            for (size_t i = 0; i < _color_pixels.size(); i++)
+                _color_pixels[i] = uint8_t((i / 3 % w) * 255 / w + (i % 3) * 40);
+        }
+        _dev.create_matcher(RS2_MATCHER_DEFAULT);
+        _dev.add_to(ctx);
+    }
+
+    ~synthetic_camera() { stop(); }
+
+    rs2::device device() const { return _dev; }
+    uint64_t produced() const { return _produced; }
+
+    void start()
+    {
+        _thread = std::thread([this]() { run(); });
+    }
+
+    void stop()
+    {
+        _running = false;
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+private:
+    void run()
+    {
+        auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1. / _opt.fps));
+        auto next = std::chrono::steady_clock::now();
+        for (int frame_number = 0; _running; frame_number++)
+        {
+            double now_ms = host_time_ms();
+            double device_ms = frame_number * 1000. / _opt.fps;
+            send(_depth_sensor, _depth, _depth_pixels, 2, frame_number, now_ms, device_ms);
+            if (_opt.color)
+                send(_color_sensor, _color, _color_pixels, 3, frame_number, now_ms, device_ms);
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    void send(rs2::software_sensor& sensor, rs2::stream_profile& profile, const std::vector<uint8_t>& pixels,
+        int bpp, int frame_number, double now_ms, double device_ms)
+    {
+        // The metadata the capture path and the metadata log read from a real camera
+        sensor.set_metadata(RS2_FRAME_METADATA_FRAME_COUNTER, frame_number);
+        sensor.set_metadata(RS2_FRAME_METADATA_FRAME_TIMESTAMP, rs2_metadata_type(device_ms * 1000.));
+        sensor.set_metadata(RS2_FRAME_METADATA_SENSOR_TIMESTAMP, rs2_metadata_type(device_ms * 1000.));
+        sensor.set_metadata(RS2_FRAME_METADATA_BACKEND_TIMESTAMP, rs2_metadata_type(now_ms));
+        sensor.set_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL, rs2_metadata_type(now_ms));
+
+        auto data = new uint8_t[pixels.size()];
+        std::copy(pixels.begin(), pixels.end(), data);
+        sensor.on_video_frame({ data, [](void* p) { delete[] static_cast<uint8_t*>(p); },
+            _opt.width * bpp, bpp, device_ms, RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK, frame_number, profile.get() });
+        _produced++;
+    }
+
+    const benchmark_options& _opt;
+    std::string _serial;
+    rs2::software_device _dev;
+    rs2::software_sensor _depth_sensor, _color_sensor;
+    rs2::stream_profile _depth, _color;
+    std::vector<uint8_t> _depth_pixels, _color_pixels;
+    std::atomic<uint64_t> _produced{ 0 };
+    std::atomic<bool> _running{ true };
+    std::thread _thread;
+};
+
+benchmark_options parse_options(int argc, char* argv[])
+{
+    benchmark_options opt;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--no-color") { opt.color = false; continue; }
+        if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+        std::string value(argv[++i]);
+        if (arg == "--bag") opt.bags.push_back(value);
+        else if (arg == "--cameras") opt.cameras = std::stoi(value);
+        else if (arg == "--width") opt.width = std::stoi(value);
+        else if (arg == "--height") opt.height = std::stoi(value);
+        else if (arg == "--fps") opt.fps = std::stoi(value);
+        else if (arg == "--seconds") opt.seconds = std::stod(value);
+        else if (arg == "--writers") opt.writers = std::stoul(value);
+        else if (arg == "--queue") opt.queue = std::stoul(value);
+        else if (arg == "--policy") { if (!parse_backpressure_policy(value, opt.policy)) throw invalid_value(arg, value); }
+        else if (arg == "--depth-codec") opt.depth_codec = value;
+        else if (arg == "--color-codec") opt.color_codec = value;
+        else if (arg == "--keyframe-interval") opt.keyframe_interval = std::stoi(value);
+        else if (arg == "--shm") opt.shm = value;
+        else if (arg == "--filters") opt.filters = value;
+        else if (arg == "--filter-threads") opt.filter_threads = std::stoul(value);
+        else if (arg == "--io") { if (!parse_io_backend(value, opt.io.backend)) throw invalid_value(arg, value); }
+        else if (arg == "--capture-policy") opt.capture_policy = value;
+        else if (arg == "--out") opt.out = value;
+        else if (arg == "--json") opt.json = value;
+        else if (arg == "--trace") opt.trace = value;
+        else throw std::runtime_error("Unknown argument " + arg);
+    }
+    if (!opt.out.empty() && opt.out.back() != '/' && opt.out.back() != '\\')
+        opt.out += '/';
+    return opt;
+}
+
+int main(int argc, char * argv[]) try
+{
+    auto opt = parse_options(argc, argv);
+
+    rs2::context ctx;
+    std::vector<std::unique_ptr<synthetic_camera>> cameras;
+    if (opt.bags.empty())
+    {
+        for (int i = 0; i < opt.cameras; i++)
+            cameras.emplace_back(new synthetic_camera(ctx, i, opt));
+    }
+
+    uint64_t captured = 0, produced = 0;
+    std::map<std::string, std::shared_ptr<writer_stats>> stats;
+    std::map<std::string, std::vector<rs2::stream_profile>> streams;
+    double seconds = 0;
+    std::string stages_text, stages_json;
+    {
+        device_container container(opt.writers, opt.queue, opt.policy);
+        container.use_context(ctx);
+        container.set_output(opt.out, false);
+        container.set_encoders(opt.depth_codec, opt.color_codec, opt.keyframe_interval);
+        container.set_io(opt.io);
+        if (!opt.filters.empty())
+            container.enable_filters(opt.filters, opt.filter_threads);
+        if (!opt.shm.empty())
+            container.enable_shm_publisher(opt.shm, 8, size_t(opt.width) * opt.height * 3);
+        if (!opt.capture_policy.empty())
+            container.set_capture_policy(capture_policy::load(opt.capture_policy));
+        if (!opt.trace.empty())
+            container.enable_trace(1 << 16);
+
+        for (auto&& bag : opt.bags)
+            container.enable_playback(bag);
+        for (auto&& cam : cameras)
+            container.enable_device(cam->device());
+        if (!container.wait_for_devices())
+            throw std::runtime_error("Timed out starting the devices");
+        streams = container.active_streams();
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto&& cam : cameras)
+            cam->start();
+        std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+        for (auto&& cam : cameras)
+        {
+            cam->stop();
+            produced += cam->produced();
+        }
+        container.flush();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        captured = container.frames_captured();
+        stats = container.writer_statistics();
+        stages_text = container.profiler().report_text() + container.filter_report();
+        stages_json = container.profiler().report_json();
+        if (!opt.trace.empty() && !container.write_trace(opt.trace))
+            throw std::runtime_error("Failed to create " + opt.trace);
+    } // stops capture and drains the writers
+
+    uint64_t enqueued = 0, written = 0, dropped = 0, failed = 0, bytes = 0;
+    latency_histogram latency;
+    for (auto&& s : stats)
+    {
+        enqueued += s.second->enqueued;
+        written += s.second->written;
+        dropped += s.second->dropped;
+        failed += s.second->failed;
+        bytes += s.second->bytes_written;
+        latency.merge(s.second->latency_ms);
+    }
+    // Synthetic frames that never reached the capture threads were dropped by librealsense
+    uint64_t lost_before_capture = produced > captured ? produced - captured : 0;
+
+    // What was actually streamed: a recording's own profiles, not the synthetic settings
+    std::string streams_text;
+    for (auto&& dev : streams)
+    {
+        for (auto&& profile : dev.second)
+        {
+            char line[160];
+            auto vp = profile.as<rs2::video_stream_profile>();
+            if (vp)
+                snprintf(line, sizeof(line), "sn %s %s %dx%d @ %d fps %s", dev.first.c_str(), profile.stream_name().c_str(),
+                    vp.width(), vp.height(), profile.fps(), rs2_format_to_string(profile.format()));
+            else
+                snprintf(line, sizeof(line), "sn %s %s @ %d fps %s", dev.first.c_str(), profile.stream_name().c_str(),
+                    profile.fps(), rs2_format_to_string(profile.format()));
+            streams_text += streams_text.empty() ? line : std::string(", ") + line;
+        }
+    }
+
+    printf("source: %s\n", opt.bags.empty() ? "synthetic" : "bag");
+    printf("streams: %zu devices, %.1f s: %s\n", streams.size(), seconds, streams_text.c_str());
+    printf("frames: produced=%llu captured=%llu enqueued=%llu written=%llu dropped=%llu failed=%llu lost before capture=%llu\n",
+        (unsigned long long)produced, (unsigned long long)captured, (unsigned long long)enqueued, (unsigned long long)written,
+        (unsigned long long)dropped, (unsigned long long)failed, (unsigned long long)lost_before_capture);
+    printf("throughput: %.1f frames/s written, %.1f MB/s\n", written / seconds, bytes / seconds / 1048576.);
+    printf("latency ms: p50=%.2f p90=%.2f p99=%.2f max=%.2f\n", latency.percentile(50), latency.percentile(90),
+        latency.percentile(99), latency.percentile(100));
+    printf("%s", stages_text.c_str());
+
+    if (!opt.json.empty())
+    {
+        std::unique_ptr<FILE, int(*)(FILE*)> json(fopen(opt.json.c_str(), "w"), fclose);
+        if (!json)
+            throw std::runtime_error("Failed to create " + opt.json);
+        fprintf(json.get(),
+            "{\"source\": \"%s\", \"devices\": %zu, \"streams\": \"%s\",\n"
+            " \"writers\": %zu, \"queue\": %zu, \"depth_codec\": \"%s\", \"color_codec\": \"%s\", \"io\": \"%s\", \"seconds\": %.3f,\n"
+            " \"produced\": %llu, \"captured\": %llu, \"enqueued\": %llu, \"written\": %llu, \"dropped\": %llu,"
+            " \"failed\": %llu, \"lost_before_capture\": %llu, \"bytes_written\": %llu,\n"
+            " \"frames_per_second\": %.2f, \"mb_per_second\": %.2f,\n"
+            " \"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n"
+            " \"stages\": %s}\n",
+            opt.bags.empty() ? "synthetic" : "bag", streams.size(), stage_profiler::json_escape(streams_text).c_str(),
+            opt.writers, opt.queue, stage_profiler::json_escape(opt.depth_codec).c_str(),
+            stage_profiler::json_escape(opt.color_codec).c_str(), io_backend_name(opt.io.backend), seconds,
+            (unsigned long long)produced, (unsigned long long)captured, (unsigned long long)enqueued,
+            (unsigned long long)written, (unsigned long long)dropped, (unsigned long long)failed,
+            (unsigned long long)lost_before_capture, (unsigned long long)bytes, written / seconds, bytes / seconds / 1048576.,
+            latency.percentile(50), latency.percentile(90), latency.percentile(99), latency.percentile(100),
+            stages_json.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error & e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,213 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shm_ring.hpp"
+
+// Shared-Memory Ring Benchmark publishes synthetic Z16 frames through shm_ring.hpp to
+// subscriber processes forked from it, as analytics processes on the same host would
+// read them. Each subscriber reads every frame in place (a checksum over all pixels) and
+// reports frames/s, MB/s, publish-to-receive latency percentiles and frames it lost to
+// being lapped or found torn. --fps 0 publishes as fast as the copy allows.
+//
+// Usage: rs-benchmark--shm-ring-- [--subscribers <n>] [--width <w>] [--height <h>] [--fps <rate>]
+//            [--seconds <s>] [--slots <n>] [--cameras <n>]
+
+struct options
+{
+    int subscribers = 2, width = 848, height = 480, cameras = 2;
+    double fps = 30, seconds = 5;
+    int slots = 8;
+};
+
+struct subscriber_result
+{
+    uint64_t received, lost, torn, bytes, checksum;
+    double seconds, p50_us, p99_us, max_us;
+};
+
+// Runs in the child process; the result goes back over `out`
+subscriber_result subscribe(const std::string& name, int ready)
+{
+    shm_frame_subscriber sub(name);
+    char c = 1;
+    if (write(ready, &c, 1) != 1)
+        throw std::runtime_error("Failed to signal readiness");
+
+    std::vector<double> latency_us;
+    uint64_t bytes = 0, checksum = 0;
+    std::chrono::steady_clock::time_point first, last;
+    shm_frame f;
+    while (sub.wait_next(f, std::chrono::milliseconds(2000)))
+    {
+        uint64_t now = shm_clock_ns();
+        if (latency_us.empty())
+            first = std::chrono::steady_clock::now();
+        // Stand-in for analytics: read every pixel where it lies
+        auto pixels = reinterpret_cast<const uint16_t*>(f.data);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < f.header->data_size / 2; i++)
+            sum += pixels[i];
+        if (!sub.valid(f))
+        {
+            // Overwritten while we read it; a real consumer would drop its result
+            continue;
+        }
+        checksum += sum;
+        bytes += f.header->data_size;
+        latency_us.push_back((now - f.header->publish_ns) / 1000.);
+        last = std::chrono::steady_clock::now();
+    }
+
+    subscriber_result r{};
+    r.received = latency_us.size();
+    r.lost = sub.lost();
+    r.torn = sub.received() - latency_us.size();
+    r.bytes = bytes;
+    r.seconds = std::chrono::duration<double>(last - first).count();
+    if (!latency_us.empty())
+    {
+        std::sort(latency_us.begin(), latency_us.end());
+        r.p50_us = latency_us[latency_us.size() / 2];
+        r.p99_us = latency_us[std::min(latency_us.size() - 1, latency_us.size() * 99 / 100)];
+        r.max_us = latency_us.back();
+    }
+    r.checksum = checksum;
+    return r;
+}
+
+int main(int argc, char * argv[]) try
+{
+    options opt;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--subscribers") opt.subscribers = std::max(1, std::stoi(argv[i + 1]));
+        else if (arg == "--width") opt.width = std::stoi(argv[i + 1]);
+        else if (arg == "--height") opt.height = std::stoi(argv[i + 1]);
+        else if (arg == "--fps") opt.fps = std::stod(argv[i + 1]);
+        else if (arg == "--seconds") opt.seconds = std::stod(argv[i + 1]);
+        else if (arg == "--slots") opt.slots = std::stoi(argv[i + 1]);
+        else if (arg == "--cameras") opt.cameras = std::max(1, std::stoi(argv[i + 1]));
+        else throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    const std::string name = "/rs-benchmark-shm-" + std::to_string(getpid());
+    const size_t frame_bytes = size_t(opt.width) * opt.height * 2;
+    std::vector<pid_t> children;
+    std::vector<int> results;
+    uint64_t published = 0;
+    double publish_us = 0;
+    {
+        shm_frame_publisher publisher(name, uint32_t(opt.slots), frame_bytes);
+
+        int ready[2];
+        if (pipe(ready) != 0)
+            throw std::runtime_error("pipe failed");
+        for (int i = 0; i < opt.subscribers; i++)
+        {
+            int out[2];
+            if (pipe(out) != 0)
+                throw std::runtime_error("pipe failed");
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                // Child: no destructors of the parent's objects may run here
+                int code = 0;
+                try
+                {
+                    auto r = subscribe(name, ready[1]);
+                    code = write(out[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1;
+                }
+                catch (const std::exception& e)
+                {
+                    fprintf(stderr, "subscriber: %s\n", e.what());
+                    code = 1;
+                }
+                _exit(code);
+            }
+            close(out[1]);
+            children.push_back(pid);
+            results.push_back(out[0]);
+        }
+        for (int i = 0; i < opt.subscribers; i++)
+        {
+            char c;
+            if (read(ready[0], &c, 1) != 1)
+                throw std::runtime_error("A subscriber failed to start");
+        }
+
+        // One synthetic frame per camera, re-published with new numbers
+        std::vector<std::vector<uint16_t>> frames(opt.cameras, std::vector<uint16_t>(frame_bytes / 2));
+        for (int c = 0; c < opt.cameras; c++)
+            for (size_t i = 0; i < frames[c].size(); i++)
+                frames[c][i] = uint16_t(1000 + c * 100 + i % 640);
+
+        auto start = std::chrono::steady_clock::now();
+        auto period = std::chrono::duration<double>(opt.fps > 0 ? 1. / opt.fps : 0);
+        for (uint64_t n = 0; std::chrono::steady_clock::now() - start < std::chrono::duration<double>(opt.seconds); n++)
+        {
+            for (int c = 0; c < opt.cameras; c++)
+            {
+                shm_frame_header h{};
+                snprintf(h.serial, sizeof(h.serial), "sw-%d", 1000 + c);
+                h.stream = 1; // RS2_STREAM_DEPTH
+                h.format = 1; // RS2_FORMAT_Z16
+                h.width = opt.width;
+                h.height = opt.height;
+                h.bytes_per_pixel = 2;
+                h.stride = opt.width * 2;
+                h.frame_number = h.frame_counter = int64_t(n);
+                auto t0 = shm_clock_ns();
+                publisher.publish(h, frames[c].data(), frame_bytes);
+                publish_us += (shm_clock_ns() - t0) / 1000.;
+                published++;
+            }
+            if (opt.fps > 0)
+                std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(period * double(n + 1)));
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("published %llu frames of %dx%d Z16 from %d cameras in %.2fs: %.0f frames/s, %.0f MB/s, %.1f us per publish\n",
+            (unsigned long long)published, opt.width, opt.height, opt.cameras, seconds, published / seconds,
+            published * frame_bytes / seconds / 1048576., publish_us / std::max<uint64_t>(1, published));
+        // Going out of scope marks the ring closed, which ends the subscribers
+    }
+
+    printf("%-12s %10s %8s %8s %10s %10s %10s %10s %10s\n", "subscriber", "received", "lost", "torn",
+        "frames/s", "MB/s", "p50 us", "p99 us", "max us");
+    bool ok = true;
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        subscriber_result r{};
+        bool got = read(results[i], &r, sizeof(r)) == sizeof(r);
+        int status = 0;
+        waitpid(children[i], &status, 0);
+        close(results[i]);
+        if (!got || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("%-12zu failed\n", i);
+            ok = false;
+            continue;
+        }
+        double s = std::max(r.seconds, 1e-9);
+        printf("%-12zu %10llu %8llu %8llu %10.0f %10.0f %10.1f %10.1f %10.1f\n", i, (unsigned long long)r.received,
+            (unsigned long long)r.lost, (unsigned long long)r.torn, r.received / s, r.bytes / s / 1048576.,
+            r.p50_us, r.p99_us, r.max_us);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,114 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stage_profiler.hpp"
+
+// Stage Profiler Benchmark measures what one stage_timer costs on the capture path: a
+// scope with nothing in it, timed with and without the frame's age, on 1..N threads
+// recording into the same profiler (each into its own slot), and on a thread that
+// alternates between two profilers. It then puts the cost per frame in terms of the
+// capture load: cameras x fps x timers per frame, as a share of one core.
+//
+// Usage: rs-benchmark--stage-profiler-- [--iterations <n>] [--threads <n>] [--cameras <n>]
+//            [--fps <rate>] [--timers-per-frame <n>]
+
+struct options
+{
+    uint64_t iterations = 10000000;
+    int threads = 4, cameras = 4;
+    double fps = 90;
+    int timers_per_frame = 12;  // about what device_container records per frame of a depth + color camera
+};
+
+// CPU ns per timer over `iterations` scopes on each of `threads` threads: the wall time
+// times the cores kept busy, so threads sharing a core are not counted twice
+double time_timers(stage_profiler& profiler, const options& opt, int threads, bool with_age)
+{
+    std::atomic<int> ready{ 0 };
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+        pool.emplace_back([&, t]()
+        {
+            int channel = profiler.channel("sw-" + std::to_string(1000 + t), "Depth");
+            double arrival_ms = with_age ? host_time_ms() : 0;
+            { stage_timer warm(profiler, channel, pipeline_stage::metadata); } // registers the thread's slot
+            ready++;
+            while (!go) std::this_thread::yield();
+            for (uint64_t i = 0; i < opt.iterations; i++)
+            {
+                stage_timer timer(profiler, channel, pipeline_stage::metadata, arrival_ms);
+            }
+        });
+    }
+    while (ready < threads) std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto&& t : pool)
+        t.join();
+    double wall_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    int cores = std::min(threads, int(std::max(1u, std::thread::hardware_concurrency())));
+    return wall_ns * cores / (double(opt.iterations) * threads);
+}
+
+// ns per timer when every other scope records into a second profiler
+double time_alternating(const options& opt)
+{
+    stage_profiler a, b;
+    int ca = a.channel("sw-1000", "Depth"), cb = b.channel("sw-1000", "Depth");
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < opt.iterations; i++)
+    {
+        stage_timer timer(i % 2 ? a : b, i % 2 ? ca : cb, pipeline_stage::metadata);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / opt.iterations;
+}
+
+int main(int argc, char * argv[]) try
+{
+    options opt;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+        std::string value(argv[++i]);
+        if (arg == "--iterations") opt.iterations = std::max(1ull, std::stoull(value));
+        else if (arg == "--threads") opt.threads = std::max(1, std::stoi(value));
+        else if (arg == "--cameras") opt.cameras = std::max(1, std::stoi(value));
+        else if (arg == "--fps") opt.fps = std::stod(value);
+        else if (arg == "--timers-per-frame") opt.timers_per_frame = std::max(1, std::stoi(value));
+        else throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    printf("%-10s %12s %12s   (CPU ns per timer)\n", "threads", "plain", "with age");
+    double worst = 0;
+    for (int threads = 1; threads <= opt.threads; threads *= 2)
+    {
+        stage_profiler profiler;
+        double plain = time_timers(profiler, opt, threads, false);
+        double aged = time_timers(profiler, opt, threads, true);
+        worst = std::max(worst, aged);
+        printf("%-10d %12.1f %12.1f\n", threads, plain, aged);
+    }
+    printf("alternating between two profilers: %.1f ns/timer\n", time_alternating(opt));
+
+    double timers_per_second = opt.cameras * opt.fps * opt.timers_per_frame;
+    printf("%d cameras x %.0f fps x %d timers per frame at %.1f ns: %.4f%% of one core\n", opt.cameras, opt.fps,
+        opt.timers_per_frame, worst, timers_per_second * worst * 1e-9 * 100.);
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -7,6 +7,10 @@
 //---add windows.h---
 #include "windows.h"
 
+#include "frame_display.hpp"    // Headless mode and rate-capped display
+#include "depth_preview.hpp"    // LUT depth colorizer and ROI statistics
+#include "roi_manager.hpp"      // Verified, parallel AE ROI configuration
+
 
 
 // Capture Example demonstrates how to
@@ -14,13 +18,11 @@
 int main(int argc, char * argv[]) try
 {
     rs2::log_to_console(RS2_LOG_SEVERITY_ERROR);
-    // Create a simple OpenGL window for rendering:
-    window app(1280, 720, "RealSense Capture Example");
-    // Declare two textures on the GPU, one for color and one for depth
-    texture depth_image, color_image;
-
-    // Declare depth colorizer for pretty visualization of depth data
-    rs2::colorizer color_map;
+    // --headless to capture without a window, --display-fps <rate> to cap redraws
+    display_options display = parse_display_options(argc, argv);
+    // Declare a texture on the GPU for color, and a depth view that colorizes with the project LUT kernel
+    texture color_image;
+    depth_preview depth_image;
 
 	// Declare RealSense pipeline, encapsulating the actual device and sensors
 	rs2::context ctx;
@@ -29,56 +31,72 @@ int main(int argc, char * argv[]) try
 	pipe.start();
 
 	//------------------------Start of set AE roi for RGB and Stereo----------------------
-	//set roi value for x,y axis in pixel map. Below is just an example for 10% center ROI.
-	int xs = 0 , xe = 640 * 0.55, ys = 0, ye = 480 * 0.55;
-	rs2::region_of_interest roi{};
-	roi.min_x = static_cast<int>(xs);
-	roi.max_x = static_cast<int>(xe);
-	roi.min_y = static_cast<int>(ys);
-	roi.max_y = static_cast<int>(ye);
-	//init roi2 to check result
-	auto sensors = ctx.query_all_sensors();
-	for (auto sensor = sensors.rbegin(); sensor != sensors.rend(); ++sensor) {
-
-		//// if depth need AE ROI feature enabled, uncomment below block of code
-		//if (sensor->is<rs2::depth_stereo_sensor>()) {
-		//	std::cout << "stereo sensor" << std::endl;
-		//	continue;
-		//}
-
-		std::this_thread::sleep_for(std::chrono::milliseconds(200));
-
-		if (sensor->is<rs2::roi_sensor>()) {
-			try {
-				//set AE roi to sensor firmware
-				sensor->as<rs2::roi_sensor>().set_region_of_interest(roi);
-				//get roi info from sensor to check if set AE roi succeed
-			}
-			catch (std::exception& e) {
-				std::cerr << e.what() << std::endl;
-			}
-		}
-
-	}
+	//roi as a fraction of each stream's resolution. Below is just an example for the top-left 55% of the image.
+	roi_fraction roi{ 0.f, 0.f, 0.55f, 0.55f };
+	//set it on every roi sensor of the device the pipeline streams from, in parallel, verifying each by reading it back
+	//(pass include_depth = false if depth does not need the AE ROI feature)
+	roi_manager rois({ pipe.get_active_profile().get_device() });
+	roi_manager::print(rois.apply(roi));
+	//--sweep moves the roi across the image once a second while capturing, without stalling it
+	bool sweep = argc > 1 && std::string(argv[1]) == "--sweep";
+	auto last_move = std::chrono::steady_clock::now();
+	std::atomic<float> roi_shift{ 0.f }; //written by capture, read by the display
+	auto shifted = [&]() { return roi_fraction{ roi.min_x + roi_shift, roi.min_y, roi.max_x + roi_shift, roi.max_y }; };
 	//-------------------------End of set AE roi for RGB and Stereo-----------------------
 
 
-    while(app) // Application still alive?
+    // Capture runs on its own thread at the camera rate; the window only picks up the
+    // newest frameset when it redraws, and colorizes just that one
+    latest_frameset latest;
+    capture_thread capture([&]()
     {
-        rs2::frameset data = pipe.wait_for_frames(); // Wait for next set of frames from the camera
-
-        rs2::frame depth = color_map.process(data.get_depth_frame()); // Find and colorize the depth data
-        rs2::frame color = data.get_color_frame();            // Find the color data
+        rs2::frameset data;
+        if (pipe.try_wait_for_frames(&data, 100)) // Wait for next set of frames from the camera
+        {
+			if (sweep && std::chrono::steady_clock::now() - last_move > std::chrono::seconds(1))
+			{
+				roi_shift = roi_shift + 0.1f > 1.f - roi.max_x ? 0.f : roi_shift + 0.1f;
+				rois.request(shifted());
+				last_move = std::chrono::steady_clock::now();
+			}
+            latest.publish(data);
+        }
+    });
 
+    if (display.headless)
+    {
+        wait_for_interrupt([&]() { return capture.running(); });
+        capture.stop();
+        return EXIT_SUCCESS;
+    }
 
-        // For cameras that don't have RGB sensor, we'll render infrared frames instead of color
-        if (!color)
-            color = data.get_infrared_frame();
+    // Create a simple OpenGL window for rendering:
+    window app(1280, 720, "RealSense Capture Example");
+    rate_limiter redraw(display.fps);
+    rs2::frame color;
+    while(app && capture.running()) // Application still alive?
+    {
+        rs2::frameset data;
+        if (latest.take(data))
+        {
+            auto depth = data.get_depth_frame();
+            auto depth_area = roi_pixels(shifted(), depth ? depth.get_width() : 0, depth ? depth.get_height() : 0);
+            depth_roi stats_roi{ depth_area.min_x, depth_area.min_y, depth_area.max_x, depth_area.max_y };
+            depth_image.update(depth, &stats_roi);             // Colorize the depth data, statistics inside the AE ROI
+            color = data.get_color_frame();                    // Find the color data
+
+            // For cameras that don't have RGB sensor, we'll render infrared frames instead of color
+            if (!color)
+                color = data.get_infrared_frame();
+        }
 
         // Render depth on to the first half of the screen and color on to the second
-        depth_image.render(depth, { 0,               0, app.width() / 2, app.height() });
-        color_image.render(color, { app.width() / 2, 0, app.width() / 2, app.height() });
+        depth_image.show({ 0,               0, app.width() / 2, app.height() });
+        depth_image.show_stats({ 0, 0, app.width() / 2, app.height() });
+        if (color) color_image.render(color, { app.width() / 2, 0, app.width() / 2, app.height() });
+        redraw.wait();
     }
+    capture.stop();
 
     return EXIT_SUCCESS;
 }
@@ -8,55 +8,85 @@
 #include <librealsense2/rs_advanced_mode.hpp>
 #include <fstream>
 
+#include "frame_ring.hpp"       // Memory-bounded ring of kept frames
+#include "frame_display.hpp"    // Headless mode and rate-capped display
+#include "depth_preview.hpp"    // LUT depth colorizer and ROI statistics
+
 
 // Capture Example demonstrates how to
 // capture depth and color video streams and render them to the screen
 int main(int argc, char * argv[]) try
 {
     rs2::log_to_console(RS2_LOG_SEVERITY_ERROR);
-    // Create a simple OpenGL window for rendering:
-    window app(1280, 720, "RealSense Capture Example");
-    // Declare two textures on the GPU, one for color and one for depth
-    texture depth_image, color_image;
-
-    // Declare depth colorizer for pretty visualization of depth data
-    rs2::colorizer color_map;
+    // --headless to capture without a window, --display-fps <rate> to cap redraws
+    display_options display = parse_display_options(argc, argv);
+    // Declare a texture on the GPU for color, and a depth view that colorizes with the project LUT kernel
+    texture color_image;
+    depth_preview depth_image;
 
 	//Declare RealSense pipeline
 	rs2::pipeline pipe;
 
 	//------------keep frames start---------------
-	std::vector<rs2::frameset> list;
-
+	// Keep the most recent depth frames within a fixed memory budget (default 512 MB)
+	size_t retain_mb = argc > 1 ? std::stoul(argv[1]) : 512;
+	frame_retention retained(retain_mb << 20);
+	auto last_report = std::chrono::steady_clock::now();
 	//------------keep frames end---------------
 
     // Start streaming with default recommended configuration
     pipe.start();
 
-    while(app) // Application still alive?
+    // Capture runs on its own thread at the camera rate; the window only picks up the
+    // newest frameset when it redraws, and colorizes just that one
+    latest_frameset latest;
+    capture_thread capture([&]()
     {
-        rs2::frameset data = pipe.wait_for_frames(); // Wait for next set of frames from the camera
-
-        rs2::frame depth = color_map.process(data.get_depth_frame()); // Find and colorize the depth data
-        rs2::frame color = data.get_color_frame();            // Find the color data
-
-        // For cameras that don't have RGB sensor, we'll render infrared frames instead of color
-        if (!color)
-            color = data.get_infrared_frame();
-
-		//------------keep frames start---------------
-		auto raw_data = data.get_depth_frame();
-		raw_data.keep();
-		list.push_back(raw_data);
-		std::_Count_pr << list.size << std::endl;
-		//------------keep frames end---------------
+        rs2::frameset data;
+        if (pipe.try_wait_for_frames(&data, 100)) // Wait for next set of frames from the camera
+        {
+			//------------keep frames start---------------
+			retained.push("default", data.get_depth_frame());
+			if (std::chrono::steady_clock::now() - last_report > std::chrono::seconds(1))
+			{
+				retained.print_report();
+				last_report = std::chrono::steady_clock::now();
+			}
+			//------------keep frames end---------------
+            latest.publish(data);
+        }
+    });
+
+    if (display.headless)
+    {
+        wait_for_interrupt([&]() { return capture.running(); });
+        capture.stop();
+        return EXIT_SUCCESS;
+    }
 
+    // Create a simple OpenGL window for rendering:
+    window app(1280, 720, "RealSense Capture Example");
+    rate_limiter redraw(display.fps);
+    rs2::frame color;
+    while(app && capture.running()) // Application still alive?
+    {
+        rs2::frameset data;
+        if (latest.take(data))
+        {
+            depth_image.update(data.get_depth_frame());          // Find and colorize the depth data
+            color = data.get_color_frame();                    // Find the color data
 
+            // For cameras that don't have RGB sensor, we'll render infrared frames instead of color
+            if (!color)
+                color = data.get_infrared_frame();
+        }
 
         // Render depth on to the first half of the screen and color on to the second
-        depth_image.render(depth, { 0,               0, app.width() / 2, app.height() });
-        color_image.render(color, { app.width() / 2, 0, app.width() / 2, app.height() });
+        depth_image.show({ 0,               0, app.width() / 2, app.height() });
+        if (color) color_image.render(color, { app.width() / 2, 0, app.width() / 2, app.height() });
+        redraw.wait();
     }
+    capture.stop();
 
     return EXIT_SUCCESS;
 }
@@ -8,19 +8,23 @@
 #include <librealsense2/rs_advanced_mode.hpp>
 #include <fstream>
 
+#include "frame_display.hpp"    // Headless mode and rate-capped display
+#include "depth_preview.hpp"    // LUT depth colorizer and ROI statistics
+#include "preset_config.hpp"    // Cached presets applied to all devices concurrently
+
 
 // Capture Example demonstrates how to
 // capture depth and color video streams and render them to the screen
+//
+// Usage: rs-capture--load-preset-json-- [preset.json]
 int main(int argc, char * argv[]) try
 {
     rs2::log_to_console(RS2_LOG_SEVERITY_ERROR);
-    // Create a simple OpenGL window for rendering:
-    window app(1280, 720, "RealSense Capture Example");
-    // Declare two textures on the GPU, one for color and one for depth
-    texture depth_image, color_image;
-
-    // Declare depth colorizer for pretty visualization of depth data
-    rs2::colorizer color_map;
+    // --headless to capture without a window, --display-fps <rate> to cap redraws
+    display_options display = parse_display_options(argc, argv);
+    // Declare a texture on the GPU for color, and a depth view that colorizes with the project LUT kernel
+    texture color_image;
+    depth_preview depth_image;
 
 
 	//------------load preset json start---------------
@@ -33,38 +37,62 @@ int main(int argc, char * argv[]) try
 		std::cout << "No device detected. Is it plugged in?\n";
 		return EXIT_SUCCESS;
 	}
-	auto dev = devices[0];
-	//read json file
-	std::ifstream file("C:\\2AndersShortNew.json");
-	std::string json_content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-	//enable advance mode & load json
-	if (dev.is<rs400::advanced_mode>())
-	{
-		auto advanced_mode_dev = dev.as<rs400::advanced_mode>();
-		if (!advanced_mode_dev.is_enabled())
-			advanced_mode_dev.toggle_advanced_mode(true);
-		advanced_mode_dev.load_json(json_content);
-	}
+	//read, validate and cache the preset once, then configure every connected device at once;
+	//devices already running this preset are left alone
+	std::string preset_path = argc > 1 ? argv[1] : "C:\\2AndersShortNew.json";
+	preset_cache presets;
+	auto preset = presets.load(preset_path);
+	auto start = std::chrono::steady_clock::now();
+	auto reports = apply_preset_to_all(ctx, *preset);
+	print_preset_reports(*preset, reports,
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
 	//------------load preset json end---------------
 
     // Start streaming with default recommended configuration
     pipe.start();
 
-    while(app) // Application still alive?
+    // Capture runs on its own thread at the camera rate; the window only picks up the
+    // newest frameset when it redraws, and colorizes just that one
+    latest_frameset latest;
+    capture_thread capture([&]()
     {
-        rs2::frameset data = pipe.wait_for_frames(); // Wait for next set of frames from the camera
+        rs2::frameset data;
+        if (pipe.try_wait_for_frames(&data, 100)) // Wait for next set of frames from the camera
+        {
+            latest.publish(data);
+        }
+    });
 
-        rs2::frame depth = color_map.process(data.get_depth_frame()); // Find and colorize the depth data
-        rs2::frame color = data.get_color_frame();            // Find the color data
+    if (display.headless)
+    {
+        wait_for_interrupt([&]() { return capture.running(); });
+        capture.stop();
+        return EXIT_SUCCESS;
+    }
+
+    // Create a simple OpenGL window for rendering:
+    window app(1280, 720, "RealSense Capture Example");
+    rate_limiter redraw(display.fps);
+    rs2::frame color;
+    while(app && capture.running()) // Application still alive?
+    {
+        rs2::frameset data;
+        if (latest.take(data))
+        {
+            depth_image.update(data.get_depth_frame());          // Find and colorize the depth data
+            color = data.get_color_frame();                    // Find the color data
 
-        // For cameras that don't have RGB sensor, we'll render infrared frames instead of color
-        if (!color)
-            color = data.get_infrared_frame();
+            // For cameras that don't have RGB sensor, we'll render infrared frames instead of color
+            if (!color)
+                color = data.get_infrared_frame();
+        }
 
         // Render depth on to the first half of the screen and color on to the second
-        depth_image.render(depth, { 0,               0, app.width() / 2, app.height() });
-        color_image.render(color, { app.width() / 2, 0, app.width() / 2, app.height() });
+        depth_image.show({ 0,               0, app.width() / 2, app.height() });
+        if (color) color_image.render(color, { app.width() / 2, 0, app.width() / 2, app.height() });
+        redraw.wait();
     }
+    capture.stop();
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,163 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_index.hpp"
+
+// Frame Index Example indexes capture directories full of fc<cnt>_ts<ts>_sn<serial>_<stream>
+// files once, then finds and reads frames without listing the directories again.
+//
+//   build   scans <dir> (and its subdirectories) on a thread pool and writes the index,
+//           by default <dir>/frames.rsfidx; an existing index is reused for unchanged files
+//   query   prints the matching frames: path, counter, timestamp, dimensions and where the
+//           dimensions came from (raw files have no header; see frame_index.hpp)
+//   streams prints every serial / stream with its frame count, timestamp range, counter gaps
+//   replay  reads the matching frames in order through mmap with read-ahead, and reports
+//           frames/s and MB/s
+//
+// Usage: rs-frame-index--query-- build <dir> [--index <file>] [--threads <n>]
+//        rs-frame-index--query-- query|replay <index> [--serial <sn>] [--stream <name>]
+//            [--from <ts>] [--to <ts>] [--tag <prefix>] [--read-ahead <files>]
+//        rs-frame-index--query-- streams <index>
+
+int usage(const char* self)
+{
+    std::cout << "Usage: " << self << " build <dir> [--index <file>] [--threads <n>]\n"
+              << "       " << self << " query|replay <index> [--serial <sn>] [--stream <name>] [--from <ts>] [--to <ts>]\n"
+              << "           [--tag <prefix>] [--read-ahead <files>]\n"
+              << "       " << self << " streams <index>\n";
+    return EXIT_SUCCESS;
+}
+
+int build(const std::string& dir, const std::string& index_path, size_t threads)
+{
+    std::unique_ptr<frame_index> previous;
+    try
+    {
+        previous.reset(new frame_index(index_path));
+    }
+    catch (const std::exception&)
+    {
+        // No usable index yet: every file is opened
+    }
+    auto stats = build_frame_index(dir, index_path, threads, previous.get());
+    previous.reset();
+
+    printf("indexed %llu frames (%.1f GB) in %llu directories in %.2fs, %llu reused, %llu other files\n",
+        (unsigned long long)stats.files, stats.bytes / 1073741824., (unsigned long long)stats.directories, stats.seconds,
+        (unsigned long long)stats.reused, (unsigned long long)stats.ignored);
+    printf("dimensions:");
+    for (size_t i = 0; i < size_t(frame_dims_source::count); i++)
+        printf(" %s=%llu", frame_dims_source_name(frame_dims_source(i)), (unsigned long long)stats.dims[i]);
+    printf("\nwritten to %s\n", index_path.c_str());
+    return EXIT_SUCCESS;
+}
+
+int streams(const frame_index& index)
+{
+    printf("%-20s %-12s %10s %20s %20s %10s\n", "serial", "stream", "frames", "first ts", "last ts", "missing");
+    for (auto&& s : index.streams())
+    {
+        // Frames the counter skipped; the tagged copies (filtered_, ev<n>_) are counted by their own runs
+        std::map<uint32_t, std::vector<int64_t>> counters;
+        for (auto r = s.first; r != s.second; r++)
+            counters[r->tag].push_back(r->frame_counter);
+        uint64_t missing = 0;
+        for (auto&& c : counters)
+        {
+            std::sort(c.second.begin(), c.second.end());
+            for (size_t i = 1; i < c.second.size(); i++)
+                missing += c.second[i] > c.second[i - 1] + 1 ? uint64_t(c.second[i] - c.second[i - 1] - 1) : 0;
+        }
+        printf("%-20s %-12s %10zu %20lld %20lld %10llu\n", index.string(s.first->serial).c_str(),
+            index.string(s.first->stream).c_str(), size_t(s.second - s.first), (long long)s.first->timestamp,
+            (long long)(s.second - 1)->timestamp, (unsigned long long)missing);
+    }
+    return EXIT_SUCCESS;
+}
+
+int query(const frame_index& index, const frame_query& q)
+{
+    auto frames = index.select(q);
+    for (auto r : frames)
+    {
+        printf("%s fc=%lld ts=%lld %ux%ux%u (%s) %llu bytes\n", index.path(*r).c_str(), (long long)r->frame_counter,
+            (long long)r->timestamp, r->width, r->height, r->bytes_per_pixel, frame_dims_source_name(frame_dims_source(r->dims)),
+            (unsigned long long)r->size);
+    }
+    printf("%zu frames\n", frames.size());
+    return EXIT_SUCCESS;
+}
+
+int replay(const frame_index& index, const frame_query& q, size_t read_ahead)
+{
+    frame_replayer replayer(index, index.select(q), read_ahead);
+    replayed_frame f;
+    uint64_t frames = 0, bytes = 0, checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (replayer.next(f))
+    {
+        // Stand-in for a consumer: touch every byte where it lies
+        uint64_t sum = 0;
+        for (size_t i = 0; i < f.size; i++)
+            sum += f.data[i];
+        checksum += sum;
+        bytes += f.size;
+        frames++;
+    }
+    double seconds = std::max(1e-9, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    printf("replayed %llu frames in %.2fs: %.0f frames/s, %.1f MB/s (%llu missing, checksum %llx)\n",
+        (unsigned long long)frames, seconds, frames / seconds, bytes / seconds / 1048576.,
+        (unsigned long long)replayer.missing(), (unsigned long long)checksum);
+    return replayer.missing() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char * argv[]) try
+{
+    if (argc < 3)
+        return usage(argv[0]);
+    std::string command(argv[1]), target(argv[2]);
+
+    std::string index_path;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency()), read_ahead = 16;
+    frame_query q;
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        std::string arg(argv[i]), value(argv[i + 1]);
+        if (arg == "--index") index_path = value;
+        else if (arg == "--threads") threads = std::stoul(value);
+        else if (arg == "--serial") q.serial = value;
+        else if (arg == "--stream") q.stream = value;
+        else if (arg == "--from") q.from = std::stoll(value);
+        else if (arg == "--to") q.to = std::stoll(value);
+        else if (arg == "--tag") { q.any_tag = false; q.tag = value == "none" ? "" : value; }
+        else if (arg == "--read-ahead") read_ahead = std::stoul(value);
+        else throw std::runtime_error("Unknown argument " + arg);
+    }
+
+    if (command == "build")
+        return build(target, index_path.empty() ? frame_index_detail::join(target, "frames.rsfidx") : index_path, threads);
+
+    frame_index index(target);
+    if (command == "query")
+        return query(index, q);
+    if (command == "replay")
+        return replay(index, q, read_ahead);
+    if (command == "streams")
+        return streams(index);
+    return usage(argv[0]);
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,46 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+
+#include <iostream>
+#include <string>
+
+#include "metadata_log.hpp"
+
+// Metadata Log Convert Example turns a binary .mdlog written during capture into
+// a CSV table (one row per frame) and/or a columnar directory layout with one
+// packed array per metadata attribute.
+int main(int argc, char * argv[]) try
+{
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " <file.mdlog> [--csv <out.csv>] [--columns <out prefix>]\n";
+        return EXIT_SUCCESS;
+    }
+
+    metadata_log_reader reader(argv[1]);
+    std::cout << argv[1] << ": " << reader.records().size() << " frames, "
+              << reader.columns().size() << " attributes" << std::endl;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--csv") reader.to_csv(argv[i + 1]);
+        else if (arg == "--columns") reader.to_columns(argv[i + 1]);
+        else throw std::runtime_error("Unknown argument " + arg);
+        std::cout << "Wrote " << argv[i + 1] << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error & e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
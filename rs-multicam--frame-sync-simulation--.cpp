@@ -0,0 +1,91 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "frame_sync.hpp"
+
+// Frame Sync Simulation Example feeds cross_device_synchronizer with synthetic timestamp
+// streams instead of cameras: each simulated camera has its own clock offset and drift,
+// USB arrival jitter, and occasionally drops a frame. It checks that the estimated drift
+// converges and that matched groups really come from the same capture instant.
+//
+// Usage: rs-multicam--frame-sync-simulation-- [cameras] [fps] [seconds] [tolerance ms]
+
+struct simulated_camera
+{
+    std::string serial;
+    double offset_ms;   // device clock at host time 0
+    double drift_ppm;
+    double phase_ms;    // capture instant relative to the other cameras
+};
+
+int main(int argc, char * argv[]) try
+{
+    int cameras = argc > 1 ? std::stoi(argv[1]) : 4;
+    double fps = argc > 2 ? std::stod(argv[2]) : 90.;
+    double seconds = argc > 3 ? std::stod(argv[3]) : 60.;
+    double tolerance = argc > 4 ? std::stod(argv[4]) : 0.5 * 1000. / fps;
+
+    std::mt19937 rng(2017);
+    std::uniform_real_distribution<double> offset(-1e6, 1e6), drift(-50., 50.), phase(0., 0.5);
+    std::exponential_distribution<double> latency(1. / 3.);  // mean 3 ms transport delay
+    std::uniform_int_distribution<int> drop(0, 199);         // 0.5% of frames never arrive
+
+    std::vector<simulated_camera> cams;
+    for (int i = 0; i < cameras; i++)
+        cams.push_back({ "sim" + std::to_string(i), offset(rng), drift(rng), phase(rng) });
+
+    // Every group must come from one capture instant: all members share the same frame index
+    uint64_t mismatched = 0;
+    cross_device_synchronizer<int> sync(tolerance, 100., [&](uint64_t, const std::vector<cross_device_synchronizer<int>::entry>& group)
+    {
+        for (auto&& e : group)
+        {
+            if (e.payload != group.front().payload)
+                mismatched++;
+        }
+    });
+    for (auto&& cam : cams)
+        sync.add_device(cam.serial);
+
+    // Arrivals from all cameras interleave in host time, as they would in the capture threads
+    struct arrival { double host_ms; int cam; int index; double device_ms; };
+    std::vector<arrival> arrivals;
+    int frames = int(seconds * fps);
+    const double host_start = 1.5e12;
+    for (int c = 0; c < cameras; c++)
+    {
+        for (int i = 0; i < frames; i++)
+        {
+            if (drop(rng) == 0)
+                continue;
+            double capture = i * 1000. / fps + cams[c].phase_ms;
+            double device = cams[c].offset_ms + capture * (1. + cams[c].drift_ppm * 1e-6);
+            arrivals.push_back({ host_start + capture + latency(rng), c, i, device });
+        }
+    }
+    std::sort(arrivals.begin(), arrivals.end(), [](const arrival& a, const arrival& b) { return a.host_ms < b.host_ms; });
+
+    for (auto&& a : arrivals)
+        sync.add(cams[a.cam].serial, a.device_ms, a.host_ms, a.index);
+
+    sync.print_report();
+    for (auto&& cam : cams)
+        printf("true   sn: %s drift=%.1f ppm\n", cam.serial.c_str(), cam.drift_ppm);
+
+    auto st = sync.stats();
+    double match_rate = st.frames_in ? double(st.frames_matched) / st.frames_in : 0.;
+    bool ok = mismatched == 0 && match_rate > 0.95;
+    printf("mismatched=%llu match rate=%.1f%%\n%s\n", (unsigned long long)mismatched, 100. * match_rate, ok ? "PASSED" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -21,291 +21,161 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "device_container.hpp"     // Per-device capture threads and the save path
+#include "frame_display.hpp"        // Headless mode and rate-capped display
+#include "preset_config.hpp"        // Cached presets applied to all devices concurrently
+
 using namespace rs400;
 
 
 const std::string no_camera_message = "No camera connected, please connect 1 or more";
-const std::string platform_camera_name = "Platform Camera";
-
-class device_container
-{
-    // Helper struct per pipeline
-    struct view_port
-    {
-		std::string dev;
-        std::map<int, rs2::frame> frames_per_stream;
-        rs2::colorizer colorize_frame;
-        texture tex;
-        rs2::pipeline pipe;
-        rs2::pipeline_profile profile;
-    };
-
-public:
-
-    void enable_device(rs2::device dev)
-    {
-        std::string serial_number(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER));
-        std::lock_guard<std::mutex> lock(_mutex);
-
-        if (_devices.find(serial_number) != _devices.end())
-        {
-            return; //already in
-        }
-
-        // Ignoring platform cameras (webcams, etc..)
-        if (platform_camera_name == dev.get_info(RS2_CAMERA_INFO_NAME))
-        {
-            return;
-        }
-        // Create a pipeline from the given device
-        rs2::pipeline p;
-        rs2::config c;
-        c.enable_device(serial_number);
-        // Start the pipeline with the configuration
-        rs2::pipeline_profile profile = p.start(c);
-        // Hold it internally
-        _devices.emplace(serial_number, view_port{ serial_number,{},{},{}, p, profile });
-
-    }
-
-    void remove_devices(const rs2::event_information& info)
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        // Go over the list of devices and check if it was disconnected
-        auto itr = _devices.begin();
-        while(itr != _devices.end())
-        {
-            if (info.was_removed(itr->second.profile.get_device()))
-            {
-                itr = _devices.erase(itr);
-            }
-            else
-            {
-                ++itr;
-            }
-        }
-    }
 
-    size_t device_count()
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        return _devices.size();
-    }
 
-    int stream_count()
+int main(int argc, char * argv[]) try
+{
+    // Display:                     --headless --display-fps <rate>
+    display_options display = parse_display_options(argc, argv);
+
+    // Writer stage configuration: --writers <threads> --queue <frames> --policy block|drop-oldest|drop-newest
+    // Raw depth container:         --container <prefix> --segment-mb <size> --segment-seconds <duration>
+    // File output backend:         --io buffered|mmap|direct
+    // Save policy:                 --capture-policy <file.json> (streams, decimation, crop; see capture_policy.hpp)
+    // Depth retention per stream:  --retain-mb <size>
+    // Encoders:                    --depth-codec raw|rice|tdc --color-codec png|qoi|rice|raw
+    //                              --keyframe-interval <frames> (tdc)
+    // Point clouds of saved depth: --pointcloud ply|xyz [--voxel <m>] [--max-depth <m>]
+    // Cross-device sync:           --sync <tolerance ms>
+    // Depth post-processing:       --filters <chain> [--filter-threads <n>] [--filter-save both|filtered|raw]
+    //                              (chain e.g. decimation:2,spatial,temporal; see post_processing.hpp)
+    // Shared-memory publishing:    --shm <name> [--shm-slots <n>] [--shm-slot-mb <size>] (see shm_ring.hpp)
+    // Advanced-mode preset:        --preset <file.json>
+    // Event recording:             --event-pre <s> --event-post <s> [--event-near <mm> --event-fraction <0..1>]
+    //                              (events: space bar, SIGUSR1, or the depth trigger)
+    // Stream health metrics:       --health <metrics.prom> (Prometheus text, rewritten every second)
+    // Stage timing:                --profile <report.json> (rewritten every second)
+    //                              --trace <trace.json> (Chrome trace of the last spans, written on exit)
+    size_t writer_threads = 2, queue_capacity = 256;
+    backpressure_policy policy = backpressure_policy::block;
+    std::string container_prefix;
+    io_options io;
+    std::string capture_policy_path;
+    uint64_t segment_mb = 1024;
+    int segment_seconds = 0;
+    size_t retain_mb = 256;
+    std::string depth_codec = "raw", color_codec = "png";
+    int keyframe_interval = 30;
+    point_format cloud_format = point_format::ply;
+    bool pointcloud = false;
+    float voxel_m = 0, max_depth_m = 0;
+    double sync_tolerance_ms = 0;
+    std::string filter_chain, filter_save = "both";
+    size_t filter_threads = 2;
+    std::string shm_name;
+    uint32_t shm_slots = 8;
+    size_t shm_slot_mb = 4;
+    std::string preset_path;
+    double event_pre = 0, event_post = 0, event_fraction = 0.2;
+    int event_near = 0;
+    std::string profile_path, trace_path, health_path;
+    for (int i = 1; i < argc; i++)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        int count = 0;
-        for (auto&& sn_to_dev : _devices)
+        std::string arg(argv[i]);
+        if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+        std::string value(argv[++i]);
+        if (arg == "--writers") writer_threads = std::stoul(value);
+        else if (arg == "--queue") queue_capacity = std::stoul(value);
+        else if (arg == "--policy") { if (!parse_backpressure_policy(value, policy)) throw invalid_value(arg, value); }
+        else if (arg == "--container") container_prefix = value;
+        else if (arg == "--io") { if (!parse_io_backend(value, io.backend)) throw invalid_value(arg, value); }
+        else if (arg == "--capture-policy") capture_policy_path = value;
+        else if (arg == "--segment-mb") segment_mb = std::stoull(value);
+        else if (arg == "--segment-seconds") segment_seconds = std::stoi(value);
+        else if (arg == "--retain-mb") retain_mb = std::stoul(value);
+        else if (arg == "--depth-codec") depth_codec = value;
+        else if (arg == "--color-codec") color_codec = value;
+        else if (arg == "--keyframe-interval") keyframe_interval = std::stoi(value);
+        else if (arg == "--pointcloud") { if (!parse_point_format(value, cloud_format)) throw invalid_value(arg, value); pointcloud = true; }
+        else if (arg == "--voxel") voxel_m = std::stof(value);
+        else if (arg == "--max-depth") max_depth_m = std::stof(value);
+        else if (arg == "--sync") sync_tolerance_ms = std::stod(value);
+        else if (arg == "--filters") filter_chain = value;
+        else if (arg == "--filter-threads") filter_threads = std::stoul(value);
+        else if (arg == "--filter-save")
         {
-            for (auto&& stream : sn_to_dev.second.frames_per_stream)
-            {
-                if (stream.second)
-                {
-                    count++;
-                }
-            }
+            if (value != "both" && value != "filtered" && value != "raw") throw invalid_value(arg, value);
+            filter_save = value;
         }
-        return count;
+        else if (arg == "--shm") shm_name = value;
+        else if (arg == "--shm-slots") shm_slots = uint32_t(std::stoul(value));
+        else if (arg == "--shm-slot-mb") shm_slot_mb = std::stoul(value);
+        else if (arg == "--preset") preset_path = value;
+        else if (arg == "--event-pre") event_pre = std::stod(value);
+        else if (arg == "--event-post") event_post = std::stod(value);
+        else if (arg == "--event-near") event_near = std::stoi(value);
+        else if (arg == "--event-fraction") event_fraction = std::stod(value);
+        else if (arg == "--profile") profile_path = value;
+        else if (arg == "--health") health_path = value;
+        else if (arg == "--trace") trace_path = value;
+        else throw std::runtime_error("Unknown argument " + arg);
     }
 
-	//------------------save raw start--------------------
-	//method 1
-	//int save_to_raw(uint16_t *image, int imageWidth, int imageHeight, const char *filename)
-	//{
-	//	char fname_bmp[128];
-	//	sprintf(fname_bmp, "%s.raw", filename);
-
-	//	FILE *fp;
-	//	if (!(fp = fopen(fname_bmp, "wb")))
-	//		return -1;
-	//	fwrite(image, sizeof(uint16_t), (size_t)(long)imageWidth*imageHeight, fp);
-	//	fclose(fp);
-	//	return 0;
-	//}
-	
-	//method 2
-	bool save_frame_raw_data(const std::string& filename, rs2::frame frame)
-	{
-		bool ret = false;
-		auto image = frame.as<rs2::video_frame>();
-		if (image)
-		{
-			std::ofstream outfile(filename.data(), std::ofstream::binary);
-			outfile.write(static_cast<const char*>(image.get_data()), image.get_height()*image.get_stride_in_bytes());
-
-			outfile.close();
-			ret = true;
-		}
-
-		return ret;
-	}
-
-	//--------------------save raw end--------------------
-
-
-    void poll_frames()
+    device_container connected_devices(writer_threads, queue_capacity, policy, retain_mb << 20);
+    connected_devices.set_encoders(depth_codec, color_codec, keyframe_interval);
+    connected_devices.set_io(io);
+    if (pointcloud)
+        connected_devices.enable_pointcloud(cloud_format, voxel_m, max_depth_m);
+    if (!capture_policy_path.empty())
+        connected_devices.set_capture_policy(capture_policy::load(capture_policy_path));
+    if (!container_prefix.empty())
+        connected_devices.enable_raw_container(container_prefix, segment_mb << 20, std::chrono::seconds(segment_seconds));
+    if (sync_tolerance_ms > 0)
+        connected_devices.enable_sync(sync_tolerance_ms);
+    if (!filter_chain.empty())
+        connected_devices.enable_filters(filter_chain, filter_threads, filter_save != "filtered", filter_save != "raw");
+    if (!shm_name.empty())
+        connected_devices.enable_shm_publisher(shm_name, shm_slots, shm_slot_mb << 20);
+    if (event_pre > 0 || event_post > 0)
+        connected_devices.enable_events(event_pre, event_post, uint16_t(event_near), event_fraction);
+    if (!profile_path.empty())
+        connected_devices.enable_profile_report(profile_path);
+    if (!health_path.empty())
+        connected_devices.enable_health_report(health_path);
+    if (!trace_path.empty())
+        connected_devices.enable_trace(1 << 16);
+    auto write_trace = [&]()
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-
-		// Declare depth colorizer for pretty visualization of depth data
-		rs2::colorizer color_map;
-
-		std::vector<rs2::frameset> list;
-
-        // Go over all device
-        for (auto&& view : _devices)
-        {
-			printf("sn: %s\n", view.second.dev.c_str());
-            // Ask each pipeline if there are new frames available
-            rs2::frameset frameset;
-            if (view.second.pipe.poll_for_frames(&frameset))
-            {
-				//keep frame
-				auto raw_data = frameset.get_depth_frame();
-				raw_data.keep();
-				list.push_back(raw_data);
-				//std::_Count_pr << list.size << std::endl;
-
-				//printf("%s, ae=%lld\n", rs2_stream_to_string(frame.get_profile().stream_type()), exp);
-
-                for (int i = 0; i < frameset.size(); i++)
-                {
-                    rs2::frame frame = frameset[i];
-
-
-					//--------------------get timestamp and frame count start-------------------
-
-
-					//auto exp = frame.get_frame_metadata(RS2_FRAME_METADATA_ACTUAL_EXPOSURE);
-					auto ts_bkend = frame.get_frame_metadata(RS2_FRAME_METADATA_BACKEND_TIMESTAMP);
-					auto ts_toa = frame.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL);
-					auto ts_frame = frame.get_frame_metadata(RS2_FRAME_METADATA_FRAME_TIMESTAMP);
-					auto ts_sensor = frame.get_frame_metadata(RS2_FRAME_METADATA_SENSOR_TIMESTAMP);
-					auto frm_id = frame.get_frame_number();
-					auto frm_cnt = frame.get_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER);
-					auto frm_tp = rs2_stream_to_string(frame.get_profile().stream_type());
-					printf("                %s id=%lld cnt=%lld tsbk=%lld %lld %lld %lld\n", frm_tp, frm_id, frm_cnt, ts_bkend, ts_toa, ts_frame, ts_sensor);
-
-                    int stream_id = frame.get_profile().unique_id();
-                    view.second.frames_per_stream[stream_id] = view.second.colorize_frame.process(frame); //update view port with the new stream
-                
-					//--------------------get timestamp and frame count end-------------------
-
-					//--------------------------save raw start-------------------------
-
-
-
-					//save image to disk 
-					// We can only save video frames as pngs, so we skip the rest
-					if (auto vf = frame.as<rs2::video_frame>())
-					{
-						auto stream = frame.get_profile().stream_type();
-						// Use the colorizer to get an rgb image for the depth stream
-						if (vf.is<rs2::depth_frame>()) //vf = color_map.process(frame);
-						{
-							//save depth to raw
-							std::stringstream raw_file;
-							std::string raw_filename;
-							//raw_file <<"sn"<<view.second.dev <<"_ts"<<ts_bkend<<"_cnt"<<frm_cnt<< "-" << vf.get_profile().stream_name() << ".raw";
-							//raw_file << vf.get_profile().stream_name()<<"_sn"<<view.second.dev << "_cnt" <<frm_cnt<<"_ts"<<ts_bkend<< ".raw";
-							raw_file << "fc" << frm_cnt << "_ts" << ts_bkend << "_sn"<<view.second.dev <<"_"<< vf.get_profile().stream_name() << ".raw";
-							raw_file >> raw_filename;
-							raw_filename = ".\\images\\" + raw_filename;
-							if (save_frame_raw_data(raw_filename, frame))
-								std::cout << "Raw data is captured into " << raw_filename << std::endl;
-						}
-
-						else
-						{
-							// Write images to disk
-							std::stringstream png_file;
-							std::string png_filename;
-							png_file << "fc" << frm_cnt << "_ts" << ts_bkend << "_sn" << view.second.dev << "_" << vf.get_profile().stream_name() << ".png";
-							png_file >> png_filename;
-							png_filename = ".\\images\\" + png_filename;
-							stbi_write_png(png_filename.c_str(), vf.get_width(), vf.get_height(),
-								vf.get_bytes_per_pixel(), vf.get_data(), vf.get_stride_in_bytes());
-							std::cout << "Saved " << png_filename << std::endl;
-
-							// Record per-frame metadata for UVC streams
-							std::stringstream csv_file;
-							csv_file << "rs-save-to-disk-output-" << vf.get_profile().stream_name()
-								<< "-metadata.csv";
-							metadata_to_csv(vf, csv_file.str());
-
-						}
-						//-------------------------save raw end--------------------------
-					}
-
-
-				}
-            }
-        }
-    }
-
-	void metadata_to_csv(const rs2::frame& frm, const std::string& filename)
-	{
-		std::ofstream csv;
-
-		csv.open(filename);
-
-		//    std::cout << "Writing metadata to " << filename << endl;
-		csv << "Stream," << rs2_stream_to_string(frm.get_profile().stream_type()) << "\nMetadata Attribute,Value\n";
-
-		// Record all the available metadata attributes
-		for (size_t i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
-		{
-			if (frm.supports_frame_metadata((rs2_frame_metadata_value)i))
-			{
-				csv << rs2_frame_metadata_to_string((rs2_frame_metadata_value)i) << ","
-					<< frm.get_frame_metadata((rs2_frame_metadata_value)i) << "\n";
-			}
-		}
+        if (!trace_path.empty() && !connected_devices.write_trace(trace_path))
+            std::cerr << "Failed to write " << trace_path << std::endl;
+    };
 
-		csv.close();
-	}
+    rs2::context ctx;    // Create librealsense context for managing devices
 
-    void render_textures(int cols, int rows, float view_width, float view_height)
+    // Configure all connected devices in parallel before any pipeline starts
+    preset_cache presets;
+    std::shared_ptr<const device_preset> preset;
+    if (!preset_path.empty())
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        int stream_no = 0;
-        for (auto&& view : _devices)
-        {
-            // For each device get its frames
-            for (auto&& id_to_frame : view.second.frames_per_stream)
-            {
-                rect frame_location{ view_width * (stream_no % cols), view_height * (stream_no / cols), view_width, view_height };
-                if (rs2::video_frame vid_frame = id_to_frame.second.as<rs2::video_frame>())
-                {
-                    view.second.tex.render(vid_frame, frame_location);
-                    stream_no++;
-                }
-            }
-        }
+        preset = presets.load(preset_path);
+        auto start = std::chrono::steady_clock::now();
+        auto reports = apply_preset_to_all(ctx, *preset);
+        print_preset_reports(*preset, reports,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
     }
-private:
-    std::mutex _mutex;
-    std::map<std::string, view_port> _devices;
-};
-
-
-int main(int argc, char * argv[]) try
-{
-    // Create a simple OpenGL window for rendering:
-    window app(1280, 960, "CPP Multi-Camera Example");
-
-    device_container connected_devices;
-
-    rs2::context ctx;    // Create librealsense context for managing devices
 
                          // Register callback for tracking which devices are currently connected
+    // Both only queue work for the device lifecycle threads, so this callback returns at
+    // once and the other cameras keep streaming while one is plugged in or out
     ctx.set_devices_changed_callback([&](rs2::event_information& info)
     {
         connected_devices.remove_devices(info);
         for (auto&& dev : info.get_new_devices())
         {
-            connected_devices.enable_device(dev);
+            // Hot-plugged devices get the preset only if already in advanced mode; one that
+            // comes back after the startup toggle is found unchanged and left alone
+            std::function<void(rs2::device)> configure;
+            if (preset)
+                configure = [ctx, preset](rs2::device d) mutable { print_preset_reports(*preset, { apply_preset(ctx, d, *preset, false) }, 0); };
+            connected_devices.enable_device(dev, configure);
         }
     });
 
@@ -315,9 +185,33 @@ int main(int argc, char * argv[]) try
         connected_devices.enable_device(dev);
     }
 
+    if (display.headless)
+    {
+        // Every device captures on its own thread; just report until Ctrl+C
+        wait_for_interrupt([]() { return true; }, [&]() { connected_devices.print_writer_stats(); });
+        write_trace();
+        return EXIT_SUCCESS;
+    }
+
+    // Create a simple OpenGL window for rendering:
+    window app(1280, 960, "CPP Multi-Camera Example");
+    app.on_key_release = [&](int key)
+    {
+        if (key == ' ')
+            connected_devices.trigger_event("key");
+    };
+    rate_limiter redraw(display.fps);
+
+    auto last_report = std::chrono::steady_clock::now();
     while (app) // Application still alive?
     {
-        connected_devices.poll_frames();
+        // Every device captures on its own thread; this loop only renders and reports
+        if (std::chrono::steady_clock::now() - last_report > std::chrono::seconds(1))
+        {
+            connected_devices.print_writer_stats();
+            last_report = std::chrono::steady_clock::now();
+        }
+        redraw.wait();
         auto total_number_of_streams = connected_devices.stream_count();
         if (total_number_of_streams == 0)
         {
@@ -338,6 +232,7 @@ int main(int argc, char * argv[]) try
         connected_devices.render_textures(cols, rows, view_width, view_height);
     }
 
+    write_trace();
     return EXIT_SUCCESS;
 }
 catch (const rs2::error & e)
@@ -0,0 +1,50 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+
+#include <iostream>
+#include <string>
+
+#include "raw_container.hpp"
+
+// Raw Container Export Example lists the frames recorded by raw_container_writer
+// and, when an output directory is given, writes them back out as one
+// fc<cnt>_ts<ts>_sn<serial>_<stream>.raw file per frame.
+int main(int argc, char * argv[]) try
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " <container prefix> [output directory]\n";
+        return EXIT_SUCCESS;
+    }
+
+    raw_container_reader reader(argv[1]);
+    for (auto&& r : reader.records())
+    {
+        std::cout << raw_record_serial(r) << " " << raw_record_stream_name(r) << " cnt=" << r.frame_counter
+                  << " tsbk=" << r.backend_timestamp << " " << r.width << "x" << r.height
+                  << " segment=" << r.segment << " offset=" << r.offset << " size=" << r.size << std::endl;
+    }
+
+    if (argc > 2)
+    {
+        std::string directory(argv[2]);
+        if (!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+            directory += '/';
+        auto count = reader.export_files(directory);
+        std::cout << "Exported " << count << " frames to " << directory << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error & e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
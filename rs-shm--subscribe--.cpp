@@ -0,0 +1,66 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "shm_ring.hpp"
+
+// Shared-Memory Subscriber Example reads the frames rs-multicam--save-raw-with-timestamp--
+// publishes with --shm <name>, in place, from another process. It needs neither
+// librealsense nor a camera: per frame it prints serial, stream, counter and how long
+// after publishing it arrived, and the mean depth of Z16 frames. Frames it was too slow
+// for are counted, never waited for.
+//
+// Usage: rs-shm--subscribe-- <name> [frames]
+
+int main(int argc, char * argv[]) try
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " <name> [frames]\n";
+        return EXIT_SUCCESS;
+    }
+    uint64_t frames = argc > 2 ? std::stoull(argv[2]) : 0;
+
+    shm_frame_subscriber subscriber(argv[1]);
+    shm_frame f;
+    while ((!frames || subscriber.received() < frames) && subscriber.wait_next(f, std::chrono::seconds(5)))
+    {
+        double latency_us = (shm_clock_ns() - f.header->publish_ns) / 1000.;
+        double mean = 0;
+        if (f.header->format == 1) // RS2_FORMAT_Z16
+        {
+            uint64_t sum = 0, valid = 0;
+            for (int y = 0; y < f.header->height; y++)
+            {
+                auto row = reinterpret_cast<const uint16_t*>(f.data + size_t(y) * f.header->stride);
+                for (int x = 0; x < f.header->width; x++)
+                {
+                    sum += row[x];
+                    valid += row[x] != 0;
+                }
+            }
+            mean = valid ? double(sum) / valid : 0;
+        }
+        // Copy out what we printed before trusting it: the slot may have been reused
+        shm_frame_header header = *f.header;
+        if (!subscriber.valid(f))
+            continue;
+        printf("sn %s stream %d/%d %dx%d cnt=%lld ts=%.3f latency=%.0fus%s", header.serial, header.stream,
+            header.stream_index, header.width, header.height, (long long)header.frame_counter, header.timestamp,
+            latency_us, header.format == 1 ? "" : "\n");
+        if (header.format == 1)
+            printf(" mean depth=%.0f\n", mean);
+    }
+    printf("received=%llu lost=%llu%s\n", (unsigned long long)subscriber.received(), (unsigned long long)subscriber.lost(),
+        subscriber.closed() ? " (publisher closed)" : "");
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
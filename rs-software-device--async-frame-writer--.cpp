@@ -0,0 +1,108 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+
+#include <thread>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "async_frame_writer.hpp"
+
+// Async Frame Writer Example drives async_frame_writer with synthetic Z16 frames
+// from a software_device, so the writer stage can be exercised without a camera.
+// A deliberately slow sink makes the queue fill up under each backpressure policy.
+
+const int W = 640;
+const int H = 480;
+const int BPP = 2;
+const int FRAMES = 120;
+
+struct run_result
+{
+    uint64_t produced, enqueued, written, dropped, failed;
+    int64_t max_queue_depth;
+};
+
+run_result run_policy(backpressure_policy policy, size_t capacity, std::chrono::milliseconds write_delay)
+{
+    rs2::software_device dev;
+    auto depth_sensor = dev.add_sensor("Depth");
+
+    rs2_intrinsics intrinsics{ W, H, W / 2.f, H / 2.f, 380.f, 380.f, RS2_DISTORTION_BROWN_CONRADY ,{ 0,0,0,0,0 } };
+    auto depth_stream = depth_sensor.add_video_stream({ RS2_STREAM_DEPTH, 0, 0, W, H, 60, BPP, RS2_FORMAT_Z16, intrinsics });
+
+    // The sink only sleeps, standing in for a slow disk
+    async_frame_writer writer([&](const write_job& job) -> size_t
+    {
+        std::this_thread::sleep_for(write_delay);
+        auto vf = job.frame.as<rs2::video_frame>();
+        return size_t(vf.get_height()) * vf.get_stride_in_bytes();
+    }, 1, capacity, policy);
+    auto stats = writer.stats_for("software");
+
+    depth_sensor.open(depth_stream);
+    depth_sensor.start([&](rs2::frame f)
+    {
+        f.keep();
+        writer.enqueue(write_job{ "software", "", f, stats });
+    });
+
+    for (int frame_number = 0; frame_number < FRAMES; frame_number++)
+    {
+        auto pixels = new uint16_t[W * H];
+        for (int i = 0; i < W * H; i++)
+            pixels[i] = uint16_t((i + frame_number) & 0xffff);
+
+        depth_sensor.on_video_frame({ pixels, [](void* p) { delete[] static_cast<uint16_t*>(p); },
+            W * BPP, BPP, rs2_time_t(frame_number * 16), RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK, frame_number, depth_stream.get() });
+    }
+
+    depth_sensor.stop();
+    depth_sensor.close();
+    writer.flush();
+
+    return run_result{ FRAMES, stats->enqueued, stats->written, stats->dropped, stats->failed, stats->max_queue_depth };
+}
+
+int main(int argc, char * argv[]) try
+{
+    const size_t capacity = 8;
+    const auto delay = std::chrono::milliseconds(5);
+
+    bool ok = true;
+    for (auto policy : { backpressure_policy::block, backpressure_policy::drop_oldest, backpressure_policy::drop_newest })
+    {
+        auto r = run_policy(policy, capacity, delay);
+        const char* name = policy == backpressure_policy::block ? "block"
+                         : policy == backpressure_policy::drop_oldest ? "drop-oldest" : "drop-newest";
+        std::cout << name << ": enqueued=" << r.enqueued << " written=" << r.written << " dropped=" << r.dropped
+                  << " failed=" << r.failed << " max_queue_depth=" << r.max_queue_depth << std::endl;
+
+        // Every frame handed to the writer is accounted for exactly once
+        if (r.written + r.dropped + r.failed != r.enqueued)
+            ok = false;
+        // Blocking never loses a frame; the dropping policies must have shed load with this slow sink
+        if (policy == backpressure_policy::block && r.dropped != 0)
+            ok = false;
+        if (policy != backpressure_policy::block && r.dropped == 0)
+            ok = false;
+        // Never more than a full queue, the frame being written and the one waiting to get in
+        if (r.max_queue_depth > int64_t(capacity) + 2)
+            ok = false;
+    }
+
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+catch (const rs2::error & e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,116 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+// 3rd party header for writing png files
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "frame_encoders.hpp"
+
+// TDC Decode Example turns the .tdc depth files the save path writes (--depth-codec tdc)
+// back into raw Z16 .raw files next to them. Delta frames need the frame before them, so
+// the files of each chain are decoded in frame number order; a chain with a missing frame
+// resumes at its next keyframe. A chain is one camera, stream and file tag: raw and
+// "filtered_" depth, and each "ev<id>_" event recording, are coded separately, while
+// sync group prefixes ("g<id>_") do not split a chain.
+//   [g<id>_][ev<id>_][filtered_]fc<cnt>_ts<ts>_sn<serial>_<stream>.tdc
+//
+// Usage: rs-tdc--decode-- [--threads <n>] <file.tdc>...
+
+struct tdc_file
+{
+    std::string path;
+    std::vector<uint8_t> data;
+    tdc::frame_info info;
+};
+
+// ".../g7_filtered_fc12_ts345_sn819612070593_Depth.tdc" -> "filtered_819612070593_Depth"
+std::string stream_of(const std::string& path)
+{
+    auto name = path.substr(path.find_last_of("/\\") + 1);
+    auto sn = name.find("_sn");
+    if (sn == std::string::npos)
+        return name;
+    std::string stream = name.substr(sn + 3, name.rfind('.') - sn - 3);
+
+    // The tag is everything before "fc<cnt>", less a sync group prefix
+    size_t fc = 0;
+    while (fc < sn && !(name.compare(fc, 2, "fc") == 0 && isdigit((unsigned char)name[fc + 2])))
+        fc = name.find('_', fc) + 1;
+    std::string tag = name.substr(0, std::min(fc, sn));
+    if (tag.size() > 1 && tag[0] == 'g' && isdigit((unsigned char)tag[1]))
+        tag = tag.substr(tag.find('_') + 1);
+    return tag + stream;
+}
+
+int main(int argc, char * argv[]) try
+{
+    int threads = 1;
+    std::map<std::string, std::vector<tdc_file>> streams;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            threads = std::max(1, std::stoi(argv[++i]));
+            continue;
+        }
+        std::ifstream file(arg, std::ios::binary);
+        tdc_file f{ arg, std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()), {} };
+        if (!file || !tdc::read_info(f.data, f.info))
+        {
+            std::cerr << arg << ": not a tdc frame" << std::endl;
+            continue;
+        }
+        streams[stream_of(arg)].push_back(std::move(f));
+    }
+    if (streams.empty())
+    {
+        std::cout << "Usage: " << argv[0] << " [--threads <n>] <file.tdc>...\n";
+        return EXIT_SUCCESS;
+    }
+
+    size_t decoded = 0, failed = 0;
+    for (auto&& stream : streams)
+    {
+        auto& files = stream.second;
+        std::sort(files.begin(), files.end(), [](const tdc_file& a, const tdc_file& b) { return a.info.number < b.info.number; });
+
+        tdc_decoder decoder(threads);
+        std::vector<uint16_t> pixels;
+        for (auto&& f : files)
+        {
+            tdc::frame_info info;
+            std::string error;
+            if (!decoder.decode(f.data, pixels, info, error))
+            {
+                std::cerr << f.path << ": " << error << std::endl;
+                failed++;
+                continue;
+            }
+            std::string out = f.path.substr(0, f.path.rfind('.')) + ".raw";
+            std::ofstream raw(out, std::ios::binary);
+            raw.write(reinterpret_cast<const char*>(pixels.data()), pixels.size() * 2);
+            if (!raw)
+                throw std::runtime_error("Failed to write " + out);
+            decoded++;
+        }
+        std::cout << stream.first << ": " << files.size() << " frames" << std::endl;
+    }
+    std::cout << "Decoded " << decoded << " frames, " << failed << " failed" << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
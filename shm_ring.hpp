@@ -0,0 +1,386 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>                  // O_* flags
+#include <sys/mman.h>               // shm_open, mmap
+#include <sys/stat.h>
+#include <unistd.h>                 // ftruncate
+#endif
+
+// Captured frames published to local processes through a POSIX shared-memory ring.
+//
+// One publisher (any number of capture threads) copies each frame once into the next
+// slot; subscribers in other processes map the ring read-only and use the frames where
+// they lie. Nobody takes a lock and the publisher never waits for a subscriber: a slow
+// subscriber is lapped and told how many frames it lost.
+//
+//   header | slot 0 | slot 1 | ... | slot N-1      slot: sequence, shm_frame_header, pixels
+//
+// Frames are numbered by a claim counter in the header. A slot's sequence is 2s+1 while
+// frame s is written into it and 2s+2 once it is complete (a seqlock), so a subscriber
+// knows whether the slot holds the frame it expects, an older one or a newer one, and
+// after reading in place, whether the frame was overwritten meanwhile (shm_frame_subscriber::valid).
+//
+// This header has no librealsense dependency, so analytics processes only need it (and
+// -lrt on older glibc). Stream, format and timestamp domain hold rs2_stream, rs2_format
+// and rs2_timestamp_domain values.
+
+struct shm_frame_header
+{
+    char serial[32];
+    int32_t stream;
+    int32_t stream_index;
+    int32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t bytes_per_pixel;
+    int32_t stride;
+    int32_t timestamp_domain;
+    uint64_t data_size;
+    uint64_t frame_number;
+    int64_t frame_counter;      // RS2_FRAME_METADATA_FRAME_COUNTER, or the frame number
+    int64_t backend_timestamp;  // RS2_FRAME_METADATA_BACKEND_TIMESTAMP, or 0
+    double timestamp;           // frame timestamp, ms
+    double capture_ms;          // host wall clock when the capture thread got it
+    uint64_t publish_ns;        // steady clock (system-wide) when it was published
+};
+
+// steady_clock is CLOCK_MONOTONIC on POSIX, comparable across processes
+inline uint64_t shm_clock_ns()
+{
+    using namespace std::chrono;
+    return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+namespace shm
+{
+    const char magic[8] = { 'R', 'S', 'S', 'H', 'M', 'R', 'N', 'G' };
+    const uint32_t version = 1;
+
+    struct ring_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t slot_count;
+        uint64_t slot_bytes;        // pixel capacity of a slot
+        uint64_t slot_stride;
+        uint64_t total_bytes;
+        alignas(64) std::atomic<uint64_t> claimed;  // frames claimed by the publisher so far
+        alignas(64) std::atomic<uint64_t> oversize; // frames larger than a slot, not published
+        std::atomic<uint32_t> closed;               // set when the publisher goes away
+    };
+
+    struct slot_header
+    {
+        std::atomic<uint64_t> sequence;
+        shm_frame_header frame;
+    };
+
+    const size_t page = 4096;
+    inline size_t round_up(size_t n, size_t to) { return (n + to - 1) / to * to; }
+    const size_t header_bytes = round_up(sizeof(ring_header), page);
+    const size_t slot_header_bytes = round_up(sizeof(slot_header), 64);
+
+    // POSIX names start with a single slash
+    inline std::string object_name(const std::string& name)
+    {
+        return name.empty() || name[0] != '/' ? "/" + name : name;
+    }
+
+    inline std::runtime_error error(const std::string& what, const std::string& name, int code = errno)
+    {
+        return std::runtime_error(what + " " + name + ": " + strerror(code));
+    }
+
+    // A mapped shared-memory object; the creator unlinks it again
+    class mapping
+    {
+    public:
+        mapping(const std::string& name, size_t create_bytes)
+            : _name(object_name(name)), _owner(create_bytes > 0)
+        {
+#ifdef _WIN32
+            throw std::runtime_error("Shared-memory frame publishing needs POSIX shared memory");
+#else
+            int fd;
+            if (_owner)
+            {
+                shm_unlink(_name.c_str()); // left over from a publisher that crashed
+                fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+                if (fd < 0)
+                    throw error("Failed to create shared memory", _name);
+                if (ftruncate(fd, off_t(create_bytes)) != 0)
+                {
+                    int code = errno;
+                    close(fd);
+                    shm_unlink(_name.c_str());
+                    throw error("Failed to size shared memory", _name, code);
+                }
+                _size = create_bytes;
+            }
+            else
+            {
+                fd = shm_open(_name.c_str(), O_RDONLY, 0);
+                if (fd < 0)
+                    throw error("Failed to open shared memory", _name);
+                struct stat st;
+                if (fstat(fd, &st) != 0)
+                {
+                    int code = errno;
+                    close(fd);
+                    throw error("Failed to stat shared memory", _name, code);
+                }
+                _size = size_t(st.st_size);
+            }
+            void* p = mmap(nullptr, _size, _owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            int code = errno;
+            close(fd);
+            if (p == MAP_FAILED)
+            {
+                if (_owner)
+                    shm_unlink(_name.c_str());
+                throw error("Failed to map shared memory", _name, code);
+            }
+            _data = static_cast<uint8_t*>(p);
+#endif
+        }
+
+        ~mapping()
+        {
+#ifndef _WIN32
+            if (_data)
+                munmap(_data, _size);
+            if (_owner)
+                shm_unlink(_name.c_str());
+#endif
+        }
+
+        mapping(const mapping&) = delete;
+        mapping& operator=(const mapping&) = delete;
+
+        uint8_t* data() const { return _data; }
+        size_t size() const { return _size; }
+        const std::string& name() const { return _name; }
+
+    private:
+        std::string _name;
+        bool _owner;
+        uint8_t* _data = nullptr;
+        size_t _size = 0;
+    };
+}
+
+class shm_frame_publisher
+{
+public:
+    // Creates (replacing any stale one) the shared-memory object `name` with `slots`
+    // frames of up to `slot_bytes` pixel bytes each
+    shm_frame_publisher(const std::string& name, uint32_t slots = 8, size_t slot_bytes = 4 << 20)
+        : _slot_count(std::max<uint32_t>(2, slots)),
+          _slot_stride(shm::round_up(shm::slot_header_bytes + std::max<size_t>(slot_bytes, 1), shm::page)),
+          _map(name, shm::header_bytes + _slot_count * _slot_stride)
+    {
+        // The object is zero-filled: every slot starts at sequence 0, nothing published
+        auto ring = new (_map.data()) shm::ring_header();
+        ring->version = shm::version;
+        ring->slot_count = _slot_count;
+        ring->slot_bytes = _slot_stride - shm::slot_header_bytes;
+        ring->slot_stride = _slot_stride;
+        ring->total_bytes = _map.size();
+        ring->claimed.store(0);
+        ring->oversize.store(0);
+        ring->closed.store(0);
+        for (uint32_t i = 0; i < _slot_count; i++)
+            new (slot(i)) shm::slot_header();
+        // The magic goes in last; subscribers check it before anything else
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(ring->magic, shm::magic, sizeof(shm::magic));
+        _ring = ring;
+    }
+
+    ~shm_frame_publisher()
+    {
+        _ring->closed.store(1, std::memory_order_release);
+    }
+
+    shm_frame_publisher(const shm_frame_publisher&) = delete;
+    shm_frame_publisher& operator=(const shm_frame_publisher&) = delete;
+
+    // Copies a frame into the next slot; false (and counted) if it is larger than a
+    // slot. Safe to call from several threads.
+    bool publish(const shm_frame_header& frame, const void* data, size_t bytes)
+    {
+        if (bytes > capacity())
+        {
+            _ring->oversize.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint64_t s = _ring->claimed.fetch_add(1, std::memory_order_relaxed);
+        auto sl = slot(uint32_t(s % _slot_count));
+
+        // Only when the ring wraps within one copy: wait for the slot's previous writer
+        uint64_t previous_done = s >= _slot_count ? 2 * (s - _slot_count) + 2 : 0;
+        while (sl->sequence.load(std::memory_order_acquire) < previous_done)
+            std::this_thread::yield();
+
+        sl->sequence.store(2 * s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        sl->frame = frame;
+        sl->frame.data_size = bytes;
+        sl->frame.publish_ns = shm_clock_ns();
+        memcpy(reinterpret_cast<uint8_t*>(sl) + shm::slot_header_bytes, data, bytes);
+        sl->sequence.store(2 * s + 2, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return size_t(_ring->slot_bytes); }
+    uint32_t slots() const { return _slot_count; }
+    const std::string& name() const { return _map.name(); }
+    uint64_t published() const { return _ring->claimed.load(std::memory_order_relaxed); }
+    uint64_t oversize() const { return _ring->oversize.load(std::memory_order_relaxed); }
+
+    void print_report() const
+    {
+        printf("shm %s: slots=%u x %zu bytes published=%llu oversize=%llu\n", name().c_str(), slots(), capacity(),
+            (unsigned long long)published(), (unsigned long long)oversize());
+    }
+
+private:
+    shm::slot_header* slot(uint32_t i) const
+    {
+        return reinterpret_cast<shm::slot_header*>(_map.data() + shm::header_bytes + size_t(i) * _slot_stride);
+    }
+
+    const uint32_t _slot_count;
+    const size_t _slot_stride;
+    shm::mapping _map;
+    shm::ring_header* _ring = nullptr;
+};
+
+// A frame as it lies in the ring; valid until the publisher reuses its slot
+struct shm_frame
+{
+    const shm_frame_header* header;
+    const uint8_t* data;
+    uint64_t sequence;
+};
+
+class shm_frame_subscriber
+{
+public:
+    // Maps the ring read-only; the first frame returned is the next one published
+    explicit shm_frame_subscriber(const std::string& name)
+        : _map(name, 0)
+    {
+        _ring = reinterpret_cast<const shm::ring_header*>(_map.data());
+        if (_map.size() < shm::header_bytes || memcmp(_ring->magic, shm::magic, sizeof(shm::magic)) != 0)
+            throw std::runtime_error("Not a frame ring (or not initialized yet): " + _map.name());
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_ring->version != shm::version || _ring->slot_count == 0 ||
+            _ring->total_bytes != _map.size() ||
+            shm::header_bytes + _ring->slot_count * _ring->slot_stride > _map.size())
+            throw std::runtime_error("Unsupported frame ring layout: " + _map.name());
+        _cursor = _ring->claimed.load(std::memory_order_acquire);
+    }
+
+    // The next frame in publishing order, in place; false if none is complete yet.
+    // Frames overwritten before we got to them are skipped and counted in lost().
+    bool next(shm_frame& out)
+    {
+        const uint64_t n = _ring->slot_count;
+        for (;;)
+        {
+            auto sl = slot(_cursor % n);
+            uint64_t sequence = sl->sequence.load(std::memory_order_acquire);
+            if (sequence == 2 * _cursor + 2)
+            {
+                out = shm_frame{ &sl->frame, reinterpret_cast<const uint8_t*>(sl) + shm::slot_header_bytes, _cursor };
+                _cursor++;
+                _received++;
+                return true;
+            }
+            if (sequence < 2 * _cursor + 2)
+                return false; // not written yet, or being written
+
+            // Lapped: resume at the oldest frame that can still be there
+            uint64_t claimed = _ring->claimed.load(std::memory_order_acquire);
+            uint64_t oldest = std::max(_cursor + 1, claimed > n ? claimed - n : 0);
+            _lost += oldest - _cursor;
+            _cursor = oldest;
+        }
+    }
+
+    // Polls for the next frame until `timeout`; false on timeout or once the publisher closed
+    bool wait_next(shm_frame& out, std::chrono::milliseconds timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (int spin = 0;; spin++)
+        {
+            if (next(out))
+                return true;
+            if (closed() || std::chrono::steady_clock::now() >= deadline)
+                return false;
+            if (spin < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    // Whether the frame's slot still holds it. Check after using the pixels in place:
+    // if the publisher lapped us meanwhile, what was read may be torn.
+    bool valid(const shm_frame& f) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot(f.sequence % _ring->slot_count)->sequence.load(std::memory_order_relaxed) == 2 * f.sequence + 2;
+    }
+
+    // The next frame copied out, retried until a copy is not torn
+    bool next_copy(shm_frame_header& header, std::vector<uint8_t>& data)
+    {
+        shm_frame f;
+        while (next(f))
+        {
+            header = *f.header;
+            size_t bytes = std::min<size_t>(header.data_size, _ring->slot_bytes);
+            data.assign(f.data, f.data + bytes);
+            if (valid(f))
+                return true;
+            _torn++;
+        }
+        return false;
+    }
+
+    bool closed() const { return _ring->closed.load(std::memory_order_acquire) != 0; }
+    uint64_t received() const { return _received; }
+    uint64_t lost() const { return _lost; }
+    uint64_t torn() const { return _torn; }
+    uint32_t slots() const { return _ring->slot_count; }
+
+private:
+    const shm::slot_header* slot(uint64_t i) const
+    {
+        return reinterpret_cast<const shm::slot_header*>(_map.data() + shm::header_bytes + size_t(i) * _ring->slot_stride);
+    }
+
+    shm::mapping _map;
+    const shm::ring_header* _ring = nullptr;
+    uint64_t _cursor = 0;
+    uint64_t _received = 0, _lost = 0, _torn = 0;
+};
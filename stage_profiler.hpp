@@ -0,0 +1,514 @@
+// License: Apache 2.0. See LICENSE file in root directory.
+// Copyright(c) 2017 Intel Corporation. All Rights Reserved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>     // Include RealSense Cross Platform API
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define STAGE_PROFILER_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STAGE_PROFILER_TSC 1
+#endif
+
+#include "frame_ring.hpp"           // host_time_ms
+
+// Always-on timing of the capture -> save -> render stages.
+//
+// Each thread records into histograms only it writes (relaxed loads and stores, no
+// locked instructions, no mutex), so recording costs a TSC read or two and a few
+// increments. Reports merge all threads per channel - a device serial and stream - and
+// stage. Durations are kept in clock ticks and converted when reported, calibrated
+// against steady_clock over the profiler's lifetime. A record may carry the frame's
+// TIME_OF_ARRIVAL; its age (host time minus arrival) when the stage ended goes into a
+// second histogram. With enable_trace() every thread also keeps a ring of its latest
+// spans, written out in Chrome trace format (chrome://tracing, Perfetto).
+
+enum class pipeline_stage { poll, metadata, colorize, filter, publish, encode, pointcloud, write, render, count };
+
+inline const char* pipeline_stage_name(pipeline_stage stage)
+{
+    static const char* names[] = { "poll", "metadata", "colorize", "filter", "publish", "encode", "pointcloud", "write", "render" };
+    return names[int(stage)];
+}
+
+// The cheapest monotonic clock there is: the TSC on x86, steady_clock nanoseconds elsewhere
+inline uint64_t stage_ticks()
+{
+#ifdef STAGE_PROFILER_TSC
+    return __rdtsc();
+#else
+    using namespace std::chrono;
+    return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Log-scale histogram of integers, 8 buckets per doubling (about 9% resolution), exact
+// below 8. One thread writes it; any thread may read it.
+class stage_histogram
+{
+public:
+    static const int bucket_count = 64 * 8;
+
+    void add(uint64_t value)
+    {
+        bump(_buckets[bucket(value)]);
+        bump(_count);
+        if (value > _max.load(std::memory_order_relaxed))
+            _max.store(value, std::memory_order_relaxed);
+    }
+
+    static int bucket(uint64_t value)
+    {
+        if (value < 8)
+            return int(value);
+        int log = highest_bit(value);
+        return log * 8 + int((value >> (log - 3)) & 7);
+    }
+
+    // Largest value that falls into the bucket
+    static double bucket_top(int bucket)
+    {
+        if (bucket < 8)
+            return bucket;
+        int log = bucket / 8;
+        return double(uint64_t(8 + bucket % 8 + 1) << (log - 3)) - 1.;
+    }
+
+private:
+    friend struct stage_summary;
+
+    static void bump(std::atomic<uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static int highest_bit(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return int(index);
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+    std::atomic<uint64_t> _buckets[bucket_count] = {};
+    std::atomic<uint64_t> _count{ 0 };
+    std::atomic<uint64_t> _max{ 0 };
+};
+
+// Histograms of several threads added up, for reporting
+struct stage_summary
+{
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(stage_histogram::bucket_count);
+    uint64_t count = 0;
+    uint64_t max = 0;
+
+    void add(const stage_histogram& h)
+    {
+        for (int i = 0; i < stage_histogram::bucket_count; i++)
+            buckets[i] += h._buckets[i].load(std::memory_order_relaxed);
+        count += h._count.load(std::memory_order_relaxed);
+        max = std::max(max, h._max.load(std::memory_order_relaxed));
+    }
+
+    // In recorded units; 0 when empty
+    double percentile(double p) const
+    {
+        if (!count)
+            return 0.;
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100. * count))), seen = 0;
+        for (int i = 0; i < stage_histogram::bucket_count; i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::min(double(max), stage_histogram::bucket_top(i));
+        }
+        return double(max);
+    }
+};
+
+class stage_profiler
+{
+public:
+    static const int max_channels = 64;
+    static const int stage_count = int(pipeline_stage::count);
+
+    stage_profiler()
+        : _id(next_id()), _names(std::make_shared<channel_map>()),
+          _start_ticks(stage_ticks()), _start(std::chrono::steady_clock::now())
+    {
+    }
+
+    // Id for a serial + stream, to pass to record(); -1 once max_channels are taken.
+    // Lookups of known channels take no lock, but callers on a hot path should keep the id.
+    int channel(const std::string& serial, const std::string& stream)
+    {
+        auto key = std::make_pair(serial, stream);
+        auto names = std::atomic_load(&_names);
+        auto it = names->find(key);
+        if (it != names->end())
+            return it->second;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        names = std::atomic_load(&_names);
+        it = names->find(key);
+        if (it != names->end())
+            return it->second;
+        if (int(_channels.size()) >= max_channels)
+            return -1;
+        auto updated = std::make_shared<channel_map>(*names);
+        (*updated)[key] = int(_channels.size());
+        _channels.push_back(key);
+        std::atomic_store(&_names, std::shared_ptr<const channel_map>(updated));
+        return int(_channels.size()) - 1;
+    }
+
+    // start and end from stage_ticks(); arrival_ms is TIME_OF_ARRIVAL, 0 if unknown
+    void record(int channel, pipeline_stage stage, uint64_t start, uint64_t end, double arrival_ms = 0)
+    {
+        if (channel < 0 || channel >= max_channels)
+            return;
+        auto& slot = local_slot();
+        auto& cell = slot.cell(channel, stage);
+        cell.duration.add(end > start ? end - start : 0);
+        if (arrival_ms > 0)
+        {
+            double age_us = (host_time_ms() - arrival_ms) * 1000.;
+            cell.age_us.add(age_us > 0 ? uint64_t(age_us) : 0);
+        }
+        if (!slot.trace.empty())
+        {
+            uint64_t n = slot.trace_written.load(std::memory_order_relaxed);
+            slot.trace[n % slot.trace.size()] = trace_event{ start, end, int16_t(channel), uint8_t(stage) };
+            slot.trace_written.store(n + 1, std::memory_order_release);
+        }
+    }
+
+    // Contents of a JSON string: quotes and backslashes escaped, control characters blanked
+    static std::string json_escape(const std::string& s)
+    {
+        std::string out;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+        }
+        return out;
+    }
+
+    // Names the calling thread in traces; cheap after the first call
+    void name_thread(const std::string& name)
+    {
+        auto& slot = local_slot();
+        if (slot.named)
+            return;
+        std::lock_guard<std::mutex> lock(_mutex);
+        slot.name = name;
+        slot.named = true;
+    }
+
+    // Every thread that records afterwards keeps its last `events_per_thread` spans.
+    // Call before capture starts; threads already recording are not traced.
+    void enable_trace(size_t events_per_thread)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _trace_capacity = events_per_thread;
+    }
+
+    // One line per channel: p50/p99 of every stage seen, then the frame age after the last one
+    std::string report_text() const
+    {
+        std::string out;
+        double us_per_tick = 1. / ticks_per_us();
+        for (auto&& c : summarize())
+        {
+            char line[256];
+            snprintf(line, sizeof(line), "stage sn: %s %s", c.serial.c_str(), c.stream.c_str());
+            out += line;
+            const stage_summary* last_age = nullptr;
+            for (int s = 0; s < stage_count; s++)
+            {
+                if (!c.duration[s].count)
+                    continue;
+                snprintf(line, sizeof(line), " %s=%.3f/%.3fms", pipeline_stage_name(pipeline_stage(s)),
+                    c.duration[s].percentile(50) * us_per_tick / 1000., c.duration[s].percentile(99) * us_per_tick / 1000.);
+                out += line;
+                if (c.age_us[s].count)
+                    last_age = &c.age_us[s];
+            }
+            if (last_age)
+            {
+                snprintf(line, sizeof(line), " age=%.1f/%.1fms", last_age->percentile(50) / 1000., last_age->percentile(99) / 1000.);
+                out += line;
+            }
+            out += "\n";
+        }
+        return out;
+    }
+
+    std::string report_json() const
+    {
+        double us_per_tick = 1. / ticks_per_us();
+        std::string out = "{\"channels\": [";
+        bool first_channel = true;
+        for (auto&& c : summarize())
+        {
+            out += first_channel ? "\n" : ",\n";
+            first_channel = false;
+            out += " {\"serial\": \"" + json_escape(c.serial) + "\", \"stream\": \"" + json_escape(c.stream) + "\", \"stages\": {";
+            bool first_stage = true;
+            for (int s = 0; s < stage_count; s++)
+            {
+                auto& d = c.duration[s];
+                auto& a = c.age_us[s];
+                if (!d.count)
+                    continue;
+                char text[512];
+                snprintf(text, sizeof(text),
+                    "%s\"%s\": {\"count\": %llu, \"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, "
+                    "\"age_count\": %llu, \"age_p50_ms\": %.3f, \"age_p99_ms\": %.3f}",
+                    first_stage ? "" : ", ", pipeline_stage_name(pipeline_stage(s)), (unsigned long long)d.count,
+                    d.percentile(50) * us_per_tick, d.percentile(90) * us_per_tick, d.percentile(99) * us_per_tick,
+                    d.max * us_per_tick, (unsigned long long)a.count, a.percentile(50) / 1000., a.percentile(99) / 1000.);
+                out += text;
+                first_stage = false;
+            }
+            out += "}}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    // Replaces the file as a whole, so a reader polling it never sees half a report
+    bool write_report(const std::string& path) const
+    {
+        std::string tmp = path + ".tmp";
+        {
+            std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(tmp.c_str(), "w"), fclose);
+            if (!file)
+                return false;
+            auto json = report_json();
+            if (fwrite(json.data(), 1, json.size(), file.get()) != json.size())
+                return false;
+        }
+        std::remove(path.c_str()); // rename does not replace on Windows
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    // Spans still being overwritten while this runs may come out torn; write the trace
+    // once capture has stopped for an exact one
+    bool write_chrome_trace(const std::string& path) const
+    {
+        std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(path.c_str(), "w"), fclose);
+        if (!file)
+            return false;
+        double us_per_tick = 1. / ticks_per_us();
+        std::lock_guard<std::mutex> lock(_mutex);
+        fprintf(file.get(), "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for (size_t t = 0; t < _slots.size(); t++)
+        {
+            auto& slot = *_slots[t];
+            if (!slot.name.empty())
+            {
+                fprintf(file.get(), "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", t, json_escape(slot.name).c_str());
+                first = false;
+            }
+            uint64_t written = slot.trace_written.load(std::memory_order_acquire);
+            uint64_t begin = written > slot.trace.size() ? written - slot.trace.size() : 0;
+            for (uint64_t i = begin; i < written; i++)
+            {
+                auto& e = slot.trace[i % slot.trace.size()];
+                if (e.channel < 0 || e.channel >= int16_t(_channels.size()) || e.start < _start_ticks)
+                    continue;
+                fprintf(file.get(), "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %zu, "
+                    "\"args\": {\"serial\": \"%s\", \"stream\": \"%s\"}}",
+                    first ? "" : ",\n", pipeline_stage_name(pipeline_stage(e.stage)), pipeline_stage_name(pipeline_stage(e.stage)),
+                    (e.start - _start_ticks) * us_per_tick, (e.end - e.start) * us_per_tick, t,
+                    json_escape(_channels[e.channel].first).c_str(), json_escape(_channels[e.channel].second).c_str());
+                first = false;
+            }
+        }
+        fprintf(file.get(), "\n]}\n");
+        return !ferror(file.get());
+    }
+
+    // Clock ticks per microsecond, measured since the profiler was created
+    double ticks_per_us() const
+    {
+#ifdef STAGE_PROFILER_TSC
+        using namespace std::chrono;
+        auto elapsed = steady_clock::now() - _start;
+        if (elapsed < milliseconds(20)) // too short to tell; wait a little for a usable estimate
+            std::this_thread::sleep_for(milliseconds(20) - elapsed);
+        uint64_t ticks = stage_ticks();
+        double us = duration<double, std::micro>(steady_clock::now() - _start).count();
+        return (ticks - _start_ticks) / us;
+#else
+        return 1000.;
+#endif
+    }
+
+private:
+    typedef std::map<std::pair<std::string, std::string>, int> channel_map;
+
+    struct stage_cell
+    {
+        stage_histogram duration;   // ticks
+        stage_histogram age_us;
+    };
+
+    struct trace_event
+    {
+        uint64_t start, end;
+        int16_t channel;
+        uint8_t stage;
+    };
+
+    // Everything one thread records. Cells are allocated by the owning thread on first
+    // use and published through the atomic pointer for readers.
+    struct thread_slot
+    {
+        explicit thread_slot(size_t trace_capacity) : trace(trace_capacity) {}
+
+        ~thread_slot()
+        {
+            for (auto&& c : cells)
+                delete c.load();
+        }
+
+        stage_cell& cell(int channel, pipeline_stage stage)
+        {
+            auto& p = cells[channel * stage_count + int(stage)];
+            auto c = p.load(std::memory_order_relaxed);
+            if (!c)
+            {
+                c = new stage_cell();
+                p.store(c, std::memory_order_release);
+            }
+            return *c;
+        }
+
+        std::atomic<stage_cell*> cells[max_channels * stage_count] = {};
+        std::vector<trace_event> trace;
+        std::atomic<uint64_t> trace_written{ 0 };
+        std::string name;   // under the profiler's _mutex
+        bool named = false; // owning thread only
+    };
+
+    struct channel_summary
+    {
+        std::string serial, stream;
+        stage_summary duration[stage_count];
+        stage_summary age_us[stage_count];
+    };
+
+    std::vector<channel_summary> summarize() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<channel_summary> out(_channels.size());
+        for (size_t c = 0; c < _channels.size(); c++)
+        {
+            out[c].serial = _channels[c].first;
+            out[c].stream = _channels[c].second;
+            for (auto&& slot : _slots)
+            {
+                for (int s = 0; s < stage_count; s++)
+                {
+                    auto cell = slot->cells[c * stage_count + s].load(std::memory_order_acquire);
+                    if (!cell)
+                        continue;
+                    out[c].duration[s].add(cell->duration);
+                    out[c].age_us[s].add(cell->age_us);
+                }
+            }
+        }
+        return out;
+    }
+
+    // The calling thread's slot; registered on the thread's first record with this profiler.
+    // The cache holds one entry per profiler the thread records with (ids are never reused,
+    // so an entry of a destroyed profiler is never matched again).
+    thread_slot& local_slot()
+    {
+        struct cached_slot { uint64_t owner; thread_slot* slot; };
+        static thread_local std::vector<cached_slot> cache;
+        for (auto&& c : cache)
+        {
+            if (c.owner == _id)
+                return *c.slot;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _slots.emplace_back(new thread_slot(_trace_capacity));
+        cache.push_back(cached_slot{ _id, _slots.back().get() });
+        return *cache.back().slot;
+    }
+
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> id{ 0 };
+        return ++id;
+    }
+
+    const uint64_t _id;     // tells this profiler's thread slots from an earlier one's
+    mutable std::mutex _mutex;
+    std::shared_ptr<const channel_map> _names;                // read/written with std::atomic_load/store
+    std::vector<std::pair<std::string, std::string>> _channels; // by id, under _mutex
+    std::vector<std::unique_ptr<thread_slot>> _slots;
+    size_t _trace_capacity = 0;
+    uint64_t _start_ticks;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Records the enclosing scope as one stage of a channel
+class stage_timer
+{
+public:
+    stage_timer(stage_profiler& profiler, int channel, pipeline_stage stage, double arrival_ms = 0)
+        : _profiler(profiler), _channel(channel), _stage(stage), _arrival_ms(arrival_ms), _start(stage_ticks())
+    {
+    }
+
+    ~stage_timer()
+    {
+        _profiler.record(_channel, _stage, _start, stage_ticks(), _arrival_ms);
+    }
+
+    stage_timer(const stage_timer&) = delete;
+    stage_timer& operator=(const stage_timer&) = delete;
+
+private:
+    stage_profiler& _profiler;
+    int _channel;
+    pipeline_stage _stage;
+    double _arrival_ms;
+    uint64_t _start;
+};
+
+// TIME_OF_ARRIVAL of a frame in host milliseconds, 0 when the frame does not carry it
+inline double frame_arrival_ms(const rs2::frame& f)
+{
+    return (f && f.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL))
+        ? double(f.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL)) : 0.;
+}